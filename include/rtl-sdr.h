@@ -192,6 +192,29 @@ RTLSDR_API int rtlsdr_set_center_freq64(rtlsdr_dev_t *dev, uint64_t freq);
  */
 RTLSDR_API int rtlsdr_set_harmonic_rx(rtlsdr_dev_t *dev, int harmonic);
 
+/*!
+ * Set a fine frequency offset relative to the center frequency - without retuning.
+ * The offset is applied phase-continuous through the RTL2832's digital down converter (DDC).
+ * The tuner PLL is only retuned, when the offset leaves the inner half of the
+ * usable bandwidth (tuner bandwidth or samplerate).
+ * Use it for drift compensation or doppler tracking.
+ * The offset is kept over following rtlsdr_set_center_freq() calls.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param offset in Hz. positive values shift reception to higher frequencies. 0 to deactivate
+ * \return 0 on success
+ * \return < 0 if device handle is invalid or some other error
+ */
+RTLSDR_API int rtlsdr_set_fine_offset(rtlsdr_dev_t *dev, int32_t offset);
+
+/*!
+ * Get fine frequency offset set with rtlsdr_set_fine_offset()
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return fine offset in Hz, 0 on error
+ */
+RTLSDR_API int32_t rtlsdr_get_fine_offset(rtlsdr_dev_t *dev);
+
 /*!
  * Check, if tuner PLL (frequency) is still locked.
  * Tuner/PLL might loose lock (at high frequencies),
@@ -411,6 +434,17 @@ RTLSDR_API int rtlsdr_set_sample_rate(rtlsdr_dev_t *dev, uint32_t rate);
  */
 RTLSDR_API uint32_t rtlsdr_get_sample_rate(rtlsdr_dev_t *dev);
 
+/*!
+ * Get the sample rate of the data delivered by rtlsdr_read_sync()
+ * and rtlsdr_read_async(): half the configured one,
+ * while rtlsdr_set_ds_decimation() is effective.
+ * Applies the options of the environment variable LIBRTLSDR_OPT first.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return 0 on error, sample rate in Hz otherwise
+ */
+RTLSDR_API uint32_t rtlsdr_get_delivered_sample_rate(rtlsdr_dev_t *dev);
+
 /*!
  * Enable test mode that returns an 8 bit counter instead of the samples.
  * The counter is generated inside the RTL2832.
@@ -470,6 +504,23 @@ enum rtlsdr_ds_mode {
  */
 RTLSDR_API int rtlsdr_set_ds_mode(rtlsdr_dev_t *dev, enum rtlsdr_ds_mode mode, uint32_t freq_threshold);
 
+/*!
+ * Enable or disable halfband filtering and decimation by 2 in direct sampling mode.
+ * rtlsdr_read_async() delivers half the data, rtlsdr_read_sync() reads twice
+ * the requested length from the device. Either way consumers have to use
+ * rtlsdr_get_delivered_sample_rate(): half the rate of rtlsdr_set_sample_rate().
+ * Passband is +/- samplerate/8 of the configured samplerate.
+ * Has no effect, while direct sampling is inactive, and with the automatic
+ * modes of rtlsdr_set_ds_mode(), where the delivered samplerate would
+ * change whenever a retune crosses the threshold.
+ * Can't be changed while rtlsdr_read_async() is running.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param on 0 means disabled, 1 enabled
+ * \return 0 on success, -2 while streaming asynchronously
+ */
+RTLSDR_API int rtlsdr_set_ds_decimation(rtlsdr_dev_t *dev, int on);
+
 /*!
  * Enable or disable offset tuning for zero-IF tuners, which allows to avoid
  * problems caused by the DC offset of the ADCs and 1/f noise.
@@ -499,6 +550,18 @@ RTLSDR_API int rtlsdr_get_offset_tuning(rtlsdr_dev_t *dev);
  */
 RTLSDR_API int rtlsdr_set_dithering(rtlsdr_dev_t *dev, int dither);
 
+/*!
+ * Force a new filter calibration of the R820T/R828D tuner.
+ * The calibration result is cached per device handle and reused on
+ * tuner re-initialization, e.g. when leaving direct sampling mode.
+ * The cache is also dropped, when the PLL fails to lock.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return 0 on success, 1 for tuners without filter calibration
+ * \return < 0 on error
+ */
+RTLSDR_API int rtlsdr_recalibrate_tuner_filter(rtlsdr_dev_t *dev);
+
 /* streaming functions */
 
 
@@ -566,6 +629,53 @@ RTLSDR_API int rtlsdr_read_async(rtlsdr_dev_t *dev,
  */
 RTLSDR_API int rtlsdr_cancel_async(rtlsdr_dev_t *dev);
 
+typedef void(*rtlsdr_spectrum_cb_t)(const float *bins_db, uint32_t fft_size, void *ctx);
+
+/*!
+ * Deliver periodic spectrum snapshots from the streaming data of rtlsdr_read_async().
+ * A worker thread calculates an average over 8 Hann windowed FFTs,
+ * from segments captured over the stream, and delivers the power in dB,
+ * relative to full scale. Bins are ordered from -samplerate/2 to +samplerate/2.
+ * The main callback is not disturbed; snapshots are skipped,
+ * while the worker is still busy with the previous one.
+ * The tap sees the samples before the decimation of rtlsdr_set_ds_decimation(),
+ * at the samplerate set with rtlsdr_set_sample_rate().
+ * Can be called while rtlsdr_read_async() is running, but not from
+ * the spectrum callback itself.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param fft_size number of bins: power of 2 in 16 .. 65536. 0 deactivates the tap
+ * \param interval_ms minimum time between snapshots in ms
+ * \param cb callback function receiving the bins. NULL deactivates the tap
+ * \param ctx user specific context to pass via the callback function
+ * \return 0 on success
+ * \return -2 if fft_size is invalid
+ * \return -4 with RPC, where the callbacks are not available
+ */
+RTLSDR_API int rtlsdr_set_spectrum_tap(rtlsdr_dev_t *dev, uint32_t fft_size, uint32_t interval_ms,
+				       rtlsdr_spectrum_cb_t cb, void *ctx);
+
+struct rtlsdr_usb_stats {
+	uint32_t ctrl_in;		/* control transfers reading registers */
+	uint32_t ctrl_out;		/* control transfers writing registers */
+	uint32_t ctrl_errors;	/* failed control transfers */
+	uint32_t bulk_sync;		/* bulk transfers from rtlsdr_read_sync() */
+	uint32_t bulk_async;	/* completed bulk transfers from rtlsdr_read_async() */
+	uint32_t bulk_errors;	/* failed bulk transfers */
+	uint64_t bulk_bytes;	/* received bytes from bulk transfers */
+};
+
+/*!
+ * Get USB transfer statistics of the device, e.g. to count the
+ * control transfers required for an API call.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param stats pointer to receive the counters, may be NULL
+ * \param reset 1 to reset the counters after reading
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_get_usb_stats(rtlsdr_dev_t *dev, struct rtlsdr_usb_stats *stats, int reset);
+
 /*!
  * Read from the remote control (RC) infrared (IR) sensor
  *
@@ -658,6 +768,7 @@ RTLSDR_API int rtlsdr_set_gpio_status(rtlsdr_dev_t *dev, int *status );
  *   value 1 to enable. 0 to disable.
  * option 'ds' set direct sampling as with rtlsdr_set_direct_sampling():
  *   '0' to deactivate, '1' or 'i' for I-ADC input, '2' or 'q' for Q-ADC input
+ * option 'dsdec' activates decimation by 2 in direct sampling as with rtlsdr_set_ds_decimation()
  * option 't' or 'T' for enabling bias tee on GPIO PIN 0 as with rtlsdr_set_bias_tee():
  *   '1' for Bias T on. '0' for Bias T off.
  *
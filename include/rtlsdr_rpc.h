@@ -12,6 +12,8 @@ extern "C" {
 typedef void (*rtlsdr_rpc_read_async_cb_t)
 (unsigned char*, uint32_t, void*);
 
+struct rtlsdr_usb_stats;
+
 uint32_t rtlsdr_rpc_get_device_count(void);
 
 const char* rtlsdr_rpc_get_device_name
@@ -116,6 +118,23 @@ int rtlsdr_rpc_read_async
 int rtlsdr_rpc_cancel_async
 (void* dev);
 
+int rtlsdr_rpc_set_fine_offset
+(void* dev, int32_t offset);
+
+int rtlsdr_rpc_set_ds_decimation
+(void* dev, int on);
+
+int rtlsdr_rpc_get_usb_stats
+(void* dev, struct rtlsdr_usb_stats* stats, int reset);
+
+int rtlsdr_rpc_recalibrate_tuner_filter
+(void* dev);
+
+int32_t rtlsdr_rpc_get_fine_offset
+(void* dev);
+
+uint32_t rtlsdr_rpc_get_delivered_sample_rate(void* dev);
+uint32_t rtlsdr_rpc_get_delivered_sample_rate(void* dev);
 unsigned int rtlsdr_rpc_is_enabled(void);
 
 #ifdef __cplusplus
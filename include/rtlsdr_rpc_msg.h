@@ -45,7 +45,16 @@ typedef enum
 
   /* non api operations */
   RTLSDR_RPC_OP_EVENT_STATE,
- 
+
+  /* later api operations, appended to keep the numbering */
+  RTLSDR_RPC_OP_SET_FINE_OFFSET,
+  RTLSDR_RPC_OP_SET_DS_DECIMATION,
+  RTLSDR_RPC_OP_GET_USB_STATS,
+  RTLSDR_RPC_OP_RECALIBRATE_TUNER_FILTER,
+  RTLSDR_RPC_OP_GET_FINE_OFFSET,
+  RTLSDR_RPC_OP_RTLSDR_RPC_OP_GET_DELIVERED_SAMPLE_RATE,
+  RTLSDR_RPC_OP_GET_DELIVERED_SAMPLE_RATE,
+
   RTLSDR_RPC_OP_INVALID
 } rtlsdr_rpc_op_t;
 
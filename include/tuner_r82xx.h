@@ -93,6 +93,10 @@ struct r82xx_priv {
 	int32_t						if_band_center_freq;	/* frequency relative to zero IF,
 														 * on which the band center shall be positioned */
 	uint8_t						fil_cal_code;
+	uint8_t						fil_cal_valid;	/* cached fil_cal_code is reusable .. */
+	uint8_t						fil_cal_q;		/* .. for this filter Q, */
+	enum r82xx_tuner_type		fil_cal_type;	/* standard */
+	uint32_t					fil_cal_xtal;	/* and xtal */
 	uint8_t						input;
 	uint8_t						last_vco_curr;
 	int							has_lock;
@@ -173,6 +177,8 @@ int r82xx_get_sideband(struct r82xx_priv *priv);
 /* should rtlsdr flip the spectrum? */
 int r82xx_flip_rtl_sideband(struct r82xx_priv *priv);
 int r82xx_set_dither(struct r82xx_priv *priv, int dither);
+/* drop the cached filter calibration and calibrate again */
+int r82xx_recalibrate_filter(struct r82xx_priv *priv);
 
 int r82xx_read_cache_reg(struct r82xx_priv *priv, int reg);
 int r82xx_write_reg_mask(struct r82xx_priv *priv, uint8_t reg, uint8_t val,uint8_t bit_mask);
@@ -28,7 +28,14 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #else
 #include <windows.h>
 #include <fcntl.h>
@@ -320,4 +327,199 @@ void executeInBackground( char * file, char * args, char * searchStr[], char * r
 #endif
 
 
+#ifndef _WIN32
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_SINK_CHILDREN	4
+
+/* handlers started for 'pipe:' sinks, reaped in closeEventSink() */
+static struct {
+	int fd;
+	pid_t pid;
+} sinkChildren[MAX_SINK_CHILDREN];
+static int numSinkChildren = 0;
+
+static int setupSinkFd(int fd, int isSocket)
+{
+	int fl = fcntl(fd, F_GETFL);
+	if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0
+		|| fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (isSocket) {
+		/* room for bursts of records while the consumer is busy */
+		int sndbuf = 1 << 20;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+#ifdef SO_NOSIGPIPE
+		sndbuf = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &sndbuf, sizeof(sndbuf));
+#endif
+	}
+	return fd;
+}
+
+int openEventSink(const char * spec, int * isSocket)
+{
+	int fd, sv[2];
+	pid_t pid;
+	*isSocket = 0;
+	if (!strncmp(spec, "pipe:", 5)) {
+		if (numSinkChildren >= MAX_SINK_CHILDREN) {
+			fprintf(stderr, "error: too many pipe sinks for '%s'!\n", spec + 5);
+			return -1;
+		}
+		/* socketpair instead of pipe(): send() can avoid SIGPIPE */
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+			fprintf(stderr, "error: socketpair for '%s' failed!\n", spec + 5);
+			return -1;
+		}
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "error: fork for '%s' failed!\n", spec + 5);
+			close(sv[0]);
+			close(sv[1]);
+			return -1;
+		}
+		if (pid == 0) {
+			/* records on stdin. stdout might carry our audio */
+			close(sv[0]);
+			dup2(sv[1], STDIN_FILENO);
+			if (sv[1] != STDIN_FILENO)
+				close(sv[1]);
+			dup2(STDERR_FILENO, STDOUT_FILENO);
+			execl("/bin/sh", "sh", "-c", spec + 5, (char *)NULL);
+			fprintf(stderr, "error: execl of '%s' failed!\n", spec + 5);
+			exit(10);
+		}
+		close(sv[1]);
+		*isSocket = 1;
+		fd = setupSinkFd(sv[0], 1);
+		if (fd < 0) {
+			kill(pid, SIGTERM);
+			waitpid(pid, NULL, 0);
+			return -1;
+		}
+		sinkChildren[numSinkChildren].fd = fd;
+		sinkChildren[numSinkChildren].pid = pid;
+		numSinkChildren++;
+		return fd;
+	}
+	if (!strncmp(spec, "unix:", 5)) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(spec + 5) >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "error: socket path '%s' too long!\n", spec + 5);
+			return -1;
+		}
+		strcpy(addr.sun_path, spec + 5);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			fprintf(stderr, "error: connect to '%s' failed!\n", spec + 5);
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+		*isSocket = 1;
+		return setupSinkFd(fd, 1);
+	}
+	/* file or fifo. read access keeps a fifo open without reader:
+	 * no blocking open(), no SIGPIPE - records queue up in the fifo */
+	fd = open(spec, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "error: open of '%s' failed!\n", spec);
+		return -1;
+	}
+	return setupSinkFd(fd, 0);
+}
+
+int writeEventRecord(int fd, int isSocket, const char * rec, int len)
+{
+	int r, done = 0, retries = 0;
+	while (done < len) {
+		if (isSocket)
+			r = (int)send(fd, rec + done, len - done, MSG_NOSIGNAL);
+		else
+			r = (int)write(fd, rec + done, len - done);
+		if (r > 0) {
+			done += r;
+			continue;
+		}
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (!done)
+				return 0;	/* consumer is busy: drop the whole record */
+			if (++retries > 100)
+				return -1;
+			usleep(1000);	/* finish a partially written record */
+			continue;
+		}
+		return -1;
+	}
+	return 1;
+}
+
+void closeEventSink(int fd)
+{
+	int k, t;
+	pid_t pid = 0;
+	if (fd < 0)
+		return;
+	close(fd);
+	for (k = 0; k < numSinkChildren; k++) {
+		if (sinkChildren[k].fd == fd) {
+			pid = sinkChildren[k].pid;
+			sinkChildren[k] = sinkChildren[--numSinkChildren];
+			break;
+		}
+	}
+	if (pid <= 0)
+		return;
+	/* the handler sees end of input: give it a second to finish */
+	for (t = 0; t < 100; t++) {
+		if (waitpid(pid, NULL, WNOHANG) != 0)
+			return;
+		usleep(10000);
+	}
+	fprintf(stderr, "event sink handler %d did not exit, terminating it.\n", (int)pid);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+#else
+
+int openEventSink(const char * spec, int * isSocket)
+{
+	int fd;
+	*isSocket = 0;
+	if (!strncmp(spec, "pipe:", 5) || !strncmp(spec, "unix:", 5)) {
+		fprintf(stderr, "error: event sink '%s' is not supported on this platform!\n", spec);
+		return -1;
+	}
+	fd = _open(spec, _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, 0644);
+	if (fd < 0)
+		fprintf(stderr, "error: open of '%s' failed!\n", spec);
+	return fd;
+}
+
+int writeEventRecord(int fd, int isSocket, const char * rec, int len)
+{
+	(void)isSocket;
+	return (_write(fd, rec, len) == len) ? 1 : -1;
+}
+
+void closeEventSink(int fd)
+{
+	if (fd >= 0)
+		_close(fd);
+}
+
+#endif
+
+
 // vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
@@ -61,6 +61,30 @@ time_t localtimestr_to_time(const char * str, double * fraction);
 
 void executeInBackground( char * file, char * args, char * searchStr[], char * replaceStr[] );
 
+/*!
+ * Open a long-lived, non-blocking sink for event records
+ *
+ * \param spec "pipe:command" starts command once with stdin connected to the sink
+ *        and stdout to stderr, closeEventSink() waits for it to exit,
+ *        "unix:path" connects to a listening unix domain stream socket,
+ *        anything else is opened as file or fifo (appending)
+ * \param isSocket set to 1 when the sink is a socket
+ * \return file descriptor or -1 on error
+ */
+
+int openEventSink(const char * spec, int * isSocket);
+
+/*!
+ * Write one record without blocking on a busy consumer
+ *
+ * \return 1 when written, 0 when dropped because the consumer is busy,
+ *         -1 when the sink is broken
+ */
+
+int writeEventRecord(int fd, int isSocket, const char * rec, int len);
+
+void closeEventSink(int fd);
+
 
 #ifdef __cplusplus
 }
@@ -44,6 +44,8 @@ typedef int socklen_t;
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
 
 #ifndef _WIN32
 #define min(a, b) (((a) < (b)) ? (a) : (b))
@@ -157,6 +159,20 @@ static const int fir_default[FIR_LEN] = {
 };
 
 
+#define DS_HB_LEN 15
+
+/*
+ * Halfband lowpass for decimation by 2 in direct sampling mode.
+ *
+ * Kaiser window (beta 6) with 15 taps, scaled by 2^15. Every second
+ * coefficient is zero, except the center tap. Only the non-zero
+ * coefficients of one half are specified, the outer one first.
+ * Passband is +/- samplerate/8, stopband attenuation ~46 dB.
+ */
+static const int ds_hb_coef[DS_HB_LEN / 4 + 1] = { -22, 417, -2055, 9856 };
+#define DS_HB_CENTER	16376
+
+
 enum softagc_mode {
 	SOFTAGC_OFF = 0,	/* off */
 	SOFTAGC_ON_CHANGE,	/* activate on initial start and on relevant changes .. and deactivate afterwards */
@@ -200,6 +216,32 @@ struct softagc_state {
 	int *	rpcGainValues;
 };
 
+#define SPECTRUM_TAP_AVG	8	/* number of averaged FFTs per snapshot */
+
+struct spectrum_tap_state {
+	pthread_t		thread;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	volatile int	active;
+	int				exit_thread;
+	int				ready;		/* capture buffer is complete: worker computes */
+
+	rtlsdr_spectrum_cb_t	cb;
+	void *			cb_ctx;
+	uint32_t		fft_size;
+	int				log2_size;
+	uint32_t		interval_ms;
+
+	int64_t			due_sps;	/* samples until next snapshot starts */
+	uint32_t		fill_sps;	/* samples already captured for this snapshot */
+	unsigned char *	capture;	/* SPECTRUM_TAP_AVG * fft_size I/Q samples */
+
+	float *			window;
+	float *			twiddle;	/* cos/sin pairs */
+	float *			work;		/* complex FFT buffer */
+	float *			power;		/* accumulated power, then dB */
+};
+
 struct rtlsdr_dev {
 	libusb_context *ctx;
 	struct libusb_device_handle *devh;
@@ -226,6 +268,9 @@ struct rtlsdr_dev {
 	uint32_t bw;
 	uint32_t offs_freq; /* Hz */
 	int32_t  if_band_center_freq; /* Hz - rtlsdr_set_tuner_band_center() */
+	uint32_t if_freq; /* Hz - last IF requested with rtlsdr_set_if_freq(), without fine offset */
+	int32_t  fine_offset; /* Hz - rtlsdr_set_fine_offset() */
+	int32_t  fine_tuner_offset; /* Hz - part of fine_offset, which is applied through tuner PLL */
 	int      tuner_if_freq;
 	int      tuner_sideband;
 	int      rtl_spectrum_sideband;  /* buffered last sideband. 1: LSB; 2: USB */
@@ -233,11 +278,22 @@ struct rtlsdr_dev {
 	/* int gain; * tenth dB */
 	enum rtlsdr_ds_mode direct_sampling_mode;
 	uint32_t direct_sampling_threshold; /* Hz */
+	/* decimation by 2 in direct sampling mode - rtlsdr_set_ds_decimation() */
+	int ds_decimation;
+	int ds_hb_pos;
+	int ds_hb_phase;
+	int ds_hb_i[2 * DS_HB_LEN];
+	int ds_hb_q[2 * DS_HB_LEN];
+	unsigned char *ds_sync_buf;	/* rtlsdr_read_sync() reads twice the length */
+	uint32_t ds_sync_len;
 	struct e4k_state e4k_s;
 	struct r82xx_config r82xx_c;
 	struct r82xx_priv r82xx_p;
 	/* soft tuner agc */
 	struct softagc_state softagc;
+	/* periodic spectrum snapshots - rtlsdr_set_spectrum_tap() */
+	struct spectrum_tap_state spec;
+	pthread_mutex_t spec_lock;	/* held by the callback while feeding the tap */
 
 	/* -cs- Concurrent lock for the periodic reading of I2C registers */
 	pthread_mutex_t cs_mutex;
@@ -272,6 +328,9 @@ struct rtlsdr_dev {
 
 	int called_set_opt;
 
+	/* usb transfer statistics - rtlsdr_get_usb_stats() */
+	struct rtlsdr_usb_stats usb_stats;
+
 	/* status */
 	int dev_lost;
 	int driver_active;
@@ -290,6 +349,18 @@ static int rtlsdr_set_spectrum_inversion(rtlsdr_dev_t *dev, int sideband);
 static void softagc_init(rtlsdr_dev_t *dev);
 static void softagc_uninit(rtlsdr_dev_t *dev);
 static int reactivate_softagc(rtlsdr_dev_t *dev, enum softagc_stateT newState);
+static uint32_t ds_decimate(rtlsdr_dev_t *dev, unsigned char *buf, uint32_t len);
+
+/* only with static direct sampling: automatic switching would change
+ * the delivered samplerate with every retune across the threshold */
+static inline int ds_decimating(rtlsdr_dev_t *dev)
+{
+	return dev->ds_decimation && dev->direct_sampling
+		&& dev->direct_sampling_mode <= RTLSDR_DS_Q;
+}
+static void spectrum_tap_feed(rtlsdr_dev_t *dev, const unsigned char *buf, uint32_t len);
+static void spectrum_tap_uninit(rtlsdr_dev_t *dev);
+static void rtlsdr_process_env_opts(rtlsdr_dev_t *dev);
 
 /* generic tuner interface functions, shall be moved to the tuner implementations */
 int e4000_init(void *dev) {
@@ -715,6 +786,21 @@ static rtlsdr_dongle_t known_devices[] = {
 #define CTRL_TIMEOUT	300
 #define BULK_TIMEOUT	0
 
+/* all control transfers to the RTL2832 go through here - for the statistics */
+static int rtlsdr_ctrl_transfer(rtlsdr_dev_t *dev, uint8_t type, uint16_t addr, uint16_t index,
+				unsigned char *data, uint16_t len)
+{
+	int r = libusb_control_transfer(dev->devh, type, 0, addr, index, data, len, CTRL_TIMEOUT);
+
+	if (type == CTRL_IN)
+		++dev->usb_stats.ctrl_in;
+	else
+		++dev->usb_stats.ctrl_out;
+	if (r < 0)
+		++dev->usb_stats.ctrl_errors;
+	return r;
+}
+
 #define EEPROM_ADDR	0xa0
 
 enum usb_reg {
@@ -815,7 +901,7 @@ int rtlsdr_read_array(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint8_t *
 	uint16_t index = (block << 8);
 	if (block == IRB) index = (SYSB << 8) | 0x01;
 
-	r = libusb_control_transfer(dev->devh, CTRL_IN, 0, addr, index, array, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_IN, addr, index, array, len);
 #if 0
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -829,7 +915,7 @@ int rtlsdr_write_array(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint8_t
 	uint16_t index = (block << 8) | 0x10;
 	if (block == IRB) index = (SYSB << 8) | 0x11;
 
-	r = libusb_control_transfer(dev->devh, CTRL_OUT, 0, addr, index, array, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_OUT, addr, index, array, len);
 #if 0
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -886,7 +972,7 @@ uint16_t rtlsdr_read_reg(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint8_
 	uint16_t index = (block << 8);
 	if (block == IRB) index = (SYSB << 8) | 0x01;
 
-	r = libusb_control_transfer(dev->devh, CTRL_IN, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_IN, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -911,7 +997,7 @@ int rtlsdr_write_reg(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint16_t v
 
 	data[1] = val & 0xff;
 
-	r = libusb_control_transfer(dev->devh, CTRL_OUT, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_OUT, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -928,7 +1014,7 @@ uint16_t rtlsdr_demod_read_reg(rtlsdr_dev_t *dev, uint8_t page, uint16_t addr, u
 	uint16_t reg;
 	addr = (addr << 8) | 0x20;
 
-	r = libusb_control_transfer(dev->devh, CTRL_IN, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_IN, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -952,7 +1038,7 @@ int rtlsdr_demod_write_reg(rtlsdr_dev_t *dev, uint8_t page, uint16_t addr, uint1
 
 	data[1] = val & 0xff;
 
-	r = libusb_control_transfer(dev->devh, CTRL_OUT, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_OUT, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -1182,6 +1268,19 @@ int rtlsdr_deinit_baseband(rtlsdr_dev_t *dev)
 	return r;
 }
 
+/* residual of the fine offset, which has to be applied in the DDC */
+static int32_t rtlsdr_fine_offset_if(rtlsdr_dev_t *dev)
+{
+	int32_t offs;
+
+	if (dev->direct_sampling)
+		return dev->fine_offset;
+
+	offs = dev->fine_offset - dev->fine_tuner_offset;
+	/* follow the spectrum inversion of the tuner's IF */
+	return (dev->rtl_spectrum_sideband == 1) ? -offs : offs;
+}
+
 static int rtlsdr_set_if_freq(rtlsdr_dev_t *dev, uint32_t freq)
 {
 	uint32_t rtl_xtal;
@@ -1196,6 +1295,8 @@ static int rtlsdr_set_if_freq(rtlsdr_dev_t *dev, uint32_t freq)
 	if (rtlsdr_get_xtal_freq(dev, &rtl_xtal, NULL))
 		return -2;
 
+	dev->if_freq = freq;
+
 #ifdef WITH_UDP_SERVER
 	dev->last_if_freq = freq;
 	if ( dev->override_if_flag ) {
@@ -1208,7 +1309,7 @@ static int rtlsdr_set_if_freq(rtlsdr_dev_t *dev, uint32_t freq)
 	}
 #endif
 
-	if_freq = ((freq * TWO_POW(22)) / rtl_xtal) * (-1);
+	if_freq = (((freq + (double)rtlsdr_fine_offset_if(dev)) * TWO_POW(22)) / rtl_xtal) * (-1);
 
 	tmp = (if_freq >> 16) & 0x3f;
 	r = rtlsdr_demod_write_reg(dev, 1, 0x19, tmp, 1);
@@ -1233,6 +1334,10 @@ static int rtlsdr_set_spectrum_inversion(rtlsdr_dev_t *dev, int sideband)
 			r = rtlsdr_demod_write_reg(dev, 1, 0x15, 0x01, 1);
 
 		dev->rtl_spectrum_sideband = (r) ? 0 : (sideband + 1);
+
+		/* sign of the fine offset in the DDC depends on the inversion */
+		if (!r && dev->fine_offset != dev->fine_tuner_offset)
+			r = rtlsdr_set_if_freq(dev, dev->if_freq);
 	}
 	return r;
 }
@@ -1475,7 +1580,7 @@ int rtlsdr_set_center_freq(rtlsdr_dev_t *dev, uint32_t freq)
 		r = rtlsdr_set_if_freq(dev, freq);
 	} else if (dev->tuner && dev->tuner->set_freq) {
 		rtlsdr_set_i2c_repeater(dev, 1);
-		r = dev->tuner->set_freq(dev, freq - dev->offs_freq);
+		r = dev->tuner->set_freq(dev, freq + dev->fine_tuner_offset - dev->offs_freq);
 		rtlsdr_set_i2c_repeater(dev, 0);
 	}
 
@@ -1511,11 +1616,11 @@ int rtlsdr_set_center_freq64(rtlsdr_dev_t *dev, uint64_t freq)
 		r = rtlsdr_set_if_freq(dev, freq);
 	} else if (dev->tuner && dev->tuner->set_freq64) {
 		rtlsdr_set_i2c_repeater(dev, 1);
-		r = dev->tuner->set_freq64(dev, freq - dev->offs_freq);
+		r = dev->tuner->set_freq64(dev, (uint64_t)((int64_t)freq + dev->fine_tuner_offset) - dev->offs_freq);
 		rtlsdr_set_i2c_repeater(dev, 0);
 	} else if (dev->tuner && dev->tuner->set_freq) {
 		rtlsdr_set_i2c_repeater(dev, 1);
-		r = dev->tuner->set_freq(dev, (uint32_t)freq - dev->offs_freq);
+		r = dev->tuner->set_freq(dev, (uint32_t)freq + dev->fine_tuner_offset - dev->offs_freq);
 		rtlsdr_set_i2c_repeater(dev, 0);
 	}
 
@@ -1527,6 +1632,63 @@ int rtlsdr_set_center_freq64(rtlsdr_dev_t *dev, uint64_t freq)
 	return r;
 }
 
+int rtlsdr_set_fine_offset(rtlsdr_dev_t *dev, int32_t offset)
+{
+	int32_t residual, usable;
+	int r;
+
+	#if LOG_API_CALLS && LOG_API_SET_FREQ
+	fprintf(stderr, "LOG: rtlsdr_set_fine_offset(offset %d Hz)\n", (int)offset);
+	#endif
+
+	#ifdef _ENABLE_RPC
+	if (rtlsdr_rpc_is_enabled())
+	{
+		return rtlsdr_rpc_set_fine_offset(dev, offset);
+	}
+	#endif
+
+	if (!dev || !dev->tuner)
+		return -1;
+
+	dev->fine_offset = offset;
+	if (dev->direct_sampling)
+		return rtlsdr_set_if_freq(dev, dev->if_freq);
+
+	/* keep the wanted signal inside the inner half of the filtered band */
+	usable = (dev->bw > 0 && dev->bw < dev->rate) ? dev->bw : dev->rate;
+	usable /= 4;
+
+	residual = offset - dev->fine_tuner_offset;
+	if (residual >= -usable && residual <= usable)
+		return rtlsdr_set_if_freq(dev, dev->if_freq);
+
+	/* offset left the usable bandwidth: retune tuner PLL */
+	if (dev->verbose)
+		fprintf(stderr, "rtlsdr_set_fine_offset(%d): residual %d Hz exceeds %d Hz: retuning\n"
+			, (int)offset, (int)residual, (int)usable );
+	dev->fine_tuner_offset = offset;
+	r = rtlsdr_set_if_freq(dev, dev->if_freq);
+	if (!r && dev->freq)
+		r = rtlsdr_set_center_freq64(dev, dev->freq);
+	return r;
+}
+
+int32_t rtlsdr_get_fine_offset(rtlsdr_dev_t *dev)
+{
+	#ifdef _ENABLE_RPC
+	if (rtlsdr_rpc_is_enabled())
+	{
+	  return rtlsdr_rpc_get_fine_offset(dev);
+	}
+	#endif
+
+	if (!dev)
+		return 0;
+
+	return dev->fine_offset;
+}
+
 
 int rtlsdr_is_tuner_PLL_locked(rtlsdr_dev_t *dev)
 {
@@ -2161,6 +2323,24 @@ uint32_t rtlsdr_get_sample_rate(rtlsdr_dev_t *dev)
 	return dev->rate;
 }
 
+uint32_t rtlsdr_get_delivered_sample_rate(rtlsdr_dev_t *dev)
+{
+	if (dev && !dev->called_set_opt )
+		rtlsdr_process_env_opts(dev);
+
+	#ifdef _ENABLE_RPC
+	if (rtlsdr_rpc_is_enabled())
+	{
+	  return rtlsdr_rpc_get_delivered_sample_rate(dev);
+	}
+	#endif
+
+	if (!dev)
+		return 0;
+
+	return ds_decimating(dev) ? dev->rate / 2 : dev->rate;
+}
+
 int rtlsdr_set_testmode(rtlsdr_dev_t *dev, int on)
 {
 	#if LOG_API_CALLS
@@ -2325,6 +2505,35 @@ int rtlsdr_set_ds_mode(rtlsdr_dev_t *dev, enum rtlsdr_ds_mode mode, uint32_t fre
 	return rtlsdr_set_center_freq64(dev, center_freq);
 }
 
+int rtlsdr_set_ds_decimation(rtlsdr_dev_t *dev, int on)
+{
+	#if LOG_API_CALLS
+	fprintf(stderr, "LOG: rtlsdr_set_ds_decimation(on %d)\n", on);
+	#endif
+
+	#ifdef _ENABLE_RPC
+	if (rtlsdr_rpc_is_enabled())
+	{
+		return rtlsdr_rpc_set_ds_decimation(dev, on);
+	}
+	#endif
+
+	if (!dev)
+		return -1;
+
+	/* the callback would see the delivered rate change mid-buffer */
+	if (RTLSDR_INACTIVE != dev->async_status)
+		return -2;
+
+	/* restart with empty delay line */
+	dev->ds_hb_pos = 0;
+	dev->ds_hb_phase = 0;
+	memset(dev->ds_hb_i, 0, sizeof(dev->ds_hb_i));
+	memset(dev->ds_hb_q, 0, sizeof(dev->ds_hb_q));
+	dev->ds_decimation = on ? 1 : 0;
+	return 0;
+}
+
 static int rtlsdr_update_ds(rtlsdr_dev_t *dev, uint64_t freq)
 {
 	int new_ds = 0;
@@ -2424,6 +2633,35 @@ int rtlsdr_set_dithering(rtlsdr_dev_t *dev, int dither)
 	return 1;
 }
 
+int rtlsdr_recalibrate_tuner_filter(rtlsdr_dev_t *dev)
+{
+	int r;
+
+	#ifdef _ENABLE_RPC
+	if (rtlsdr_rpc_is_enabled())
+	{
+	  return rtlsdr_rpc_recalibrate_tuner_filter(dev);
+	}
+	#endif
+
+	if (!dev)
+		return -1;
+
+	if (dev->tuner_type != RTLSDR_TUNER_R820T && dev->tuner_type != RTLSDR_TUNER_R828D)
+		return 1;
+
+	if (dev->direct_sampling) {
+		/* tuner gets re-initialized and calibrated when leaving direct sampling */
+		dev->r82xx_p.fil_cal_valid = 0;
+		return 0;
+	}
+
+	rtlsdr_set_i2c_repeater(dev, 1);
+	r = r82xx_recalibrate_filter(&dev->r82xx_p);
+	rtlsdr_set_i2c_repeater(dev, 0);
+	return r;
+}
+
 static rtlsdr_dongle_t *find_known_device(uint16_t vid, uint16_t pid)
 {
 	unsigned int i;
@@ -3122,6 +3360,7 @@ int rtlsdr_open(rtlsdr_dev_t **out_dev, uint32_t index)
 	pthread_mutexattr_init(&dev->cs_mutex_attr);
 	pthread_mutexattr_settype(&dev->cs_mutex_attr, PTHREAD_MUTEX_RECURSIVE);
 	pthread_mutex_init(&dev->cs_mutex, &dev->cs_mutex_attr);
+	pthread_mutex_init(&dev->spec_lock, NULL);
 
 	dev->rtl_vga_control = 0;
 	dev->biast_gpio_pin_no = 0;
@@ -3455,6 +3694,9 @@ int rtlsdr_close(rtlsdr_dev_t *dev)
 	}
 
 	softagc_uninit(dev);
+	spectrum_tap_uninit(dev);
+	free(dev->ds_sync_buf);
+	pthread_mutex_destroy(&dev->spec_lock);
 	pthread_mutex_destroy(&dev->cs_mutex);
 
 	libusb_release_interface(dev->devh, 0);
@@ -3507,8 +3749,22 @@ static void rtlsdr_process_env_opts(rtlsdr_dev_t *dev)
 }
 
 
+static int rtlsdr_read_sync_raw(rtlsdr_dev_t *dev, void *buf, int len, int *n_read)
+{
+	int r = libusb_bulk_transfer(dev->devh, 0x81, buf, len, n_read, BULK_TIMEOUT);
+
+	++dev->usb_stats.bulk_sync;
+	if (r < 0)
+		++dev->usb_stats.bulk_errors;
+	else if (n_read)
+		dev->usb_stats.bulk_bytes += *n_read;
+	return r;
+}
+
 int rtlsdr_read_sync(rtlsdr_dev_t *dev, void *buf, int len, int *n_read)
 {
+	int r;
+
 	if (dev && !dev->called_set_opt )
 		rtlsdr_process_env_opts(dev);
 
@@ -3522,7 +3778,25 @@ int rtlsdr_read_sync(rtlsdr_dev_t *dev, void *buf, int len, int *n_read)
 	if (!dev)
 		return -1;
 
-	return libusb_bulk_transfer(dev->devh, 0x81, buf, len, n_read, BULK_TIMEOUT);
+	if (!ds_decimating(dev))
+		return rtlsdr_read_sync_raw(dev, buf, len, n_read);
+
+	/* read twice the length, that the caller gets len after decimation */
+	if (len < 0)
+		return -1;
+	if (dev->ds_sync_len < 2 * (uint32_t)len) {
+		unsigned char *b = realloc(dev->ds_sync_buf, 2 * (uint32_t)len);
+		if (!b)
+			return -1;
+		dev->ds_sync_buf = b;
+		dev->ds_sync_len = 2 * (uint32_t)len;
+	}
+	r = rtlsdr_read_sync_raw(dev, dev->ds_sync_buf, 2 * len, n_read);
+	if (!r && n_read) {
+		*n_read = (int)ds_decimate(dev, dev->ds_sync_buf, (uint32_t)*n_read);
+		memcpy(buf, dev->ds_sync_buf, *n_read);
+	}
+	return r;
 }
 
 
@@ -3783,21 +4057,335 @@ static int softagc(rtlsdr_dev_t *dev, unsigned char *buf, int len)
 }
 
 
+/* halfband filter and decimate interleaved I/Q by 2 - in place. return == new length */
+static uint32_t ds_decimate(rtlsdr_dev_t *dev, unsigned char *buf, uint32_t len)
+{
+	uint32_t i, o = 0;
+	int pos = dev->ds_hb_pos;
+	int phase = dev->ds_hb_phase;
+
+	for (i = 0; i + 1 < len; i += 2) {
+		const int *hi, *hq;
+		int k, acc_i, acc_q;
+
+		/* delay line is doubled, that the last DS_HB_LEN samples are contiguous */
+		dev->ds_hb_i[pos] = dev->ds_hb_i[pos + DS_HB_LEN] = buf[i];
+		dev->ds_hb_q[pos] = dev->ds_hb_q[pos + DS_HB_LEN] = buf[i + 1];
+		if (++pos >= DS_HB_LEN)
+			pos = 0;
+
+		phase ^= 1;
+		if (phase)
+			continue;
+
+		/* oldest sample at [0], newest at [DS_HB_LEN - 1] */
+		hi = &dev->ds_hb_i[pos];
+		hq = &dev->ds_hb_q[pos];
+		acc_i = DS_HB_CENTER * hi[DS_HB_LEN / 2];
+		acc_q = DS_HB_CENTER * hq[DS_HB_LEN / 2];
+		for (k = 0; k <= DS_HB_LEN / 4; ++k) {
+			acc_i += ds_hb_coef[k] * (hi[2 * k] + hi[DS_HB_LEN - 1 - 2 * k]);
+			acc_q += ds_hb_coef[k] * (hq[2 * k] + hq[DS_HB_LEN - 1 - 2 * k]);
+		}
+		/* coefficients sum up to 2^15: DC offset of unsigned samples is kept */
+		acc_i = (acc_i + (1 << 14)) >> 15;
+		acc_q = (acc_q + (1 << 14)) >> 15;
+		buf[o++] = (acc_i < 0) ? 0 : (acc_i > 255) ? 255 : acc_i;
+		buf[o++] = (acc_q < 0) ? 0 : (acc_q > 255) ? 255 : acc_q;
+	}
+
+	dev->ds_hb_pos = pos;
+	dev->ds_hb_phase = phase;
+	return o;
+}
+
+/* in-place radix-2 complex FFT with precomputed twiddle factors */
+static void spectrum_tap_fft(struct spectrum_tap_state *st)
+{
+	float *x = st->work;
+	const uint32_t n = st->fft_size;
+	uint32_t i, j, k, len, half, step;
+
+	/* bit reversal permutation */
+	for (i = 1, j = 0; i < n; ++i) {
+		uint32_t bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j |= bit;
+		if (i < j) {
+			float t = x[2*i];  x[2*i] = x[2*j];  x[2*j] = t;
+			t = x[2*i+1];  x[2*i+1] = x[2*j+1];  x[2*j+1] = t;
+		}
+	}
+
+	for (len = 2; len <= n; len <<= 1) {
+		half = len >> 1;
+		step = n / len;
+		for (i = 0; i < n; i += len) {
+			for (k = 0; k < half; ++k) {
+				const float wr = st->twiddle[2 * k * step];
+				const float wi = st->twiddle[2 * k * step + 1];
+				float *a = &x[2 * (i + k)];
+				float *b = &x[2 * (i + k + half)];
+				const float tr = b[0] * wr - b[1] * wi;
+				const float ti = b[0] * wi + b[1] * wr;
+				b[0] = a[0] - tr;  b[1] = a[1] - ti;
+				a[0] += tr;  a[1] += ti;
+			}
+		}
+	}
+}
+
+static void spectrum_tap_compute(rtlsdr_dev_t *dev)
+{
+	struct spectrum_tap_state *st = &dev->spec;
+	const uint32_t n = st->fft_size;
+	const float norm = 1.0f / ((float)SPECTRUM_TAP_AVG * n * n);
+	uint32_t i;
+	int a;
+
+	memset(st->power, 0, n * sizeof(float));
+	for (a = 0; a < SPECTRUM_TAP_AVG; ++a) {
+		const unsigned char *in = st->capture + (size_t)2 * a * n;
+		for (i = 0; i < n; ++i) {
+			st->work[2*i]   = (in[2*i]   - 127.4f) * (1.0f / 128.0f) * st->window[i];
+			st->work[2*i+1] = (in[2*i+1] - 127.4f) * (1.0f / 128.0f) * st->window[i];
+		}
+		spectrum_tap_fft(st);
+		/* reorder: deliver bins from -samplerate/2 to +samplerate/2 */
+		for (i = 0; i < n; ++i) {
+			const float *c = &st->work[2 * ((i + n/2) & (n - 1))];
+			st->power[i] += c[0] * c[0] + c[1] * c[1];
+		}
+	}
+
+	for (i = 0; i < n; ++i)
+		st->power[i] = 10.0f * log10f(st->power[i] * norm + 1E-20f);
+}
+
+static void *spectrum_tap_worker(void *arg)
+{
+	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)arg;
+	struct spectrum_tap_state *st = &dev->spec;
+
+	pthread_mutex_lock(&st->mutex);
+	while (1) {
+		while (!st->ready && !st->exit_thread)
+			pthread_cond_wait(&st->cond, &st->mutex);
+		if (st->exit_thread)
+			break;
+		pthread_mutex_unlock(&st->mutex);
+
+		spectrum_tap_compute(dev);
+		st->cb(st->power, st->fft_size, st->cb_ctx);
+
+		pthread_mutex_lock(&st->mutex);
+		st->ready = 0;
+	}
+	pthread_mutex_unlock(&st->mutex);
+	return NULL;
+}
+
+/* called from the streaming thread: capture strided segments, when a snapshot is due */
+static void spectrum_tap_feed(rtlsdr_dev_t *dev, const unsigned char *buf, uint32_t len)
+{
+	struct spectrum_tap_state *st = &dev->spec;
+	const uint32_t n = st->fft_size;
+	const uint32_t total = SPECTRUM_TAP_AVG * n;
+	uint32_t num_sps = len / 2;
+	int busy;
+
+	pthread_mutex_lock(&st->mutex);
+	busy = st->ready;
+	pthread_mutex_unlock(&st->mutex);
+	if (busy)
+		return;		/* worker still busy with last snapshot */
+
+	if (!st->fill_sps) {
+		st->due_sps -= num_sps;
+		if (st->due_sps > 0)
+			return;
+	}
+
+	if (st->fill_sps % n) {
+		/* continue segment from previous block */
+		uint32_t k = n - (st->fill_sps % n);
+		if (k > num_sps)
+			k = num_sps;
+		memcpy(st->capture + 2 * (size_t)st->fill_sps, buf, 2 * k);
+		st->fill_sps += k;
+	} else {
+		/* spread complete segments over the whole block */
+		uint32_t num_seg = num_sps / n;
+		uint32_t want = (total - st->fill_sps) / n;
+		uint32_t seg, stride;
+		if (!num_seg) {
+			memcpy(st->capture + 2 * (size_t)st->fill_sps, buf, 2 * num_sps);
+			st->fill_sps += num_sps;
+		} else {
+			if (want > num_seg)
+				want = num_seg;
+			stride = num_seg / want;
+			for (seg = 0; seg < want; ++seg) {
+				memcpy(st->capture + 2 * (size_t)st->fill_sps, buf + 2 * (size_t)seg * stride * n, 2 * n);
+				st->fill_sps += n;
+			}
+		}
+	}
+
+	if (st->fill_sps < total)
+		return;
+
+	st->fill_sps = 0;
+	st->due_sps = (int64_t)st->interval_ms * dev->rate / 1000;
+	pthread_mutex_lock(&st->mutex);
+	st->ready = 1;
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->mutex);
+}
+
+static void spectrum_tap_uninit(rtlsdr_dev_t *dev)
+{
+	struct spectrum_tap_state *st = &dev->spec;
+
+	if (!st->cb)
+		return;
+
+	/* no spectrum_tap_feed() is running or starts after this */
+	pthread_mutex_lock(&dev->spec_lock);
+	st->active = 0;
+	pthread_mutex_unlock(&dev->spec_lock);
+	pthread_mutex_lock(&st->mutex);
+	st->exit_thread = 1;
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->mutex);
+	pthread_join(st->thread, NULL);
+	pthread_cond_destroy(&st->cond);
+	pthread_mutex_destroy(&st->mutex);
+
+	free(st->capture);
+	free(st->window);
+	free(st->twiddle);
+	free(st->work);
+	free(st->power);
+	memset(st, 0, sizeof(*st));
+}
+
+int rtlsdr_set_spectrum_tap(rtlsdr_dev_t *dev, uint32_t fft_size, uint32_t interval_ms,
+				rtlsdr_spectrum_cb_t cb, void *ctx)
+{
+	struct spectrum_tap_state *st;
+	uint32_t i;
+	int log2_size = 0;
+
+	#if LOG_API_CALLS
+	fprintf(stderr, "LOG: rtlsdr_set_spectrum_tap(fft_size %u, interval %u ms)\n",
+		(unsigned)fft_size, (unsigned)interval_ms);
+	#endif
+
+	#ifdef _ENABLE_RPC
+	if (rtlsdr_rpc_is_enabled())
+	{
+		/* the callback would have to run on the client side */
+		fprintf(stderr, "rtlsdr_set_spectrum_tap() is not available with RPC\n");
+		return -4;
+	}
+	#endif
+
+	if (!dev)
+		return -1;
+
+	/* streaming thread might be running: stop, then reconfigure */
+	spectrum_tap_uninit(dev);
+	if (!cb || !fft_size)
+		return 0;
+
+	if (fft_size < 16 || fft_size > 65536)
+		return -2;
+	while ((1U << log2_size) < fft_size)
+		++log2_size;
+	if ((1U << log2_size) != fft_size)
+		return -2;
+
+	st = &dev->spec;
+	st->fft_size = fft_size;
+	st->log2_size = log2_size;
+	st->interval_ms = interval_ms;
+	st->cb = cb;
+	st->cb_ctx = ctx;
+	st->capture = malloc((size_t)2 * SPECTRUM_TAP_AVG * fft_size);
+	st->window = malloc(fft_size * sizeof(float));
+	st->twiddle = malloc(fft_size * sizeof(float));
+	st->work = malloc(2 * fft_size * sizeof(float));
+	st->power = malloc(fft_size * sizeof(float));
+	if (!st->capture || !st->window || !st->twiddle || !st->work || !st->power) {
+		free(st->capture);
+		free(st->window);
+		free(st->twiddle);
+		free(st->work);
+		free(st->power);
+		memset(st, 0, sizeof(*st));
+		return -ENOMEM;
+	}
+
+	/* Hann window */
+	for (i = 0; i < fft_size; ++i)
+		st->window[i] = 0.5f - 0.5f * (float)cos(2.0 * M_PI * i / fft_size);
+	/* twiddle factors for the first half circle */
+	for (i = 0; i < fft_size / 2; ++i) {
+		st->twiddle[2*i]   = (float)cos(-2.0 * M_PI * i / fft_size);
+		st->twiddle[2*i+1] = (float)sin(-2.0 * M_PI * i / fft_size);
+	}
+
+	pthread_mutex_init(&st->mutex, NULL);
+	pthread_cond_init(&st->cond, NULL);
+	if (pthread_create(&st->thread, NULL, spectrum_tap_worker, dev)) {
+		pthread_cond_destroy(&st->cond);
+		pthread_mutex_destroy(&st->mutex);
+		st->cb = NULL;
+		free(st->capture);
+		free(st->window);
+		free(st->twiddle);
+		free(st->work);
+		free(st->power);
+		memset(st, 0, sizeof(*st));
+		return -3;
+	}
+	pthread_mutex_lock(&dev->spec_lock);
+	st->active = 1;
+	pthread_mutex_unlock(&dev->spec_lock);
+	return 0;
+}
+
+
 static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
 {
 	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)xfer->user_data;
 
 	if (LIBUSB_TRANSFER_COMPLETED == xfer->status) {
 		int keepBlock = 1;
+		++dev->usb_stats.bulk_async;
+		dev->usb_stats.bulk_bytes += xfer->actual_length;
 		if ( dev->softagc.agcState != SOFTSTATE_OFF )
 			keepBlock = softagc(dev, xfer->buffer, xfer->actual_length);
 
-		if (dev->cb && keepBlock)
-			dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
+		/* before ds_decimate() rewrites the buffer: the tap works at dev->rate */
+		pthread_mutex_lock(&dev->spec_lock);
+		if (dev->spec.active)
+			spectrum_tap_feed(dev, xfer->buffer, xfer->actual_length);
+		pthread_mutex_unlock(&dev->spec_lock);
+
+		if (dev->cb && keepBlock) {
+			uint32_t len = xfer->actual_length;
+			if (ds_decimating(dev))
+				len = ds_decimate(dev, xfer->buffer, len);
+			dev->cb(xfer->buffer, len, dev->cb_ctx);
+		}
 
 		libusb_submit_transfer(xfer); /* resubmit transfer */
 		dev->xfer_errors = 0;
 	} else if (LIBUSB_TRANSFER_CANCELLED != xfer->status) {
+		++dev->usb_stats.bulk_errors;
 #ifndef _WIN32
 		if (LIBUSB_TRANSFER_ERROR == xfer->status)
 			dev->xfer_errors++;
@@ -3810,6 +4398,10 @@ static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
 			fprintf(stderr, "cb transfer status: %d, "
 				"canceling...\n", xfer->status);
 #ifndef _WIN32
+		} else if (LIBUSB_TRANSFER_ERROR == xfer->status) {
+			/* sporadic error: without the resubmit the transfer is lost
+			 * and the stream stalls once all of them are gone */
+			libusb_submit_transfer(xfer);
 		}
 #endif
 	}
@@ -4033,7 +4625,8 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 					 * propagate */
 					libusb_handle_events_timeout_completed(dev->ctx,
 												 &zerotv, NULL);
-					if (r < 0)
+					/* don't wait another round for an already delivered cancel */
+					if (r < 0 || LIBUSB_TRANSFER_CANCELLED == dev->xfer[i]->status)
 						continue;
 
 					next_status = RTLSDR_CANCELING;
@@ -4087,6 +4680,25 @@ int rtlsdr_cancel_async(rtlsdr_dev_t *dev)
 	return -2;
 }
 
+int rtlsdr_get_usb_stats(rtlsdr_dev_t *dev, struct rtlsdr_usb_stats *stats, int reset)
+{
+	#ifdef _ENABLE_RPC
+	if (rtlsdr_rpc_is_enabled())
+	{
+	  return rtlsdr_rpc_get_usb_stats(dev, stats, reset);
+	}
+	#endif
+
+	if (!dev)
+		return -1;
+
+	if (stats)
+		*stats = dev->usb_stats;
+	if (reset)
+		memset(&dev->usb_stats, 0, sizeof(dev->usb_stats));
+	return 0;
+}
+
 uint32_t rtlsdr_get_tuner_clock(void *dev)
 {
 	uint32_t tuner_freq;
@@ -4149,7 +4761,7 @@ static int rtlsdr_read_regs(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uin
 	uint16_t index = (block << 8);
 	if (block == IRB) index = (SYSB << 8) | 0x01;
 
-	r = libusb_control_transfer(dev->devh, CTRL_IN, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_IN, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -4340,6 +4952,9 @@ const char * rtlsdr_get_opt_help(int longInfo)
 		"\t\t                        0: use I & Q; 1: use I; 2: use Q; 3: use I below threshold frequency;\n"
 		"\t\t                        4: use Q below threshold frequency (=RTL-SDR v3)\n"
 		"\t\t                        other values set the threshold frequency\n"
+		"\t\tdsdec=<ds_decimation> 1 halfband filters and decimates by 2 in direct sampling mode.\n"
+		"\t\t                        delivers half the samplerate. default: 0\n"
+		"\t\tfcal                  R820T/2: drop cached filter calibration and calibrate again\n"
 #if ENBALE_R820T_HARM_OPT
 		"\t\tharm=<Nth_harmonic>   R820T/2: use Nth harmonic for frequencies above 1.76 GHz. default: 5\n"
 #endif
@@ -4359,15 +4974,15 @@ const char * rtlsdr_get_opt_help(int longInfo)
 		return
 		"\t[-O\tset RTL options string seperated with ':', e.g. -O 'bc=30000:agc=0' ]\n"
 		"\t\tverbose:f=<freqHz>:bw=<bw_in_kHz>:bc=<if_in_Hz>:sb=<sideband>\n"
-		"\t\tagc=<tuner_gain_mode>:gain=<tenth_dB>:ifm=<tuner_if_mode>:dagc=<rtl_agc>\n"
+		"\t\tagc=<tuner_gain_mode>:gain=<tenth_dB>:ifm=<tuner_if_mode>:dagc=<rtl_agc>:fcal\n"
 #if ENBALE_R820T_HARM_OPT
 		"\t\tharm=<harmonic>\n"
 #endif
 #if ENABLE_VCO_OPTIONS
-		"\t\tds=<direct_sampling>:dm=<ds_mode_thresh>:vcocmin=<c>:vcocmax=<c>:vcoalgo=<a>\n"
-		"\t\tT=<bias_tee>\n"
+		"\t\tds=<direct_sampling>:dm=<ds_mode_thresh>:dsdec=<ds_decimation>\n"
+		"\t\tvcocmin=<c>:vcocmax=<c>:vcoalgo=<a>:T=<bias_tee>\n"
 #else
-		"\t\tds=<direct_sampling>:dm=<ds_mode_thresh>:T=<bias_tee>\n"
+		"\t\tds=<direct_sampling>:dm=<ds_mode_thresh>:dsdec=<ds_decimation>:T=<bias_tee>\n"
 #endif
 #ifdef WITH_UDP_SERVER
 		"\t\tport=<udp_port default with 1>\n"
@@ -4487,6 +5102,17 @@ int rtlsdr_set_opt_string(rtlsdr_dev_t *dev, const char *opts, int verbose)
 				dev->direct_sampling_threshold = dm;
 			ret = rtlsdr_set_ds_mode(dev, dev->direct_sampling_mode, dev->direct_sampling_threshold);
 		}
+		else if (!strcmp(optPart, "fcal")) {
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed tuner filter recalibration\n");
+			ret = rtlsdr_recalibrate_tuner_filter(dev);
+		}
+		else if (!strncmp(optPart, "dsdec=", 6)) {
+			int on = atoi(optPart +6);
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed direct sampling decimation %d\n", on);
+			ret = rtlsdr_set_ds_decimation(dev, on);
+		}
 #if ENBALE_R820T_HARM_OPT
 		else if (!strncmp(optPart, "harm=", 5)) {
 			int harmonic = atoi(optPart +5);
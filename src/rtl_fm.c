@@ -58,7 +58,19 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#ifdef __APPLE__
+#include <sys/time.h>
+#endif
+#define closesocket close
+#define SOCKET int
+#define INVALID_SOCKET -1
 #else
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #include <fcntl.h>
 #include <io.h>
@@ -87,18 +99,52 @@
 #include "convenience/rtl_convenience.h"
 #include "convenience/wavewrite.h"
 
+/* SSE2 kernels, selected at runtime with cpu_has_sse2() */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#include <emmintrin.h>
+#define HAVE_SSE2		1
+#define SSE2_ATTR		__attribute__((target("sse2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define HAVE_SSE2		1
+#define SSE2_ATTR
+#endif
+
 #define DEFAULT_SAMPLE_RATE		24000
 #define DEFAULT_BUF_LENGTH		(1 * 16384)
 #define MAXIMUM_OVERSAMPLE		16
 #define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)
 #define AUTO_GAIN				-100
 #define DEFAULT_BUFFER_DUMP		4096
-
-#define FREQUENCIES_LIMIT		1024
+#define DEFAULT_QUEUE_BLOCKS	8
+#define MAXIMUM_QUEUE_BLOCKS	256
+
+#define FREQUENCIES_INITIAL		64
+#define CMD_RESULT_RECORD_LEN	24
+#define CHANNELS_LIMIT			64
+#define NCO_LUT_BITS			10
+#define HB_MAX_STAGES			10
+#define HB_MAX_TAPS				31
+#define RESAMP_TAPS_PER_PHASE	24
+#define RESAMP_MAX_INTERP		512
+#define PREDET_STRIDE			4
+#define PREDET_MARGIN			2	/* skip only below squelch / 2 (-6 dB) */
+#define NET_MAX_PAYLOAD			1400	/* bytes per datagram, multiple of 4 */
+#define RTP_HEADER_LEN			12
+#define RTP_PAYLOAD_TYPE		96		/* dynamic: L16 at output rate */
+
+/* atan(a) for 0 <= a <= 1 of -A simd: max error measured on [0, 1],
+ * about one LSB of the discriminator output */
+#define DISC_ATAN_P3	-0.0464964749f
+#define DISC_ATAN_P2	0.15931422f
+#define DISC_ATAN_P1	-0.327622764f
+#define DISC_ATAN_MAX_ERR		"2.0e-4"	/* rad */
 
 static int BufferDump = DEFAULT_BUFFER_DUMP;
 static int OutputToStdout = 1;
 static int MinCaptureRate = 1000000;
+static int QueueBlocks = DEFAULT_QUEUE_BLOCKS;
+static int QueueBackpressure = 0;
 
 static volatile int do_exit = 0;
 static int lcm_post[17] = {1,1,1,3,1,5,3,7,1,9,5,11,3,13,7,15,1};
@@ -124,6 +170,26 @@ time_t stop_time;
 int duration = 0;
 
 
+/* bounded single producer / single consumer queue of preallocated blocks.
+ * the mutex only guards the fill counter, block data is copied outside */
+struct block_queue
+{
+	int16_t *buf;		/* nblocks * block_len samples */
+	int	  *lens;
+	int	  block_len;
+	int	  nblocks;
+	int	  head;		/* written by producer only */
+	int	  tail;		/* written by consumer only */
+	int	  fill;
+	int	  max_fill;
+	int	  backpressure;	/* 1: producer waits for a free block, 0: drops */
+	uint32_t pushed;
+	uint32_t dropped;
+	pthread_mutex_t m;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
 struct cmd_state
 {
 	const char * filename;
@@ -147,12 +213,50 @@ struct cmd_state
 	double levelSum;
 	int numSummed;
 	int omitFirstFreqLevels;
-	int waitTrigger[FREQUENCIES_LIMIT];
-	int statNumLevels[FREQUENCIES_LIMIT];
-	uint64_t statFreq[FREQUENCIES_LIMIT];
-	double statSumLevels[FREQUENCIES_LIMIT];
-	float statMinLevel[FREQUENCIES_LIMIT];
-	float statMaxLevel[FREQUENCIES_LIMIT];
+	uint64_t measClock;	/* sum of numMeas over all evaluated measurements */
+	struct cmd_stat *stats;	/* in order of first measurement */
+	int numStats, capStats;
+	int *statHash;		/* open addressing: index into stats + 1, 0 = empty */
+	int hashSize;		/* power of 2 */
+	const char * resultFilename;	/* -J: binary result records */
+	int resultFd, resultIsSocket;
+	uint32_t resultDropped;
+	const char * triggerSink;	/* -k: records to one handler instead of fork */
+	int triggerFd, triggerIsSocket;
+	uint32_t triggerSent, triggerDropped;
+};
+
+/* statistics and trigger hold-off of one command file line */
+struct cmd_stat
+{
+	uint64_t freq;
+	int lineNo;
+	int numLevels;
+	uint64_t blockedUntil;	/* measClock until a new trigger is allowed */
+	double sumLevels;
+	float minLevel, maxLevel;
+};
+
+/* halfband decimator by 2 on complex float samples */
+struct hb_stage
+{
+	int	  ntaps;		/* 4*k+3 */
+	float coef[HB_MAX_TAPS];
+	float hist[2*HB_MAX_TAPS];
+};
+
+/* '-F hb': halfband decimation chain plus polyphase audio resampler */
+struct decim_chain
+{
+	int	  planned;
+	int	  num_stages;
+	struct hb_stage stage[HB_MAX_STAGES];
+	float *bufA, *bufB;	/* complex work buffers with history headroom */
+	int	  interp, decim;	/* audio resampler L/M, 0 if off */
+	float *resamp_coef;	/* interp * RESAMP_TAPS_PER_PHASE */
+	float *resamp_buf;	/* history + block */
+	int	  resamp_phase;
+	int	  resamp_index;
 };
 
 struct dongle_state
@@ -167,7 +271,6 @@ struct dongle_state
 	uint32_t bandwidth;
 	int	  bccorner;  /* -1 for low band corner, 0 for band center, +1 for high band corner */
 	int	  gain;
-	int16_t  buf16[MAXIMUM_BUF_LENGTH];
 	uint32_t buf_len;
 	int	  ppm_error;
 	int	  offset_tuning;
@@ -179,15 +282,29 @@ struct dongle_state
 	unsigned char sampleMax;
 };
 
+/* optional per stage timing of full_demod(), used by the benchmark (-I) */
+enum demod_stage
+{
+	STAGE_INPUT, STAGE_DECIM, STAGE_FIR, STAGE_LEVEL,
+	STAGE_DEMOD, STAGE_POSTDS, STAGE_DEEMPH, STAGE_RESAMPLE, STAGE_COUNT
+};
+
+struct stage_timing
+{
+	double last;			/* end of previous stage [ns] */
+	double ns[STAGE_COUNT];	/* accumulated per stage [ns] */
+};
+
 struct demod_state
 {
 	int	  exit_flag;
 	pthread_t thread;
-	int16_t  lowpassed[MAXIMUM_BUF_LENGTH];
+	int16_t  *lowpassed;	/* MAXIMUM_BUF_LENGTH, buf_len for channels */
 	int	  lp_len;
 	int16_t  lp_i_hist[10][6];
 	int16_t  lp_q_hist[10][6];
-	int16_t  result[MAXIMUM_BUF_LENGTH];
+	int16_t  *result;
+	int	  result_cap;	/* samples, result and output queue blocks */
 	int16_t  droop_i_hist[9];
 	int16_t  droop_q_hist[9];
 	int	  result_len;
@@ -203,16 +320,19 @@ struct demod_state
 	int	  squelch_level, conseq_squelch, squelch_hits, terminate_on_squelch;
 	int	  downsample_passes;
 	int	  comp_fir_size;
+	int	  hb_chain;
+	struct decim_chain chain;
+	int	  predetect;
+	uint32_t predetect_skips;
 	int	  custom_atan;
-	int	  deemph, deemph_a;
+	int	  deemph, deemph_a, deemph_avg;
 	int	  now_lpr;
 	int	  prev_lpr_index;
 	int	  dc_block_audio, dc_avg, adc_block_const;
 	int	  dc_block_raw, dc_avgI, dc_avgQ, rdc_block_const;
 	void	 (*mode_demod)(struct demod_state*);
-	pthread_rwlock_t rw;
-	pthread_cond_t ready;
-	pthread_mutex_t ready_m;
+	struct stage_timing *timing;	/* NULL unless benchmarking */
+	struct block_queue queue;	/* input from dongle */
 	struct output_state *output_target;
 	struct cmd_state *cmd;
 };
@@ -224,20 +344,40 @@ struct output_state
 	FILE	 *file;
 	char	 *filename;
 	char	 *tempfilename;
-	int16_t  result[MAXIMUM_BUF_LENGTH];
-	int	  result_len;
 	int	  rate;
-	pthread_rwlock_t rw;
-	pthread_cond_t ready;
-	pthread_mutex_t ready_m;
+	int	  is_wave;
+	int	  net;		/* 0: file, else OUTPUT_UDP or OUTPUT_RTP */
+	SOCKET	  sock;
+	struct sockaddr_storage dest;
+	int	  dest_len;
+	int	  nchan;	/* 2 for raw I/Q */
+	uint16_t rtp_seq;
+	uint32_t rtp_ts, rtp_ssrc;
+	uint32_t net_errors;
+	unsigned char pkt[RTP_HEADER_LEN + NET_MAX_PAYLOAD];
+	struct block_queue queue;	/* input from demod */
+};
+
+enum output_net { OUTPUT_UDP = 1, OUTPUT_RTP };
+
+/* additional channel inside the captured band: mixed to zero IF,
+ * then decimated and demodulated like the primary channel */
+struct channel_state
+{
+	uint64_t freq;
+	int32_t  offset;	/* relative to zero IF of the capture */
+	uint32_t phase, phase_inc;
+	struct demod_state demod;
+	struct output_state output;
+	char default_name[32];	/* output name without a filename given */
 };
 
 struct controller_state
 {
 	int	  exit_flag;
 	pthread_t thread;
-	uint32_t freqs[FREQUENCIES_LIMIT];
-	int	  freq_len;
+	uint32_t *freqs;
+	int	  freq_len, freq_cap;
 	int	  freq_now;
 	int	  edge;
 	int	  wb_mode;
@@ -252,6 +392,11 @@ struct demod_state demod;
 struct output_state output;
 struct controller_state controller;
 struct cmd_state cmd;
+struct channel_state *channels = NULL;
+int num_channels = 0;
+static struct cmd_state channel_cmd;	/* always without command file */
+static int16_t nco_cos[1 << NCO_LUT_BITS];
+static int16_t nco_sin[1 << NCO_LUT_BITS];
 
 
 void usage(void)
@@ -271,6 +416,15 @@ void usage(void)
 		"\t[-C command_filename: command file with comma seperated values (.csv). sets modulation 'raw']\n"
 		"\t\tcommand file contains lines with: freq,gain,trig-crit,trig_level,trig_tolerance,#meas,#blocks,trigger_command,arguments\n"
 		"\t\t with trig_crit one of 'in', 'out', 'lt' or 'gt'\n"
+		"\t[-J result_filename: with -C, write a binary record of 24 bytes per measurement]\n"
+		"\t\trecord (little endian): u64 unix time, u64 freq [Hz], u24 command file line,\n"
+		"\t\t u8 flags (1 = trig-crit met, 2 = trigger on hold, 4 = no statistics),\n"
+		"\t\t s16 level [0.1 dB], u8 adc max (with adcmax), u8 adc rms (with adcrms)\n"
+		"\t\tfiles are appended to. 'pipe:command', 'unix:path' and fifos as with -k, never blocking rtl_fm\n"
+		"\t[-k trigger_sink: with -C, send each trigger as text line to one handler, instead of fork per trigger]\n"
+		"\t\t'pipe:command' starts command once and writes to its stdin, 'unix:path' connects to a unix socket,\n"
+		"\t\tothers are opened as file or fifo. a busy handler loses records instead of blocking rtl_fm.\n"
+		"\t\tline: time, cmd file line, freq, gain, mlevel, crit, reflevel, reftol, command, args - tab separated\n"
 		"\t[-B num_samples at capture rate: remove that many samples at capture_rate after changing frequency (default: 4096)]\n"
 		"\t[-m minimum_capture_rate Hz (default: 1m, min=900k, max=3.2m)]\n"
 		"\t[-v increase verbosity (default: 0)]\n"
@@ -286,6 +440,11 @@ void usage(void)
 		"\t[-g tuner_gain (default: automatic)]\n"
 		"\t[-w tuner_bandwidth in Hz (default: automatic)]\n"
 		"\t[-W length of single buffer in units of 512 samples (default: 32 was 256)]\n"
+		"\t[-Q number of buffers queued between dongle, demod and output (default: 8)]\n"
+		"\t[-x channel_freq[,filename[,squelch_level]]: demodulate additional channel (default: off)]\n"
+		"\t	use multiple -x for multiple channels inside the captured band\n"
+		"\t	each channel uses modulation and sample rate of -M and -s\n"
+		"\t	filename defaults to ch_<freq>.raw, squelch_level defaults to -l\n"
 		"\t[-l squelch_level (default: 0/off)]\n"
 		"\t[-L N  prints levels every N calculations]\n"
 		"\t	output are comma separated values (csv):\n"
@@ -311,13 +470,20 @@ void usage(void)
 		"\t	bcc:    use tuner bandwidths center as band center (default)\n"
 		"\t	bclo:   use tuner bandwidths low  corner as band center\n"
 		"\t	bchi:   use tuner bandwidths high corner as band center\n"
+		"\t	predet: skip scanned frequencies early, when a cheap in-channel\n"
+		"\t	        level estimate is clearly (6 dB) below the squelch level\n"
+		"\t	qwait:  let producers wait for a free buffer when a queue is full,\n"
+		"\t	        instead of dropping the buffer (default: drop)\n"
 		"%s"
 		"\t[-q dc_avg_factor for option rdc (default: 9)]\n"
 		"\t[-n disables demodulation output to stdout/file]\n"
 		"\t[-H write wave Header to file (default: off)]\n"
 		"\t	limitation: only 1st tuned frequency will be written into the header!\n"
 		"\tfilename ('-' means stdout)\n"
-		"\t	omitting the filename also uses stdout\n\n"
+		"\t	omitting the filename also uses stdout\n"
+		"\t	udp://host:port sends the samples as udp datagrams\n"
+		"\t	rtp://host:port[?ttl=n] sends RTP (L16, payload type 96), optionally multicast\n"
+		"\t	both also work as filename of -x channels, giving one stream per channel\n\n"
 		"Experimental options:\n"
 		"\t[-r resample_rate (default: none / same as -s)]\n"
 		"\t[-t squelch_delay (default: 10)]\n"
@@ -325,7 +491,12 @@ void usage(void)
 		"\t[-F fir_size (default: off)]\n"
 		"\t	enables low-leakage downsample filter\n"
 		"\t	size can be 0 or 9.  0 has bad roll off\n"
-		"\t[-A std/fast/lut/ale choose atan math (default: std)]\n"
+		"\t	'hb' uses cascaded halfband filters and a polyphase resampler for -r\n"
+		"\t[-A std/fast/lut/ale/simd choose atan math (default: std)]\n"
+		"\t	simd: polynomial atan, max error " DISC_ATAN_MAX_ERR " rad, vectorized where supported\n"
+		"\t[-I iq_filename: benchmark demodulation of a u8 I/Q recording, no dongle needed]\n"
+		"\t	runs all modulations and atan math - or only those given with -M and -A -\n"
+		"\t	with the other options and prints throughput and ns/sample per stage as csv\n"
 #if 0
 		"\t[-C clip_path (default: off)\n"
 		"\t (create time stamped raw clips, requires squelch)\n"
@@ -368,6 +539,113 @@ static void sighandler(int signum)
 #define safe_cond_signal(n, m) do { pthread_mutex_lock(m); pthread_cond_signal(n); pthread_mutex_unlock(m); } while (0)
 #define safe_cond_wait(n, m)   do { pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m); } while (0)
 
+static int queue_init(struct block_queue *q, int nblocks, int block_len, int backpressure)
+{
+	q->buf = malloc((size_t)nblocks * block_len * sizeof(int16_t));
+	q->lens = malloc(nblocks * sizeof(int));
+	if (!q->buf || !q->lens) {
+		free(q->buf);
+		free(q->lens);
+		q->buf = NULL;
+		q->lens = NULL;
+		return -1;
+	}
+	q->block_len = block_len;
+	q->nblocks = nblocks;
+	q->head = q->tail = q->fill = q->max_fill = 0;
+	q->backpressure = backpressure;
+	q->pushed = q->dropped = 0;
+	pthread_mutex_init(&q->m, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	return 0;
+}
+
+static void queue_cleanup(struct block_queue *q)
+{
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->m);
+	free(q->buf);
+	free(q->lens);
+	q->buf = NULL;
+	q->lens = NULL;
+}
+
+/* producer: get the next free block or NULL, when the block is dropped */
+static int16_t *queue_write_block(struct block_queue *q)
+{
+	pthread_mutex_lock(&q->m);
+	while (q->fill == q->nblocks) {
+		if (!q->backpressure || do_exit) {
+			q->dropped++;
+			pthread_mutex_unlock(&q->m);
+			return NULL;
+		}
+		pthread_cond_wait(&q->not_full, &q->m);
+	}
+	pthread_mutex_unlock(&q->m);
+	return q->buf + (size_t)q->head * q->block_len;
+}
+
+/* producer: publish the block from queue_write_block() with len samples */
+static void queue_commit(struct block_queue *q, int len)
+{
+	q->lens[q->head] = len;
+	q->head = (q->head + 1) % q->nblocks;
+	pthread_mutex_lock(&q->m);
+	q->fill++;
+	q->pushed++;
+	if (q->max_fill < q->fill)
+		q->max_fill = q->fill;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->m);
+}
+
+/* consumer: wait for the oldest block. NULL on exit */
+static int16_t *queue_read_block(struct block_queue *q, int *len)
+{
+	pthread_mutex_lock(&q->m);
+	while (!q->fill && !do_exit)
+		pthread_cond_wait(&q->not_empty, &q->m);
+	if (!q->fill) {
+		pthread_mutex_unlock(&q->m);
+		return NULL;
+	}
+	pthread_mutex_unlock(&q->m);
+	*len = q->lens[q->tail];
+	return q->buf + (size_t)q->tail * q->block_len;
+}
+
+/* consumer: give back the block from queue_read_block() */
+static void queue_release(struct block_queue *q)
+{
+	q->tail = (q->tail + 1) % q->nblocks;
+	pthread_mutex_lock(&q->m);
+	q->fill--;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->m);
+}
+
+/* consumer: drop all queued blocks, e.g. after a hop */
+static void queue_flush(struct block_queue *q)
+{
+	pthread_mutex_lock(&q->m);
+	q->tail = (q->tail + q->fill) % q->nblocks;
+	q->fill = 0;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->m);
+}
+
+/* wake up waiting threads, e.g. for exit */
+static void queue_wake(struct block_queue *q)
+{
+	pthread_mutex_lock(&q->m);
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->m);
+}
+
 /* {length, coef, coef, coef}  and scaled by 2^15
    for now, only length 9, optimal way to get +85% bandwidth */
 #define CIC_TABLE_MAX 10
@@ -512,7 +790,6 @@ static char * trim(char * s) {
 
 static void cmd_init(struct cmd_state *c)
 {
-	int k;
 	c->filename = NULL;
 	c->file = NULL;
 	c->lineNo = 1;
@@ -533,13 +810,118 @@ static void cmd_init(struct cmd_state *c)
 	c->levelSum = 0.0;
 	c->numSummed = 0;
 	c->omitFirstFreqLevels = 3;
-	for (k = 0; k < FREQUENCIES_LIMIT; k++) {
-		c->waitTrigger[k] = 0;
-		c->statNumLevels[k] = 0;
-		c->statFreq[k] = 0;
-		c->statSumLevels[k] = 0.0;
-		c->statMinLevel[k] = 0.0F;
-		c->statMaxLevel[k] = 0.0F;
+	c->measClock = 0;
+	c->stats = NULL;
+	c->numStats = c->capStats = 0;
+	c->statHash = NULL;
+	c->hashSize = 0;
+	c->resultFilename = NULL;
+	c->resultFd = -1;
+	c->resultIsSocket = 0;
+	c->resultDropped = 0;
+	c->triggerSink = NULL;
+	c->triggerFd = -1;
+	c->triggerIsSocket = 0;
+	c->triggerSent = c->triggerDropped = 0;
+}
+
+static void cmd_cleanup(struct cmd_state *c)
+{
+	closeEventSink(c->resultFd);
+	c->resultFd = -1;
+	closeEventSink(c->triggerFd);
+	c->triggerFd = -1;
+	free(c->stats);
+	free(c->statHash);
+	c->stats = NULL;
+	c->statHash = NULL;
+	c->numStats = c->capStats = c->hashSize = 0;
+}
+
+static unsigned cmd_stat_hash(uint64_t freq, int lineNo, int hashSize)
+{
+	uint64_t h = (freq ^ ((uint64_t)(uint32_t)lineNo << 40)) * 0x9E3779B97F4A7C15ULL;
+	return (unsigned)(h >> 32) & (unsigned)(hashSize - 1);
+}
+
+static int cmd_stat_rehash(struct cmd_state *c, int hashSize)
+{
+	int k, *tab = calloc(hashSize, sizeof(int));
+	unsigned h;
+	if (!tab)
+		return -1;
+	for (k = 0; k < c->numStats; k++) {
+		h = cmd_stat_hash(c->stats[k].freq, c->stats[k].lineNo, hashSize);
+		while (tab[h])
+			h = (h + 1) & (unsigned)(hashSize - 1);
+		tab[h] = k + 1;
+	}
+	free(c->statHash);
+	c->statHash = tab;
+	c->hashSize = hashSize;
+	return 0;
+}
+
+static struct cmd_stat * cmd_stat_lookup(struct cmd_state *c, uint64_t freq, int lineNo)
+/* entry for (freq, lineNo), created on first use. NULL when out of memory */
+{
+	struct cmd_stat *st;
+	unsigned h;
+	int k;
+	if (2 * (c->numStats + 1) > c->hashSize
+		&& cmd_stat_rehash(c, c->hashSize ? 2 * c->hashSize : 2 * FREQUENCIES_INITIAL) < 0)
+		return NULL;
+	h = cmd_stat_hash(freq, lineNo, c->hashSize);
+	while ((k = c->statHash[h]) != 0) {
+		st = &c->stats[k - 1];
+		if (st->freq == freq && st->lineNo == lineNo)
+			return st;
+		h = (h + 1) & (unsigned)(c->hashSize - 1);
+	}
+	if (c->numStats == c->capStats) {
+		int cap = c->capStats ? 2 * c->capStats : FREQUENCIES_INITIAL;
+		st = realloc(c->stats, cap * sizeof(struct cmd_stat));
+		if (!st)
+			return NULL;
+		c->stats = st;
+		c->capStats = cap;
+	}
+	st = &c->stats[c->numStats];
+	memset(st, 0, sizeof(struct cmd_stat));
+	st->freq = freq;
+	st->lineNo = lineNo;
+	c->statHash[h] = ++c->numStats;
+	return st;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int n)
+{
+	int k;
+	for (k = 0; k < n; k++, v >>= 8)
+		p[k] = (unsigned char)(v & 0xff);
+}
+
+static void cmd_write_result(struct cmd_state *c, double level, int adcMax, double adcRms, int flags)
+/* fixed size little endian record, see usage() */
+{
+	unsigned char rec[CMD_RESULT_RECORD_LEN];
+	int r, lvl = (int)floor(level * 10.0 + 0.5);
+	if (lvl < -32768) lvl = -32768;
+	if (lvl > 32767) lvl = 32767;
+	put_le(rec, (uint64_t)time(NULL), 8);
+	put_le(rec + 8, c->freq, 8);
+	put_le(rec + 16, (uint32_t)c->lineNo, 3);
+	rec[19] = (unsigned char)flags;
+	put_le(rec + 20, (uint16_t)(int16_t)lvl, 2);
+	rec[22] = (unsigned char)(c->checkADCmax ? adcMax + 127 : 0);
+	rec[23] = (unsigned char)(c->checkADCrms && adcRms >= 0.0 ? (int)(adcRms + 0.5) : 0);
+	r = writeEventRecord(c->resultFd, c->resultIsSocket, (const char *)rec, CMD_RESULT_RECORD_LEN);
+	if (!r)
+		c->resultDropped++;
+	else if (r < 0) {
+		fprintf(stderr, "Failed to write results to %s, stopping result output.\n", c->resultFilename);
+		closeEventSink(c->resultFd);
+		c->resultFd = -1;
 	}
 }
 
@@ -668,16 +1050,61 @@ static int testTrigCrit(struct cmd_state *c, double level)
 	return 0;
 }
 
+static void sendTriggerRecord(struct cmd_state *c, char * searchStr[], char * replaceStr[])
+/* one text line per trigger for the handler behind -k:
+ * time, line, freq, gain, mlevel, crit, reflevel, reftol, command, args - tab separated.
+ * args get the same replacements as for a forked command */
+{
+	char rec[4096], args[4096], tok[4096];
+	char *p, *t;
+	int k, n = 0, r;
+	args[0] = 0;
+	if (c->args) {
+		snprintf(tok, sizeof(tok), "%s", c->args);
+		for (p = strtok(tok, " \t"); p; p = strtok(NULL, " \t")) {
+			t = p;
+			for (k = 0; searchStr[k] && replaceStr[k]; k++) {
+				if (!strcmp(p, searchStr[k])) {
+					t = replaceStr[k];
+					break;
+				}
+			}
+			n += snprintf(args + n, sizeof(args) - n, "%s%s", (n ? " " : ""), t);
+			if (n >= (int)sizeof(args))
+				break;
+		}
+	}
+	n = snprintf(rec, sizeof(rec), "%lu\t%d\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n",
+		(unsigned long)time(NULL), c->lineNo, replaceStr[0], replaceStr[1], replaceStr[2],
+		replaceStr[3], replaceStr[4], replaceStr[5], (c->command ? c->command : ""), args);
+	if (n >= (int)sizeof(rec)) {
+		n = (int)sizeof(rec) - 1;
+		rec[n - 1] = '\n';
+	}
+	r = writeEventRecord(c->triggerFd, c->triggerIsSocket, rec, n);
+	if (r > 0)
+		c->triggerSent++;
+	else if (!r)
+		c->triggerDropped++;
+	else {
+		fprintf(stderr, "Trigger sink %s is broken, no more triggers will be delivered.\n", c->triggerSink);
+		closeEventSink(c->triggerFd);
+		c->triggerFd = -1;
+		c->triggerDropped++;
+	}
+}
+
 static void checkTriggerCommand(struct cmd_state *c, unsigned char adcSampleMax, double powerSum, int powerCount )
 {
 	char acRepFreq[32], acRepGain[32], acRepMLevel[32], acRepRefLevel[32], acRepRefTolerance[32];
 	char * execSearchStrings[7] = { "!freq!", "!gain!", "!mlevel!", "!crit!", "!reflevel!", "!reftol!", NULL };
 	char * execReplaceStrings[7] = { acRepFreq, acRepGain, acRepMLevel, NULL, acRepRefLevel, acRepRefTolerance, NULL };
 	double triggerLevel;
-	double adcRms = 0.0;
-	int k, triggerCommand = 0;
+	double adcRms = -1.0;
+	int triggerCommand = 0, waitTrigger;
 	int adcMax = (int)adcSampleMax - 127;
 	char adcText[128];
+	struct cmd_stat *st;
 
 	if (c->numSummed != c->numMeas)
 		return;
@@ -688,34 +1115,26 @@ static void checkTriggerCommand(struct cmd_state *c, unsigned char adcSampleMax,
 		return;
 	}
 
-	/* decrease all counters */
-	for ( k = 0; k < FREQUENCIES_LIMIT; k++ ) {
-		if ( c->waitTrigger[k] > 0 ) {
-			c->waitTrigger[k] -= c->numMeas;
-			if ( c->waitTrigger[k] < 0 )
-				c->waitTrigger[k] = 0;
-		}
-	}
+	/* advance the clock of all trigger hold-offs */
+	c->measClock += c->numMeas;
 	triggerLevel = 20.0 * log10( 1E-10 + c->levelSum / c->numSummed );
 	triggerCommand = testTrigCrit(c, triggerLevel);
 
 	/* update statistics */
-	if ( c->lineNo < FREQUENCIES_LIMIT ) {
-		if ( c->statNumLevels[c->lineNo] == 0 ) {
-			++c->statNumLevels[c->lineNo];
-			c->statFreq[c->lineNo] = c->freq;
-			c->statSumLevels[c->lineNo] = triggerLevel;
-			c->statMinLevel[c->lineNo] = (float)triggerLevel;
-			c->statMaxLevel[c->lineNo] = (float)triggerLevel;
-		} else if ( c->statFreq[c->lineNo] == c->freq ) {
-			++c->statNumLevels[c->lineNo];
-			c->statSumLevels[c->lineNo] += triggerLevel;
-			if ( c->statMinLevel[c->lineNo] > (float)triggerLevel )
-				c->statMinLevel[c->lineNo] = (float)triggerLevel;
-			if ( c->statMaxLevel[c->lineNo] < (float)triggerLevel )
-				c->statMaxLevel[c->lineNo] = (float)triggerLevel;
+	st = cmd_stat_lookup(c, c->freq, c->lineNo);
+	if (st) {
+		if ( st->numLevels == 0 ) {
+			st->minLevel = (float)triggerLevel;
+			st->maxLevel = (float)triggerLevel;
 		}
+		++st->numLevels;
+		st->sumLevels += triggerLevel;
+		if ( st->minLevel > (float)triggerLevel )
+			st->minLevel = (float)triggerLevel;
+		if ( st->maxLevel < (float)triggerLevel )
+			st->maxLevel = (float)triggerLevel;
 	}
+	waitTrigger = st ? (st->blockedUntil > c->measClock ? (int)(st->blockedUntil - c->measClock) : 0) : -1;
 
 	adcText[0] = 0;
 	if (c->checkADCmax && c->checkADCrms) {
@@ -729,14 +1148,17 @@ static void checkTriggerCommand(struct cmd_state *c, unsigned char adcSampleMax,
 		sprintf(adcText, "adc rms %5.1f ", adcRms );
 	}
 
-	if ( c->lineNo < FREQUENCIES_LIMIT && c->waitTrigger[c->lineNo] <= 0 ) {
-			c->waitTrigger[c->lineNo] = triggerCommand ? c->numBlockTrigger : 0;
+	if (c->resultFd >= 0)
+		cmd_write_result(c, triggerLevel, adcMax, adcRms,
+			(triggerCommand ? 1 : 0) | (waitTrigger > 0 ? 2 : 0) | (!st ? 4 : 0));
+
+	if ( st && waitTrigger <= 0 ) {
+			st->blockedUntil = c->measClock + (triggerCommand ? c->numBlockTrigger : 0);
 			if (verbosity)
 				fprintf(stderr, "%.3f kHz: gain %4.1f + level %4.1f dB %s=> %s\n",
 					(double)c->freq /1000.0, 0.1*c->gain, triggerLevel, adcText,
 					(triggerCommand ? "activates trigger" : "does not trigger") );
-			if (triggerCommand && c->command && c->command[0]) {
-				fprintf(stderr, "command to trigger is '%s %s'\n", c->command, c->args);
+			if (triggerCommand && (c->triggerSink || (c->command && c->command[0]))) {
 				/* prepare search/replace of special parameters for command arguments */
 				snprintf(acRepFreq, 32, "%.0f", (double)c->freq);
 				snprintf(acRepGain, 32, "%d", c->gain);
@@ -744,12 +1166,21 @@ static void checkTriggerCommand(struct cmd_state *c, unsigned char adcSampleMax,
 				execReplaceStrings[3] = aCritStr[c->trigCrit];
 				snprintf(acRepRefLevel, 32, "%d", (int)(0.5 + c->refLevel*10.0) );
 				snprintf(acRepRefTolerance, 32, "%d", (int)(0.5 + c->refLevelTol*10.0) );
-				executeInBackground( c->command, c->args, execSearchStrings, execReplaceStrings );
+				if (c->triggerSink) {
+					/* never fall back to fork per trigger, not even with a broken sink */
+					if (c->triggerFd >= 0)
+						sendTriggerRecord(c, execSearchStrings, execReplaceStrings);
+					else
+						c->triggerDropped++;
+				} else {
+					fprintf(stderr, "command to trigger is '%s %s'\n", c->command, c->args);
+					executeInBackground( c->command, c->args, execSearchStrings, execReplaceStrings );
+				}
 			}
 	} else if (verbosity) {
 		fprintf(stderr, "%.3f kHz: gain %4.1f + level %4.1f dB %s=> %s, blocks for %d\n",
 			(double)c->freq /1000.0, 0.1*c->gain, triggerLevel, adcText, (triggerCommand ? "would trigger" : "does not trigger"),
-			(c->lineNo < FREQUENCIES_LIMIT ? c->waitTrigger[c->lineNo] : -1 ) );
+			waitTrigger );
 	}
 	c->numSummed++;
 }
@@ -901,6 +1332,8 @@ int atan_lut_init(void)
 {
 	int i = 0;
 
+	if (atan_lut)
+		return 0;
 	atan_lut = malloc(atan_lut_size * sizeof(int));
 
 	for (i = 0; i < atan_lut_size; i++) {
@@ -966,6 +1399,112 @@ int esbensen(int ar, int aj, int br, int bj)
 	return (scaled_pi * cj / (ar*ar+aj*aj+1));
 }
 
+#define DISC_SCALE		((float)(1<<14) / 3.14159265f)
+
+int polar_disc_poly(int ar, int aj, int br, int bj)
+{
+	float cr = (float)ar * br + (float)aj * bj;
+	float cj = (float)aj * br - (float)ar * bj;
+	float ax = fabsf(cr), ay = fabsf(cj);
+	float mn = (ax < ay) ? ax : ay;
+	float mx = (ax < ay) ? ay : ax;
+	float a = mn / (mx + 1E-20f);
+	float t = a * a;
+	float r = ((DISC_ATAN_P3 * t + DISC_ATAN_P2) * t + DISC_ATAN_P1) * t * a + a;
+	if (ay > ax)
+		r = 1.57079633f - r;
+	if (cr < 0)
+		r = 3.14159265f - r;
+	if (cj < 0)
+		r = -r;
+	return (int)(r * DISC_SCALE);
+}
+
+/* discriminate n samples: out[k] from lp samples k and k-1, k = 1 .. n-1 */
+static void polar_disc_block_generic(const int16_t *lp, int16_t *out, int n)
+{
+	int k;
+	for (k = 1; k < n; k++)
+		out[k] = (int16_t)polar_disc_poly(lp[2*k], lp[2*k+1], lp[2*k-2], lp[2*k-1]);
+}
+
+#ifdef HAVE_SSE2
+SSE2_ATTR
+static __m128i polar_disc_sse2_4(const int16_t *cur)
+/* 4 samples: cur[0..7] with previous samples at cur[-2..5] */
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	const __m128i odd = _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+	__m128i a = _mm_loadu_si128((const __m128i *)cur);
+	__m128i b = _mm_loadu_si128((const __m128i *)(cur - 2));
+	/* (br, bj) -> (-bj, br) */
+	__m128i bs = _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, _MM_SHUFFLE(2,3,0,1)), _MM_SHUFFLE(2,3,0,1));
+	__m128i bn = _mm_or_si128(_mm_and_si128(odd, bs), _mm_andnot_si128(odd, _mm_sub_epi16(_mm_setzero_si128(), bs)));
+	/* a * conj(b) */
+	__m128 x = _mm_cvtepi32_ps(_mm_madd_epi16(a, b));
+	__m128 y = _mm_cvtepi32_ps(_mm_madd_epi16(a, bn));
+	__m128 ax = _mm_andnot_ps(sign, x);
+	__m128 ay = _mm_andnot_ps(sign, y);
+	__m128 mn = _mm_min_ps(ax, ay);
+	__m128 mx = _mm_max_ps(ax, ay);
+	__m128 q = _mm_div_ps(mn, _mm_add_ps(mx, _mm_set1_ps(1E-20f)));
+	__m128 t = _mm_mul_ps(q, q);
+	__m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(DISC_ATAN_P3), t), _mm_set1_ps(DISC_ATAN_P2));
+	__m128 m;
+	r = _mm_add_ps(_mm_mul_ps(r, t), _mm_set1_ps(DISC_ATAN_P1));
+	r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, t), q), q);
+	/* octant and quadrant corrections */
+	m = _mm_cmpgt_ps(ay, ax);
+	r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(1.57079633f), r)), _mm_andnot_ps(m, r));
+	m = _mm_cmplt_ps(x, _mm_setzero_ps());
+	r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(3.14159265f), r)), _mm_andnot_ps(m, r));
+	r = _mm_xor_ps(r, _mm_and_ps(sign, y));
+	return _mm_cvttps_epi32(_mm_mul_ps(r, _mm_set1_ps(DISC_SCALE)));
+}
+
+SSE2_ATTR
+static void polar_disc_block_sse2(const int16_t *lp, int16_t *out, int n)
+{
+	int k;
+	/* 8 samples per iteration */
+	for (k = 1; k + 8 <= n; k += 8) {
+		__m128i lo = polar_disc_sse2_4(lp + 2*k);
+		__m128i hi = polar_disc_sse2_4(lp + 2*k + 8);
+		_mm_storeu_si128((__m128i *)(out + k), _mm_packs_epi32(lo, hi));
+	}
+	for (; k < n; k++)
+		out[k] = (int16_t)polar_disc_poly(lp[2*k], lp[2*k+1], lp[2*k-2], lp[2*k-1]);
+}
+#endif
+
+static void (*polar_disc_block)(const int16_t *lp, int16_t *out, int n) = polar_disc_block_generic;
+
+static int cpu_has_sse2(void)
+{
+#ifdef HAVE_SSE2
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") ? 1 : 0;
+#else
+	return 1;
+#endif
+#else
+	return 0;
+#endif
+}
+
+const char * polar_disc_block_init(void)
+{
+#ifdef HAVE_SSE2
+	if (cpu_has_sse2()) {
+		polar_disc_block = polar_disc_block_sse2;
+		return "sse2";
+	}
+#endif
+	polar_disc_block = polar_disc_block_generic;
+	return "generic";
+}
+
 void fm_demod(struct demod_state *fm)
 {
 	int i, pcm;
@@ -973,7 +1512,13 @@ void fm_demod(struct demod_state *fm)
 	pcm = polar_discriminant(lp[0], lp[1],
 		fm->pre_r, fm->pre_j);
 	fm->result[0] = (int16_t)pcm;
-	for (i = 2; i < (fm->lp_len-1); i += 2) {
+	if (fm->custom_atan == 4) {
+		polar_disc_block(lp, fm->result, fm->lp_len/2);
+		i = fm->lp_len;	/* skip scalar loop */
+	} else {
+		i = 2;
+	}
+	for (; i < (fm->lp_len-1); i += 2) {
 		switch (fm->custom_atan) {
 		case 0:
 			pcm = polar_discriminant(lp[i], lp[i+1],
@@ -1052,7 +1597,7 @@ void raw_demod(struct demod_state *fm)
 
 void deemph_filter(struct demod_state *fm)
 {
-	static int avg;  /* cheating... */
+	int avg = fm->deemph_avg;
 	int i, d;
 	/* de-emph IIR
 	 * avg = avg * (1 - alpha) + sample * alpha;
@@ -1066,6 +1611,7 @@ void deemph_filter(struct demod_state *fm)
 		}
 		fm->result[i] = (int16_t)avg;
 	}
+	fm->deemph_avg = avg;
 }
 
 void dc_block_audio_filter(struct demod_state *fm)
@@ -1083,29 +1629,6 @@ void dc_block_audio_filter(struct demod_state *fm)
 	fm->dc_avg = avg;
 }
 
-void dc_block_raw_filter(struct demod_state *fm, int16_t *buf, int len)
-{
-	/* derived from dc_block_audio_filter,
-		running over the raw I/Q components
-	*/
-	int i, avgI, avgQ;
-	int64_t sumI = 0;
-	int64_t sumQ = 0;
-	for (i = 0; i < len; i += 2) {
-		sumI += buf[i];
-		sumQ += buf[i+1];
-	}
-	avgI = sumI / ( len / 2 );
-	avgQ = sumQ / ( len / 2 );
-	avgI = (avgI + fm->dc_avgI * fm->rdc_block_const) / ( fm->rdc_block_const + 1 );
-	avgQ = (avgQ + fm->dc_avgQ * fm->rdc_block_const) / ( fm->rdc_block_const + 1 );
-	for (i = 0; i < len; i += 2) {
-		buf[i] -= avgI;
-		buf[i+1] -= avgQ;
-	}
-	fm->dc_avgI = avgI;
-	fm->dc_avgQ = avgQ;
-}
 int mad(int16_t *samples, int len, int step)
 /* mean average deviation */
 {
@@ -1219,6 +1742,259 @@ void arbitrary_resample(int16_t *buf1, int16_t *buf2, int len1, int len2)
 	}
 }
 
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+	for (k = 1; k < 30; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+static double kaiser(int n, int len, double beta)
+/* n = 0 .. len-1 */
+{
+	double r = 2.0 * n / (len - 1) - 1.0;
+	return bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+}
+
+static void hb_design(struct hb_stage *st, int ntaps)
+/* windowed sinc halfband with gain 2, to match the summing low_pass().
+ * odd taps are normalized to sum up to the center tap: this puts an
+ * exact zero at nyquist, where the next decimation folds onto DC */
+{
+	int n, c = ntaps / 2;
+	double h[HB_MAX_TAPS], sum = 0.0;
+	st->ntaps = ntaps;
+	for (n = 0; n < ntaps; n++) {
+		int m = n - c;
+		h[n] = (m % 2) ? sin(M_PI * m / 2.0) / (M_PI * m) * kaiser(n, ntaps, 7.0) : 0.0;
+		sum += h[n];
+	}
+	for (n = 0; n < ntaps; n++)
+		st->coef[n] = (float)(h[n] / sum);
+	st->coef[c] = 1.0f;
+	memset(st->hist, 0, sizeof(st->hist));
+}
+
+static int gcd(int a, int b)
+{
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+void decim_chain_free(struct demod_state *d)
+{
+	struct decim_chain *ch = &d->chain;
+	free(ch->bufA);
+	free(ch->bufB);
+	free(ch->resamp_coef);
+	free(ch->resamp_buf);
+	ch->bufA = ch->bufB = ch->resamp_coef = ch->resamp_buf = NULL;
+	ch->planned = 0;
+}
+
+int decim_chain_plan(struct demod_state *d)
+/* one halfband stage per factor 2 of downsample: short filters in the
+ * early stages, where the transition band is wide, long in the last */
+{
+	struct decim_chain *ch = &d->chain;
+	int k, n, g, ntaps, taps, remain;
+	double fc, x;
+
+	ch->bufA = ch->bufB = ch->resamp_coef = ch->resamp_buf = NULL;
+	ch->num_stages = d->downsample_passes;
+	if (ch->num_stages > HB_MAX_STAGES || (1 << ch->num_stages) != d->downsample)
+		return -1;
+	for (k = 0; k < ch->num_stages; k++) {
+		remain = ch->num_stages - 1 - k;	/* stages after this one */
+		ntaps = (remain == 0) ? HB_MAX_TAPS : (remain == 1) ? 15 : 11;
+		hb_design(&ch->stage[k], ntaps);
+	}
+	ch->bufA = malloc((MAXIMUM_BUF_LENGTH + 2*HB_MAX_TAPS) * sizeof(float));
+	ch->bufB = malloc((MAXIMUM_BUF_LENGTH + 2*HB_MAX_TAPS) * sizeof(float));
+	if (!ch->bufA || !ch->bufB)
+		goto err;
+
+	ch->interp = ch->decim = 0;
+	if (d->rate_out2 > 0 && d->rate_out2 != d->rate_out) {
+		g = gcd(d->rate_out, d->rate_out2);
+		ch->interp = d->rate_out2 / g;
+		ch->decim = d->rate_out / g;
+		if (ch->interp > RESAMP_MAX_INTERP || ch->interp > ch->decim) {
+			fprintf(stderr, "Polyphase resampler: ratio %d/%d not supported, using simple resampler.\n",
+				ch->interp, ch->decim);
+			ch->interp = ch->decim = 0;
+		}
+	}
+	if (ch->interp) {
+		/* prototype at interp * rate_out with cutoff below the lower nyquist */
+		taps = ch->interp * RESAMP_TAPS_PER_PHASE;
+		fc = 0.45 / ch->decim;
+		ch->resamp_coef = malloc(taps * sizeof(float));
+		ch->resamp_buf = calloc(MAXIMUM_BUF_LENGTH + RESAMP_TAPS_PER_PHASE, sizeof(float));
+		if (!ch->resamp_coef || !ch->resamp_buf)
+			goto err;
+		for (n = 0; n < taps; n++) {
+			x = n - (taps - 1) / 2.0;
+			ch->resamp_coef[n] = (float)(ch->interp * 2.0 * fc
+				* (x == 0.0 ? 1.0 : sin(2.0 * M_PI * fc * x) / (2.0 * M_PI * fc * x))
+				* kaiser(n, taps, 8.0));
+		}
+		ch->resamp_phase = 0;
+		ch->resamp_index = 0;
+	}
+	ch->planned = 1;
+	if (verbosity)
+		fprintf(stderr, "decimation chain: %d halfband stages, audio resampler %d/%d\n",
+			ch->num_stages, ch->interp, ch->decim);
+	return 0;
+err:
+	decim_chain_free(d);
+	return -1;
+}
+
+static void hb_decimate_stage(struct hb_stage *st, const float *in, float *out, int n)
+/* in: n complex samples with (ntaps-1) complex samples headroom before in[0] */
+{
+	float *x = (float *)in - 2*(st->ntaps - 1);
+	const float *h = st->coef;
+	int c = st->ntaps / 2;
+	int i, k;
+	float re, im;
+	memcpy(x, st->hist, 2*(st->ntaps - 1) * sizeof(float));
+	for (i = 0; i < n/2; i++) {
+		const float *p = x + 4*i;	/* oldest sample of this output */
+		re = p[2*c];
+		im = p[2*c+1];
+		for (k = 0; k < c; k += 2) {
+			re += h[k] * (p[2*k] + p[2*(st->ntaps-1-k)]);
+			im += h[k] * (p[2*k+1] + p[2*(st->ntaps-1-k)+1]);
+		}
+		out[2*i]   = re;
+		out[2*i+1] = im;
+	}
+	memcpy(st->hist, x + 2*n, 2*(st->ntaps - 1) * sizeof(float));
+}
+
+void hb_decimate(struct demod_state *d)
+/* lowpassed -> lowpassed, decimated by 2^num_stages */
+{
+	struct decim_chain *ch = &d->chain;
+	float *in = ch->bufA + 2*HB_MAX_TAPS;
+	float *out = ch->bufB + 2*HB_MAX_TAPS;
+	float *t;
+	int i, k, n = d->lp_len / 2;
+	for (i = 0; i < d->lp_len; i++)
+		in[i] = d->lowpassed[i];
+	for (k = 0; k < ch->num_stages; k++) {
+		hb_decimate_stage(&ch->stage[k], in, out, n);
+		n /= 2;
+		t = in; in = out; out = t;
+	}
+	for (i = 0; i < 2*n; i++) {
+		float v = in[i];
+		v = (v > 32767.0f) ? 32767.0f : (v < -32768.0f) ? -32768.0f : v;
+		d->lowpassed[i] = (int16_t)lrintf(v);
+	}
+	d->lp_len = 2*n;
+}
+
+void polyphase_resample(struct demod_state *d)
+/* result at rate_out -> result at rate_out2, at most result_cap samples.
+ * input left over, once the output is full, is dropped */
+{
+	struct decim_chain *ch = &d->chain;
+	const int T = RESAMP_TAPS_PER_PHASE;
+	float *x = ch->resamp_buf;
+	int i, k, n = d->result_len, o = 0;
+	int idx = ch->resamp_index, ph = ch->resamp_phase;
+	float acc;
+	for (i = 0; i < n; i++)
+		x[T - 1 + i] = d->result[i];
+	while (idx < n && o < d->result_cap) {
+		const float *h = ch->resamp_coef + ph;
+		const float *p = x + T - 1 + idx;
+		acc = 0.0f;
+		for (k = 0; k < T; k++)
+			acc += h[k * ch->interp] * p[-k];
+		acc = (acc > 32767.0f) ? 32767.0f : (acc < -32768.0f) ? -32768.0f : acc;
+		d->result[o++] = (int16_t)lrintf(acc);
+		ph += ch->decim;
+		idx += ph / ch->interp;
+		ph %= ch->interp;
+	}
+	if (idx < n)
+		idx = n;
+	ch->resamp_index = idx - n;
+	ch->resamp_phase = ph;
+	memmove(x, x + n, (T - 1) * sizeof(float));
+	d->result_len = o;
+}
+
+int pre_detect_rms(struct demod_state *d)
+/* cheap estimate of rms() after decimation: boxcar sums over every
+ * PREDET_STRIDE-th output of the 2nd half of the block.
+ * the 1st half might be muted after a hop. the boxcar passes more
+ * out of band energy than the real filters and only a subset of the
+ * samples is summed, so the estimate may be off in either direction:
+ * callers need a margin against the squelch level */
+{
+	int16_t *lp = d->lowpassed;
+	int ds = d->downsample;
+	int seg = 2 * ds;
+	int start = (d->lp_len / 2) / seg * seg;
+	int i, k, num = 0;
+	int32_t sr, sj;
+	double p = 0.0;
+	for (i = start; i + seg <= d->lp_len; i += seg * PREDET_STRIDE) {
+		sr = sj = 0;
+		for (k = 0; k < seg; k += 2) {
+			sr += lp[i+k];
+			sj += lp[i+k+1];
+		}
+		p += (double)sr * sr + (double)sj * sj;
+		num++;
+	}
+	if (!num)
+		return -1;
+	/* rms() runs over interleaved I and Q */
+	return (int)sqrt(p / (2 * num));
+}
+
+static double time_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, ticks;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&ticks);
+	return (double)ticks.QuadPart * 1e9 / (double)freq.QuadPart;
+#elif defined(__APPLE__)
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+#endif
+}
+
+static void stage_mark(struct stage_timing *t, enum demod_stage stage)
+{
+	double now = time_ns();
+	t->ns[stage] += now - t->last;
+	t->last = now;
+}
+
+#define STAGE_DONE(d, stage) do { if ((d)->timing) stage_mark((d)->timing, (stage)); } while (0)
+
 void full_demod(struct demod_state *d)
 {
 	struct cmd_state *c = d->cmd;
@@ -1227,12 +2003,20 @@ void full_demod(struct demod_state *d)
 	int sr = 0;
 	static int printBlockLen = 1;
 	ds_p = d->downsample_passes;
-	if (ds_p) {
+	if (d->hb_chain && !d->chain.planned && decim_chain_plan(d) < 0) {
+		fprintf(stderr, "Failed to set up halfband decimation chain, using fifth order filters.\n");
+		d->hb_chain = 0;
+	}
+	if (d->hb_chain) {
+		hb_decimate(d);
+		STAGE_DONE(d, STAGE_DECIM);
+	} else if (ds_p) {
 		for (i=0; i < ds_p; i++) {
 			fifth_order(d->lowpassed,   (d->lp_len >> i), d->lp_i_hist[i]);
 			fifth_order(d->lowpassed+1, (d->lp_len >> i) - 1, d->lp_q_hist[i]);
 		}
 		d->lp_len = d->lp_len >> ds_p;
+		STAGE_DONE(d, STAGE_DECIM);
 		/* droop compensation */
 		if (d->comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
 			generic_fir(d->lowpassed, d->lp_len,
@@ -1240,8 +2024,10 @@ void full_demod(struct demod_state *d)
 			generic_fir(d->lowpassed+1, d->lp_len-1,
 				cic_9_tables[ds_p], d->droop_q_hist);
 		}
+		STAGE_DONE(d, STAGE_FIR);
 	} else {
 		low_pass(d);
+		STAGE_DONE(d, STAGE_DECIM);
 	}
 	/* power squelch */
 	if (d->squelch_level) {
@@ -1257,7 +2043,7 @@ void full_demod(struct demod_state *d)
 		}
 	}
 
-	if (printLevels) {
+	if (printLevels && d == &demod) {
 		if (!sr)
 			sr = rms(d->lowpassed, d->lp_len, 1, d->dc_block_raw);
 		--printLevelNo;
@@ -1295,8 +2081,10 @@ void full_demod(struct demod_state *d)
 			c->numSummed++;
 		}
 	}
+	STAGE_DONE(d, STAGE_LEVEL);
 
 	d->mode_demod(d);  /* lowpassed -> result */
+	STAGE_DONE(d, STAGE_DEMOD);
 	if (d->mode_demod == &raw_demod) {
 		return;
 	}
@@ -1304,14 +2092,163 @@ void full_demod(struct demod_state *d)
 	/* use nicer filter here too? */
 	if (d->post_downsample > 1) {
 		d->result_len = low_pass_simple(d->result, d->result_len, d->post_downsample);}
+	STAGE_DONE(d, STAGE_POSTDS);
 	if (d->deemph) {
 		deemph_filter(d);}
 	if (d->dc_block_audio) {
 		dc_block_audio_filter(d);}
-	if (d->rate_out2 > 0) {
+	STAGE_DONE(d, STAGE_DEEMPH);
+	if (d->hb_chain && d->chain.interp) {
+		polyphase_resample(d);
+	} else if (d->rate_out2 > 0) {
 		low_pass_real(d);
 		/* arbitrary_resample(d->result, d->result, d->result_len, d->result_len * d->rate_out2 / d->rate_out); */
 	}
+	STAGE_DONE(d, STAGE_RESAMPLE);
+}
+
+void nco_init(void)
+{
+	int i;
+	for (i = 0; i < (1 << NCO_LUT_BITS); i++) {
+		double a = 2.0 * M_PI * i / (1 << NCO_LUT_BITS);
+		nco_cos[i] = (int16_t)round(cos(a) * (1<<14));
+		nco_sin[i] = (int16_t)round(sin(a) * (1<<14));
+	}
+}
+
+void channel_mix(struct channel_state *ch, const int16_t *in, int16_t *out, int len)
+/* shift the channel to zero IF. output stays in input range */
+{
+	int i, c, s;
+	uint32_t phase = ch->phase;
+	for (i = 0; i < len; i += 2) {
+		c = nco_cos[phase >> (32 - NCO_LUT_BITS)];
+		s = nco_sin[phase >> (32 - NCO_LUT_BITS)];
+		out[i]   = (int16_t)((in[i] * c - in[i+1] * s) >> 14);
+		out[i+1] = (int16_t)((in[i] * s + in[i+1] * c) >> 14);
+		phase += ch->phase_inc;
+	}
+	ch->phase = phase;
+}
+
+/* statistics collected by condition_block() */
+struct cond_stats
+{
+	int64_t sumI, sumQ;	/* before dc removal */
+	uint64_t pow;		/* sum of I^2 + Q^2 */
+	unsigned char max;	/* maximum raw byte */
+};
+
+/* single pass over the raw block: u8 -> int16 conversion, subtraction of
+ * the dc estimate, -fs/4 rotation (like rotate16_neg90()) and statistics.
+ * len in bytes, multiple of 2.
+ * portable fallback: two short loops the compiler can vectorize on its own */
+static void condition_block_generic(const unsigned char *buf, int16_t *out, int len,
+	int16_t avgI, int16_t avgQ, int rotate, struct cond_stats *st)
+{
+	int i, I, Q;
+	int16_t tmp;
+	unsigned char mx = st->max;
+	int32_t sumI = 0, sumQ = 0;
+	uint64_t pow = 0;
+	for (i = 0; i < len; i += 2) {
+		mx = (buf[i] > mx) ? buf[i] : mx;
+		mx = (buf[i+1] > mx) ? buf[i+1] : mx;
+		I = (int)buf[i] - 127;
+		Q = (int)buf[i+1] - 127;
+		sumI += I;
+		sumQ += Q;
+		pow += (uint32_t)(I * I + Q * Q);
+		out[i] = (int16_t)(I - avgI);
+		out[i+1] = (int16_t)(Q - avgQ);
+	}
+	if (rotate) {
+		for (i = 0; i + 8 <= len; i += 8) {
+			/* 90 rotation is 1+0j, 0-1j, -1+0j, 0+1j */
+			tmp = out[i+3];
+			out[i+3] = -out[i+2];
+			out[i+2] = tmp;
+			out[i+4] = -out[i+4];
+			out[i+5] = -out[i+5];
+			tmp = out[i+6];
+			out[i+6] = -out[i+7];
+			out[i+7] = tmp;
+		}
+	}
+	st->max = mx;
+	st->sumI += sumI;
+	st->sumQ += sumQ;
+	st->pow += pow;
+}
+
+#ifdef HAVE_SSE2
+SSE2_ATTR
+static void condition_block_sse2(const unsigned char *buf, int16_t *out, int len,
+	int16_t avgI, int16_t avgQ, int rotate, struct cond_stats *st)
+{
+	/* 16 bytes = 8 samples = 2 rotation periods per iteration */
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c127 = _mm_set1_epi16(127);
+	const __m128i selI = _mm_set_epi16(0, 1, 0, 1, 0, 1, 0, 1);
+	const __m128i selQ = _mm_set_epi16(1, 0, 1, 0, 1, 0, 1, 0);
+	const __m128i avg = _mm_set_epi16(avgQ, avgI, avgQ, avgI, avgQ, avgI, avgQ, avgI);
+	/* signs after swapping samples 1 and 3: (I, Q) (Q, -I) (-I, -Q) (-Q, I) */
+	const __m128i sgn = rotate ? _mm_set_epi16(1, -1, -1, -1, -1, 1, 1, 1) : _mm_set1_epi16(1);
+	__m128i vmax = zero, sI = zero, sQ = zero, spow = zero;
+	int32_t t[4];
+	unsigned char m[16];
+	int i, k;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), c127);
+		__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), c127);
+		vmax = _mm_max_epu8(vmax, v);
+		sI = _mm_add_epi32(sI, _mm_add_epi32(_mm_madd_epi16(lo, selI), _mm_madd_epi16(hi, selI)));
+		sQ = _mm_add_epi32(sQ, _mm_add_epi32(_mm_madd_epi16(lo, selQ), _mm_madd_epi16(hi, selQ)));
+		spow = _mm_add_epi32(spow, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+		lo = _mm_sub_epi16(lo, avg);
+		hi = _mm_sub_epi16(hi, avg);
+		if (rotate) {
+			lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(2,3,1,0)), _MM_SHUFFLE(2,3,1,0));
+			hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(2,3,1,0)), _MM_SHUFFLE(2,3,1,0));
+			lo = _mm_mullo_epi16(lo, sgn);
+			hi = _mm_mullo_epi16(hi, sgn);
+		}
+		_mm_storeu_si128((__m128i *)(out + i), lo);
+		_mm_storeu_si128((__m128i *)(out + i + 8), hi);
+	}
+	/* per lane sums fit into 32 bit for MAXIMUM_BUF_LENGTH */
+	_mm_storeu_si128((__m128i *)t, sI);
+	st->sumI += (int64_t)t[0] + t[1] + t[2] + t[3];
+	_mm_storeu_si128((__m128i *)t, sQ);
+	st->sumQ += (int64_t)t[0] + t[1] + t[2] + t[3];
+	_mm_storeu_si128((__m128i *)t, spow);
+	st->pow += (uint64_t)(uint32_t)t[0] + (uint32_t)t[1] + (uint32_t)t[2] + (uint32_t)t[3];
+	_mm_storeu_si128((__m128i *)m, vmax);
+	for (k = 0; k < 16; k++)
+		if (m[k] > st->max)
+			st->max = m[k];
+	/* remainder keeps the rotation phase: i is a multiple of 8 samples */
+	if (i < len)
+		condition_block_generic(buf + i, out + i, len - i, avgI, avgQ, rotate, st);
+}
+#endif
+
+static void (*condition_block)(const unsigned char *buf, int16_t *out, int len,
+	int16_t avgI, int16_t avgQ, int rotate, struct cond_stats *st) = condition_block_generic;
+
+static void dc_raw_update(struct demod_state *d, const struct cond_stats *st, int len)
+/* IIR of the block mean, subtracted by condition_block() from the next block */
+{
+	int avgI, avgQ;
+	if (!d->dc_block_raw)
+		return;
+	avgI = (int)(st->sumI / (len / 2));
+	avgQ = (int)(st->sumQ / (len / 2));
+	d->dc_avgI = (avgI + d->dc_avgI * d->rdc_block_const) / ( d->rdc_block_const + 1 );
+	d->dc_avgQ = (avgQ + d->dc_avgQ * d->rdc_block_const) / ( d->rdc_block_const + 1 );
 }
 
 static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
@@ -1320,9 +2257,8 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 	struct demod_state *d = s->demod_target;
 	struct cmd_state *c = d->cmd;
 	int i, muteLen = s->mute;
-	unsigned char sampleMax;
-	uint32_t sampleP, samplePowSum = 0.0;
-	int samplePowCount = 0, step = 2;
+	int16_t *buf16;
+	struct cond_stats st;
 	time_t rawtime;
 
 	if (do_exit) {
@@ -1348,48 +2284,31 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 		s->samplePowCount = 0;
 		s->sampleMax = 0;
 	}
-	/* OR all samples to allow checking overflow
-	 * - before conversion to 16 bit and before DC filtering.
-	 * we only get bitmask of positive samples (after -127) but that won't matter */
-	if (c->checkADCmax ) {
-		sampleMax = s->sampleMax;
-		for (i=0; i<(int)len; i++) {
-			if ( buf[i] > sampleMax )
-				sampleMax = buf[i];
-		}
-		s->sampleMax = sampleMax;
-	}
-	if (c->checkADCrms ) {
-		while ( (int)len >= 16384 * step )
-			step += 2;
-		for (i=0; i<(int)len; i+= step) {
-			sampleP  = ( (int)buf[i]   -127 ) * ( (int)buf[i]   -127 );  /* I^2 */
-			sampleP += ( (int)buf[i+1] -127 ) * ( (int)buf[i+1] -127 );  /* Q^2 */
-			samplePowSum += sampleP;
-			++samplePowCount;
-		}
-		s->samplePowSum += (double)samplePowSum / samplePowCount;
+	/* conversion goes directly into the queued block */
+	buf16 = queue_write_block(&d->queue);
+	if (!buf16)
+		return;	/* demod is too slow: block is dropped and counted */
+
+	/* one pass: convert to 16 bit, remove DC (estimated up to the previous
+	 * block), down-mix by -fs/4 and collect adc max and power -
+	 * both before DC filtering */
+	memset(&st, 0, sizeof(st));
+	condition_block(buf, buf16, (int)len,
+		(int16_t)(d->dc_block_raw ? d->dc_avgI : 0),
+		(int16_t)(d->dc_block_raw ? d->dc_avgQ : 0),
+		!s->offset_tuning, &st);
+
+	if (c->checkADCmax && st.max > s->sampleMax)
+		s->sampleMax = st.max;
+	if (c->checkADCrms) {
+		s->samplePowSum += (double)st.pow / (len / 2);
 		s->samplePowCount += 1;
 	}
-	/* 1st: convert to 16 bit - to allow easier calculation of DC */
-	for (i=0; i<(int)len; i++) {
-		s->buf16[i] = ( (int16_t)buf[i] - 127 );
-	}
-	/* 2nd: do DC filtering BEFORE up-mixing */
-	if (d->dc_block_raw) {
-		dc_block_raw_filter(d, s->buf16, (int)len);
-	}
+	/* update DC estimate for the next block */
+	dc_raw_update(d, &st, (int)len);
 	if (muteLen && c->filename)
-		return;	/* "mute" after the dc_block_raw_filter(), giving it time to remove the new DC */
-	/* 3rd: down-mixing */
-	if (!s->offset_tuning) {
-		rotate16_neg90(s->buf16, (int)len);
-	}
-	pthread_rwlock_wrlock(&d->rw);
-	memcpy(d->lowpassed, s->buf16, 2*len);
-	d->lp_len = len;
-	pthread_rwlock_unlock(&d->rw);
-	safe_cond_signal(&d->ready, &d->ready_m);
+		return;	/* "mute" after the DC estimation, giving it time to remove the new DC */
+	queue_commit(&d->queue, (int)len);
 }
 
 static void *dongle_thread_fn(void *arg)
@@ -1399,21 +2318,68 @@ static void *dongle_thread_fn(void *arg)
 	return 0;
 }
 
+static void demod_output(struct demod_state *d)
+{
+	struct output_state *o = d->output_target;
+	int16_t *out = queue_write_block(&o->queue);
+	if (out) {
+		memcpy(out, d->result, 2*d->result_len);
+		queue_commit(&o->queue, d->result_len);
+	}
+}
+
 static void *demod_thread_fn(void *arg)
 {
 	struct demod_state *d = arg;
-	struct output_state *o = d->output_target;
+	struct demod_state *cd;
 	struct cmd_state *c = d->cmd;
+	int16_t *block;
+	int k, len;
 	while (!do_exit) {
-		safe_cond_wait(&d->ready, &d->ready_m);
-		pthread_rwlock_wrlock(&d->rw);
+		block = queue_read_block(&d->queue, &len);
+		if (!block)
+			break;
+		for (k = 0; k < num_channels; k++) {
+			cd = &channels[k].demod;
+			channel_mix(&channels[k], block, cd->lowpassed, len);
+			cd->lp_len = len;
+		}
+		memcpy(d->lowpassed, block, 2*len);
+		d->lp_len = len;
+		queue_release(&d->queue);
+
+		if (d->predetect && controller.freq_len > 1 && d->squelch_level) {
+			int level = pre_detect_rms(d);
+			/* close to the squelch level full_demod() decides */
+			if (level >= 0 && level * PREDET_MARGIN < d->squelch_level) {
+				/* dead channel: hop without decimation and demod */
+				d->predetect_skips++;
+				d->squelch_hits = d->conseq_squelch + 1;
+				queue_flush(&d->queue);
+				safe_cond_signal(&controller.hop, &controller.hop_m);
+				continue;
+			}
+		}
+
+		for (k = 0; k < num_channels; k++) {
+			cd = &channels[k].demod;
+			full_demod(cd);
+			if (cd->squelch_level && cd->squelch_hits > cd->conseq_squelch) {
+				cd->squelch_hits = cd->conseq_squelch + 1;
+				continue;
+			}
+			if (OutputToStdout)
+				demod_output(cd);
+		}
+
 		full_demod(d);
-		pthread_rwlock_unlock(&d->rw);
 		if (d->exit_flag) {
 			do_exit = 1;
 		}
 		if (d->squelch_level && d->squelch_hits > d->conseq_squelch) {
 			d->squelch_hits = d->conseq_squelch + 1;  /* hair trigger */
+			/* queued blocks are from the old frequency */
+			queue_flush(&d->queue);
 			safe_cond_signal(&controller.hop, &controller.hop_m);
 			continue;
 		}
@@ -1428,36 +2394,177 @@ static void *demod_thread_fn(void *arg)
 			continue;
 		}
 
-		if (OutputToStdout) {
-			pthread_rwlock_wrlock(&o->rw);
-			memcpy(o->result, d->result, 2*d->result_len);
-			o->result_len = d->result_len;
-			pthread_rwlock_unlock(&o->rw);
-			safe_cond_signal(&o->ready, &o->ready_m);
-		}
+		if (OutputToStdout)
+			demod_output(d);
 	}
 	return 0;
 }
 
+static int output_open_net(struct output_state *s, const char *url, int rate, int nchan)
+/* "udp://host:port" sends the raw samples, "rtp://host:port[?ttl=n]" sends
+ * RTP with L16 (big endian) payload. ipv6 hosts in brackets.
+ * returns 0 when url is a plain filename, 1 when open, -1 on error */
+{
+	char host[256], port[16], addr[256];
+	const char *p, *e;
+	struct addrinfo hints, *res;
+	int ttl = 1, multicast = 0;
+	size_t n;
+	if (!strncmp(url, "udp://", 6))
+		s->net = OUTPUT_UDP;
+	else if (!strncmp(url, "rtp://", 6))
+		s->net = OUTPUT_RTP;
+	else
+		return 0;
+#ifdef _WIN32
+	{
+		static int wsa_started = 0;
+		WSADATA wsd;
+		if (!wsa_started && WSAStartup(MAKEWORD(2,2), &wsd) == 0)
+			wsa_started = 1;
+	}
+#endif
+	p = url + 6;
+	e = (*p == '[') ? strchr(p, ']') : strchr(p, ':');
+	if (*p == '[' && e)
+		p++;
+	if (!e || (e[0] == ']' && e[1] != ':') || (size_t)(e - p) >= sizeof(host))
+		goto bad_url;
+	memcpy(host, p, e - p);
+	host[e - p] = 0;
+	p = e + ((e[0] == ']') ? 2 : 1);
+	n = strcspn(p, "?");
+	if (!n || n >= sizeof(port))
+		goto bad_url;
+	memcpy(port, p, n);
+	port[n] = 0;
+	if (p[n] == '?') {
+		if (strncmp(p + n + 1, "ttl=", 4))
+			goto bad_url;
+		ttl = atoi(p + n + 5);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		fprintf(stderr, "Failed to resolve %s\n", url);
+		return -1;
+	}
+	s->sock = socket(res->ai_family, SOCK_DGRAM, 0);
+	if (s->sock == INVALID_SOCKET) {
+		fprintf(stderr, "Failed to create socket for %s\n", url);
+		freeaddrinfo(res);
+		return -1;
+	}
+	memcpy(&s->dest, res->ai_addr, res->ai_addrlen);
+	s->dest_len = (int)res->ai_addrlen;
+	freeaddrinfo(res);
+	if (s->dest.ss_family == AF_INET) {
+		multicast = IN_MULTICAST(ntohl(((struct sockaddr_in *)&s->dest)->sin_addr.s_addr));
+		if (multicast)
+			setsockopt(s->sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&ttl, sizeof(ttl));
+	} else if (s->dest.ss_family == AF_INET6) {
+		multicast = IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *)&s->dest)->sin6_addr);
+		if (multicast)
+			setsockopt(s->sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, (const char *)&ttl, sizeof(ttl));
+	}
+
+	s->nchan = nchan;
+	s->rtp_ssrc = (uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)s ^ ((uint32_t)rate << 8);
+	s->rtp_seq = (uint16_t)(s->rtp_ssrc >> 7);
+	s->rtp_ts = s->rtp_ssrc * 2654435761U;
+	fprintf(stderr, "Sending %s to %s%s\n", (s->net == OUTPUT_RTP ? "RTP" : "UDP"),
+		url + 6, (multicast ? " (multicast)" : ""));
+	if (s->net == OUTPUT_RTP) {
+		/* session description for players like ffplay or vlc */
+		if (getnameinfo((struct sockaddr *)&s->dest, s->dest_len, addr, sizeof(addr), NULL, 0, NI_NUMERICHOST) != 0)
+			snprintf(addr, sizeof(addr), "%s", host);
+		fprintf(stderr, "v=0\no=- 0 0 IN %s %s\ns=rtl_fm\nc=IN %s %s%s",
+			(s->dest.ss_family == AF_INET6 ? "IP6" : "IP4"), addr,
+			(s->dest.ss_family == AF_INET6 ? "IP6" : "IP4"), addr,
+			(multicast && s->dest.ss_family == AF_INET ? "/" : ""));
+		if (multicast && s->dest.ss_family == AF_INET)
+			fprintf(stderr, "%d", ttl);
+		fprintf(stderr, "\nt=0 0\nm=audio %s RTP/AVP %d\na=rtpmap:%d L16/%d/%d\n",
+			port, RTP_PAYLOAD_TYPE, RTP_PAYLOAD_TYPE, rate, nchan);
+	}
+	return 1;
+
+bad_url:
+	fprintf(stderr, "Can't parse %s, expected udp://host:port or rtp://host:port[?ttl=n]\n", url);
+	s->net = 0;
+	return -1;
+}
+
+static void output_send_net(struct output_state *s, const int16_t *buf, int len)
+/* split into datagrams of whole frames */
+{
+	unsigned char *pl;
+	int k, n, hdr = (s->net == OUTPUT_RTP) ? RTP_HEADER_LEN : 0;
+	uint16_t v;
+	while (len > 0) {
+		n = (len * 2 > NET_MAX_PAYLOAD) ? NET_MAX_PAYLOAD / 2 : len;
+		pl = s->pkt + hdr;
+		if (hdr) {
+			s->pkt[0] = 0x80;	/* version 2 */
+			s->pkt[1] = RTP_PAYLOAD_TYPE;
+			s->pkt[2] = (unsigned char)(s->rtp_seq >> 8);
+			s->pkt[3] = (unsigned char)s->rtp_seq;
+			for (k = 0; k < 4; k++) {
+				s->pkt[4 + k] = (unsigned char)(s->rtp_ts >> (24 - 8 * k));
+				s->pkt[8 + k] = (unsigned char)(s->rtp_ssrc >> (24 - 8 * k));
+			}
+			/* L16 is network byte order */
+			for (k = 0; k < n; k++) {
+				v = (uint16_t)buf[k];
+				pl[2*k] = (unsigned char)(v >> 8);
+				pl[2*k+1] = (unsigned char)v;
+			}
+			s->rtp_seq++;
+			s->rtp_ts += (uint32_t)(n / s->nchan);
+		} else {
+			memcpy(pl, buf, 2 * n);
+		}
+		if (sendto(s->sock, (const char *)s->pkt, hdr + 2 * n, 0,
+			(struct sockaddr *)&s->dest, s->dest_len) < 0)
+			s->net_errors++;
+		buf += n;
+		len -= n;
+	}
+}
+
 static void *output_thread_fn(void *arg)
 {
 	struct output_state *s = arg;
-	if (!waveHdrStarted) {
+	int16_t *result;
+	int result_len;
+	if (s->net) {
+		while (!do_exit) {
+			result = queue_read_block(&s->queue, &result_len);
+			if (!result)
+				break;
+			output_send_net(s, result, result_len);
+			queue_release(&s->queue);
+		}
+	} else if (!s->is_wave) {
 		while (!do_exit) {
 			/* use timedwait and pad out under runs */
-			safe_cond_wait(&s->ready, &s->ready_m);
-			pthread_rwlock_rdlock(&s->rw);
-			fwrite(s->result, 2, s->result_len, s->file);
-			pthread_rwlock_unlock(&s->rw);
+			result = queue_read_block(&s->queue, &result_len);
+			if (!result)
+				break;
+			fwrite(result, 2, result_len, s->file);
+			queue_release(&s->queue);
 		}
 	} else {
 		while (!do_exit) {
 			/* use timedwait and pad out under runs */
-			safe_cond_wait(&s->ready, &s->ready_m);
-			pthread_rwlock_rdlock(&s->rw);
+			result = queue_read_block(&s->queue, &result_len);
+			if (!result)
+				break;
 			/* distinguish for endianness: wave requires little endian */
-			waveWriteSamples(s->file, s->result, s->result_len, 0);
-			pthread_rwlock_unlock(&s->rw);
+			waveWriteSamples(s->file, result, result_len, 0);
+			queue_release(&s->queue);
 		}
 	}
 	return 0;
@@ -1553,6 +2660,16 @@ static void *controller_thread_fn(void *arg)
 	if (verbosity)
 		fprintf(stderr, "verbose_set_sample_rate(%.0f Hz)\n", (double)dongle.rate);
 	verbose_set_sample_rate(dongle.dev, dongle.rate);
+	if (rtlsdr_get_delivered_sample_rate(dongle.dev) != dongle.rate) {
+		/* direct sampling decimation halves the rate: capture at twice */
+		if (2 * dongle.rate <= 3200000 && !rtlsdr_set_sample_rate(dongle.dev, 2 * dongle.rate))
+			fprintf(stderr, "ds decimation: sampling at %u Hz.\n", 2 * dongle.rate);
+		else {
+			rtlsdr_set_sample_rate(dongle.dev, dongle.rate);
+			fprintf(stderr, "WARNING: ds decimation delivers %u Hz, not the expected %u Hz.\n",
+				rtlsdr_get_delivered_sample_rate(dongle.dev), dongle.rate);
+		}
+	}
 	fprintf(stderr, "Output at %u Hz.\n", demod.rate_in/demod.post_downsample);
 
 	if ( dongle.bandwidth ) {
@@ -1679,6 +2796,21 @@ static void *controller_thread_fn(void *arg)
 	return 0;
 }
 
+int controller_add_freq(struct controller_state *s, uint32_t freq)
+{
+	if (s->freq_len == s->freq_cap) {
+		uint32_t *f = realloc(s->freqs, 2 * s->freq_cap * sizeof(uint32_t));
+		if (!f) {
+			fprintf(stderr, "Out of memory for %d frequencies.\n", 2 * s->freq_cap);
+			return -1;
+		}
+		s->freqs = f;
+		s->freq_cap *= 2;
+	}
+	s->freqs[s->freq_len++] = freq;
+	return 0;
+}
+
 void frequency_range(struct controller_state *s, char *arg)
 {
 	char *start, *stop, *step;
@@ -1690,9 +2822,7 @@ void frequency_range(struct controller_state *s, char *arg)
 	step[-1] = '\0';
 	for(i=(int)atofs(start); i<=(int)atofs(stop); i+=(int)atofs(step))
 	{
-		s->freqs[s->freq_len] = (uint32_t)i;
-		s->freq_len++;
-		if (s->freq_len >= FREQUENCIES_LIMIT) {
+		if (controller_add_freq(s, (uint32_t)i) < 0) {
 			break;}
 	}
 	stop[-1] = ':';
@@ -1725,6 +2855,10 @@ void demod_init(struct demod_state *s)
 	s->squelch_hits = 11;
 	s->downsample_passes = 0;
 	s->comp_fir_size = 0;
+	s->hb_chain = 0;
+	s->predetect = 0;
+	s->predetect_skips = 0;
+	memset(&s->chain, 0, sizeof(struct decim_chain));
 	s->prev_index = 0;
 	s->post_downsample = 1;	// once this works, default = 4
 	s->custom_atan = 0;
@@ -1742,37 +2876,209 @@ void demod_init(struct demod_state *s)
 	s->dc_avgI = 0;
 	s->dc_avgQ = 0;
 	s->rdc_block_const = 9;
-	pthread_rwlock_init(&s->rw, NULL);
-	pthread_cond_init(&s->ready, NULL);
-	pthread_mutex_init(&s->ready_m, NULL);
+	s->timing = NULL;
 	s->output_target = &output;
 	s->cmd = &cmd;
+	s->lowpassed = malloc(MAXIMUM_BUF_LENGTH * sizeof(int16_t));
+	s->result = malloc(MAXIMUM_BUF_LENGTH * sizeof(int16_t));
+	s->result_cap = MAXIMUM_BUF_LENGTH;
+	if (!s->lowpassed || !s->result) {
+		fprintf(stderr, "Failed to allocate demodulator buffers.\n");
+		exit(1);
+	}
 }
 
 void demod_cleanup(struct demod_state *s)
 {
-	pthread_rwlock_destroy(&s->rw);
-	pthread_cond_destroy(&s->ready);
-	pthread_mutex_destroy(&s->ready_m);
+	queue_cleanup(&s->queue);
+	decim_chain_free(s);
+	free(s->lowpassed);
+	free(s->result);
+	s->lowpassed = s->result = NULL;
 }
 
 void output_init(struct output_state *s)
 {
 	s->rate = DEFAULT_SAMPLE_RATE;
-	pthread_rwlock_init(&s->rw, NULL);
-	pthread_cond_init(&s->ready, NULL);
-	pthread_mutex_init(&s->ready_m, NULL);
+	s->is_wave = 0;
+	s->net = 0;
+	s->sock = INVALID_SOCKET;
+	s->file = NULL;
 }
 
 void output_cleanup(struct output_state *s)
 {
-	pthread_rwlock_destroy(&s->rw);
-	pthread_cond_destroy(&s->ready);
-	pthread_mutex_destroy(&s->ready_m);
+	queue_cleanup(&s->queue);
+	if (s->net) {
+		if (s->net_errors)
+			fprintf(stderr, "%s: %u datagrams failed to send\n", s->filename, s->net_errors);
+		closesocket(s->sock);
+		s->sock = INVALID_SOCKET;
+	}
+}
+
+void channel_add(char *arg)
+/* freq[,filename[,squelch_level]] */
+{
+	struct channel_state *ch;
+	char *filename, *squelch;
+	if (num_channels >= CHANNELS_LIMIT) {
+		fprintf(stderr, "Too many channels, maximum %i.\n", CHANNELS_LIMIT);
+		exit(1);
+	}
+	channels = realloc(channels, (num_channels + 1) * sizeof(struct channel_state));
+	if (!channels) {
+		fprintf(stderr, "Failed to allocate channel.\n");
+		exit(1);
+	}
+	ch = &channels[num_channels++];
+	memset(ch, 0, sizeof(struct channel_state));
+	ch->demod.squelch_level = -1;	/* inherit -l */
+	filename = strchr(arg, ',');
+	if (filename) {
+		*filename++ = '\0';
+		squelch = strchr(filename, ',');
+		if (squelch) {
+			*squelch++ = '\0';
+			ch->demod.squelch_level = (int)atof(squelch);
+		}
+		if (filename[0])
+			ch->output.filename = filename;
+	}
+	ch->freq = (uint64_t)atofs(arg);
+}
+
+static int channel_demod_init(struct channel_state *ch)
+/* settings of the primary channel, but own buffers and filter state */
+{
+	struct demod_state *cd = &ch->demod;
+	int squelch = cd->squelch_level;
+
+	memset(cd, 0, sizeof(struct demod_state));
+	cd->rate_in = demod.rate_in;
+	cd->rate_out = demod.rate_out;
+	cd->rate_out2 = demod.rate_out2;
+	cd->downsample = demod.downsample;
+	cd->post_downsample = demod.post_downsample;
+	cd->output_scale = demod.output_scale;
+	cd->squelch_level = (squelch >= 0) ? squelch : demod.squelch_level;
+	cd->conseq_squelch = demod.conseq_squelch;
+	cd->squelch_hits = demod.conseq_squelch + 1;
+	cd->downsample_passes = demod.downsample_passes;
+	cd->comp_fir_size = demod.comp_fir_size;
+	cd->hb_chain = demod.hb_chain;
+	cd->custom_atan = demod.custom_atan;
+	cd->deemph = demod.deemph;
+	cd->deemph_a = demod.deemph_a;
+	cd->dc_block_audio = demod.dc_block_audio;
+	cd->adc_block_const = demod.adc_block_const;
+	cd->dc_block_raw = demod.dc_block_raw;
+	cd->rdc_block_const = demod.rdc_block_const;
+	cd->mode_demod = demod.mode_demod;
+	cd->output_target = &ch->output;
+	cd->cmd = &channel_cmd;
+	/* a channel never sees more than one dongle buffer */
+	cd->lowpassed = malloc(dongle.buf_len * sizeof(int16_t));
+	cd->result = malloc(dongle.buf_len * sizeof(int16_t));
+	cd->result_cap = dongle.buf_len;
+	if (!cd->lowpassed || !cd->result) {
+		fprintf(stderr, "Failed to allocate channel buffers.\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void channel_demod_cleanup(struct channel_state *ch)
+{
+	decim_chain_free(&ch->demod);
+	free(ch->demod.lowpassed);
+	free(ch->demod.result);
+	ch->demod.lowpassed = ch->demod.result = NULL;
+}
+
+int channels_setup(void)
+/* call after optimal_settings() for the tuned frequency */
+{
+	struct channel_state *ch;
+	uint64_t center = dongle.freq + (dongle.offset_tuning ? 0 : dongle.rate / 4);
+	int64_t lo, hi, dc, half = demod.rate_in / 2;
+	int k, r;
+	char *fn;
+
+	/* usable band relative to center: without offset tuning the capture
+	 * is tuned rate/4 below, so the band is asymmetric and the DC spike
+	 * of the tuner sits at -rate/4 */
+	if (dongle.offset_tuning) {
+		lo = -(int64_t)dongle.rate / 2;
+		hi = (int64_t)dongle.rate / 2;
+	} else {
+		lo = -3 * (int64_t)dongle.rate / 4;
+		hi = (int64_t)dongle.rate / 4;
+	}
+	dc = (int64_t)dongle.freq - (int64_t)center;
+
+	if (num_channels)
+		nco_init();
+	for (k = 0; k < num_channels; k++) {
+		ch = &channels[k];
+		ch->offset = (int32_t)((int64_t)ch->freq - (int64_t)center);
+		if (ch->offset - half < lo || ch->offset + half > hi) {
+			fprintf(stderr, "Channel %.3f kHz is outside of the captured band %.3f - %.3f kHz.\n",
+				ch->freq / 1000.0, (center + lo + half) / 1000.0, (center + hi - half) / 1000.0);
+			return -1;
+		}
+		if (!dongle.offset_tuning && ch->offset - half < dc && ch->offset + half > dc) {
+			fprintf(stderr, "Channel %.3f kHz overlaps the DC spike at %.3f kHz, use -E offset or move the primary.\n",
+				ch->freq / 1000.0, (double)dongle.freq / 1000.0);
+			return -1;
+		}
+		/* shift down by offset: phase increment in units of 2^-32 turns */
+		ch->phase = 0;
+		ch->phase_inc = (uint32_t)(int64_t)floor(-(double)ch->offset * 4294967296.0 / dongle.rate + 0.5);
+
+		if (channel_demod_init(ch) < 0)
+			return -1;
+
+		fn = ch->output.filename;
+		output_init(&ch->output);
+		ch->output.rate = output.rate;
+		if (!fn) {
+			snprintf(ch->default_name, sizeof(ch->default_name), "ch_%.0f.raw", (double)ch->freq);
+			fn = ch->default_name;
+		}
+		ch->output.filename = fn;
+		if (strcmp(fn, "-") == 0) {
+			fprintf(stderr, "Channel %.3f kHz: stdout is reserved for the primary channel.\n", ch->freq / 1000.0);
+			return -1;
+		}
+		r = output_open_net(&ch->output, fn, (demod.rate_out2 > 0) ? demod.rate_out2 : demod.rate_out,
+			(demod.mode_demod == &raw_demod) ? 2 : 1);
+		if (r < 0)
+			return -1;
+		if (!r) {
+			ch->output.file = fopen(fn, "wb");
+			if (!ch->output.file) {
+				fprintf(stderr, "Failed to open %s\n", fn);
+				return -1;
+			}
+		}
+		if (queue_init(&ch->output.queue, QueueBlocks, dongle.buf_len, QueueBackpressure) < 0) {
+			fprintf(stderr, "Failed to allocate %d buffers of %u samples.\n", QueueBlocks, dongle.buf_len);
+			return -1;
+		}
+		fprintf(stderr, "Channel %.3f kHz at offset %+d Hz into %s\n", ch->freq / 1000.0, (int)ch->offset, fn);
+	}
+	return 0;
 }
 
 void controller_init(struct controller_state *s)
 {
+	s->freq_cap = FREQUENCIES_INITIAL;
+	s->freqs = malloc(s->freq_cap * sizeof(uint32_t));
+	if (!s->freqs) {
+		fprintf(stderr, "Failed to allocate frequency list.\n");
+		exit(1);
+	}
 	s->freqs[0] = 100000000;
 	s->freq_len = 0;
 	s->edge = 0;
@@ -1786,6 +3092,160 @@ void controller_cleanup(struct controller_state *s)
 {
 	pthread_cond_destroy(&s->hop);
 	pthread_mutex_destroy(&s->hop_m);
+	free(s->freqs);
+	s->freqs = NULL;
+}
+
+void modulation(const char *mode)
+{
+	if (strcmp("nbfm",  mode) == 0 || strcmp("nfm",  mode) == 0 || strcmp("fm",  mode) == 0) {
+		demod.mode_demod = &fm_demod;}
+	if (strcmp("raw",  mode) == 0 || strcmp("iq",  mode) == 0) {
+		demod.mode_demod = &raw_demod;}
+	if (strcmp("am",  mode) == 0) {
+		demod.mode_demod = &am_demod;}
+	if (strcmp("usb", mode) == 0) {
+		demod.mode_demod = &usb_demod;}
+	if (strcmp("lsb", mode) == 0) {
+		demod.mode_demod = &lsb_demod;}
+	if (strcmp("wbfm",  mode) == 0 || strcmp("wfm",  mode) == 0) {
+		controller.wb_mode = 1;
+		demod.mode_demod = &fm_demod;
+		demod.rate_in = 170000;
+		demod.rate_out = 170000;
+		demod.rate_out2 = 32000;
+		output.rate = 32000;
+		demod.custom_atan = 1;
+		//demod.post_downsample = 4;
+		demod.deemph = 1;
+		demod.squelch_level = 0;}
+}
+
+void atan_math(const char *math)
+{
+	if (strcmp("std",  math) == 0) {
+		demod.custom_atan = 0;}
+	if (strcmp("fast", math) == 0) {
+		demod.custom_atan = 1;}
+	if (strcmp("lut",  math) == 0) {
+		atan_lut_init();
+		demod.custom_atan = 2;}
+	if (strcmp("ale", math) == 0) {
+		demod.custom_atan = 3;}
+	if (strcmp("simd", math) == 0) {
+		const char *kernel = polar_disc_block_init();
+		if (verbosity)
+			fprintf(stderr, "using %s kernel for atan math 'simd'\n", kernel);
+		demod.custom_atan = 4;}
+}
+
+void deemph_setup(int timeConstant)
+{
+	double tc = (double)timeConstant * 1e-6;
+	if (demod.deemph)
+		demod.deemph_a = (int)round(1.0/((1.0-exp(-1.0/(demod.rate_out * tc)))));
+}
+
+#define BENCH_MAX_BYTES		(64 * 1024 * 1024)	/* of the recording kept in memory */
+#define BENCH_MIN_SAMPLES	(64 * 1024 * 1024)	/* per run, the recording is repeated */
+
+static int benchmark(const char *filename, const char *modArg, const char *atanArg, int timeConstant)
+/* run the demodulator over a u8 I/Q recording as fast as possible,
+ * for each modulation and atan math - or those given with -M / -A.
+ * prints csv to stdout, stage times are ns per input sample */
+{
+	static const char *mods[] = {"fm", "wbfm", "am", "usb", "lsb", "raw"};
+	static const char *atans[] = {"std", "fast", "lut", "ale", "simd"};
+	struct demod_state base;
+	const char **modList = modArg ? &modArg : mods;
+	const char **atanList = atanArg ? &atanArg : atans;
+	int numMods = modArg ? 1 : (int)(sizeof(mods) / sizeof(mods[0]));
+	int numAtans = atanArg ? 1 : (int)(sizeof(atans) / sizeof(atans[0]));
+	int baseRate = output.rate, baseWb = controller.wb_mode;
+	int blk = (int)dongle.buf_len;
+	int m, a, k, isFm;
+	size_t len, pos;
+	uint64_t samples;
+	double total;
+	unsigned char *buf;
+	struct stage_timing t;
+	struct cond_stats st;
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s\n", filename);
+		return -1;
+	}
+	buf = malloc(BENCH_MAX_BYTES);
+	if (!buf) {
+		fclose(f);
+		return -1;
+	}
+	len = fread(buf, 1, BENCH_MAX_BYTES, f);
+	fclose(f);
+	len -= len % blk;
+	if (!len) {
+		fprintf(stderr, "%s: need at least one buffer of %d bytes.\n", filename, blk);
+		free(buf);
+		return -1;
+	}
+	fprintf(stderr, "benchmark with %u bytes of %s, buffers of %d bytes, %d samples per run\n",
+		(unsigned)len, filename, blk, BENCH_MIN_SAMPLES);
+
+	base = demod;
+	printf("modulation,atan,capture_rate,MS/s,realtime,ns/sample,input,decim,fir,level,demod,postds,deemph,resample\n");
+	for (m = 0; m < numMods; m++) {
+		for (a = 0; a < numAtans; a++) {
+			demod = base;
+			output.rate = baseRate;
+			controller.wb_mode = baseWb;
+			modulation(modList[m]);
+			isFm = (demod.mode_demod == &fm_demod);
+			if (isFm)
+				atan_math(atanList[a]);
+			else if (a)
+				break;	/* atan math is used by fm only */
+			demod.rate_in *= demod.post_downsample;
+			if (!output.rate)
+				output.rate = demod.rate_out;
+			deemph_setup(timeConstant);
+			optimal_settings(100000000, demod.rate_in);
+
+			memset(&t, 0, sizeof(t));
+			demod.timing = &t;
+			for (samples = 0, pos = 0; samples < BENCH_MIN_SAMPLES; samples += blk / 2) {
+				t.last = time_ns();
+				memset(&st, 0, sizeof(st));
+				condition_block(buf + pos, demod.lowpassed, blk,
+					(int16_t)(demod.dc_block_raw ? demod.dc_avgI : 0),
+					(int16_t)(demod.dc_block_raw ? demod.dc_avgQ : 0),
+					!dongle.offset_tuning, &st);
+				dc_raw_update(&demod, &st, blk);
+				demod.lp_len = blk;
+				stage_mark(&t, STAGE_INPUT);
+				full_demod(&demod);
+				pos += blk;
+				if (pos >= len)
+					pos = 0;
+			}
+			demod.timing = NULL;
+			decim_chain_free(&demod);
+
+			for (total = 0.0, k = 0; k < STAGE_COUNT; k++)
+				total += t.ns[k];
+			printf("%s,%s,%u,%.2f,%.1f,%.2f", modList[m], isFm ? atanList[a] : "-",
+				(unsigned)dongle.rate, samples * 1e3 / total,
+				samples * 1e9 / total / dongle.rate, total / samples);
+			for (k = 0; k < STAGE_COUNT; k++)
+				printf(",%.2f", t.ns[k] / samples);
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+	demod = base;
+	free(buf);
+	return 0;
 }
 
 void sanity_checks(void)
@@ -1795,13 +3255,23 @@ void sanity_checks(void)
 		exit(1);
 	}
 
-	if (controller.freq_len >= FREQUENCIES_LIMIT) {
-		fprintf(stderr, "Too many channels, maximum %i.\n", FREQUENCIES_LIMIT);
+	if (controller.freq_len > 1 && demod.squelch_level == 0) {
+		fprintf(stderr, "Please specify a squelch level.  Required for scanning multiple frequencies.\n");
 		exit(1);
 	}
 
-	if (controller.freq_len > 1 && demod.squelch_level == 0) {
-		fprintf(stderr, "Please specify a squelch level.  Required for scanning multiple frequencies.\n");
+	if (cmd.resultFilename && !cmd.filename) {
+		fprintf(stderr, "Binary results (-J) require a command file (-C).\n");
+		exit(1);
+	}
+
+	if (cmd.triggerSink && !cmd.filename) {
+		fprintf(stderr, "A trigger sink (-k) requires a command file (-C).\n");
+		exit(1);
+	}
+
+	if (num_channels && (controller.freq_len > 1 || cmd.filename)) {
+		fprintf(stderr, "Additional channels (-x) can't be combined with scanning or a command file.\n");
 		exit(1);
 	}
 
@@ -1812,12 +3282,15 @@ int main(int argc, char **argv)
 #ifndef _WIN32
 	struct sigaction sigact;
 #endif
-	int r, opt;
+	int r, opt, k;
 	int dev_given = 0;
 	int writeWav = 0;
 	int custom_ppm = 0;
 	int enable_biastee = 0;
 	const char * rtlOpts = NULL;
+	const char * modArg = NULL;
+	const char * atanArg = NULL;
+	const char * benchFile = NULL;
 	enum rtlsdr_ds_mode ds_mode = RTLSDR_DS_IQ;
 	uint32_t ds_temp, ds_threshold = 0;
 	int timeConstant = 75; /* default: U.S. 75 uS */
@@ -1828,27 +3301,28 @@ int main(int argc, char **argv)
 	controller_init(&controller);
 	cmd_init(&cmd);
 
-	while ((opt = getopt(argc, argv, "d:f:g:s:b:l:o:t:r:p:R:E:O:F:A:M:hTC:B:m:L:q:c:w:W:D:nHv")) != -1) {
+	while ((opt = getopt(argc, argv, "d:f:g:s:b:l:o:t:r:p:R:E:O:F:A:M:hTC:J:k:B:m:L:q:c:w:W:D:Q:x:I:nHv")) != -1) {
 		switch (opt) {
 		case 'd':
 			dongle.dev_index = verbose_device_search(optarg);
 			dev_given = 1;
 			break;
 		case 'f':
-			if (controller.freq_len >= FREQUENCIES_LIMIT) {
-				break;}
 			if (strchr(optarg, ':'))
 				{frequency_range(&controller, optarg);}
 			else
-			{
-				controller.freqs[controller.freq_len] = (uint32_t)atofs(optarg);
-				controller.freq_len++;
-			}
+				{controller_add_freq(&controller, (uint32_t)atofs(optarg));}
 			break;
 		case 'C':
 			cmd.filename = optarg;
 			demod.mode_demod = &raw_demod;
 			break;
+		case 'J':
+			cmd.resultFilename = optarg;
+			break;
+		case 'k':
+			cmd.triggerSink = optarg;
+			break;
 		case 'm':
 			MinCaptureRate = (int)atofs(optarg);
 			break;
@@ -1922,6 +3396,10 @@ int main(int argc, char **argv)
 				dongle.bccorner = 0; }
 			if (strcmp("bchi", optarg) == 0 || strcmp("bcH", optarg) == 0 || strcmp("bch", optarg) == 0) {
 				dongle.bccorner = 1; }
+			if (strcmp("qwait", optarg) == 0) {
+				QueueBackpressure = 1; }
+			if (strcmp("predet", optarg) == 0) {
+				demod.predetect = 1; }
 			break;
 		case 'O':
 			rtlOpts = optarg;
@@ -1931,41 +3409,21 @@ int main(int argc, char **argv)
 			break;
 		case 'F':
 			demod.downsample_passes = 1;  /* truthy placeholder */
-			demod.comp_fir_size = atoi(optarg);
+			if (strcmp("hb", optarg) == 0)
+				demod.hb_chain = 1;
+			else
+				demod.comp_fir_size = atoi(optarg);
 			break;
 		case 'A':
-			if (strcmp("std",  optarg) == 0) {
-				demod.custom_atan = 0;}
-			if (strcmp("fast", optarg) == 0) {
-				demod.custom_atan = 1;}
-			if (strcmp("lut",  optarg) == 0) {
-				atan_lut_init();
-				demod.custom_atan = 2;}
-			if (strcmp("ale", optarg) == 0) {
-				demod.custom_atan = 3;}
+			atan_math(optarg);
+			atanArg = optarg;
 			break;
 		case 'M':
-			if (strcmp("nbfm",  optarg) == 0 || strcmp("nfm",  optarg) == 0 || strcmp("fm",  optarg) == 0) {
-				demod.mode_demod = &fm_demod;}
-			if (strcmp("raw",  optarg) == 0 || strcmp("iq",  optarg) == 0) {
-				demod.mode_demod = &raw_demod;}
-			if (strcmp("am",  optarg) == 0) {
-				demod.mode_demod = &am_demod;}
-			if (strcmp("usb", optarg) == 0) {
-				demod.mode_demod = &usb_demod;}
-			if (strcmp("lsb", optarg) == 0) {
-				demod.mode_demod = &lsb_demod;}
-			if (strcmp("wbfm",  optarg) == 0 || strcmp("wfm",  optarg) == 0) {
-				controller.wb_mode = 1;
-				demod.mode_demod = &fm_demod;
-				demod.rate_in = 170000;
-				demod.rate_out = 170000;
-				demod.rate_out2 = 32000;
-				output.rate = 32000;
-				demod.custom_atan = 1;
-				//demod.post_downsample = 4;
-				demod.deemph = 1;
-				demod.squelch_level = 0;}
+			modulation(optarg);
+			modArg = optarg;
+			break;
+		case 'I':
+			benchFile = optarg;
 			break;
 		case 'T':
 			enable_biastee = 1;
@@ -1999,6 +3457,16 @@ int main(int argc, char **argv)
 			if (dongle.buf_len > MAXIMUM_BUF_LENGTH)
 				dongle.buf_len = MAXIMUM_BUF_LENGTH;
 			break;
+		case 'x':
+			channel_add(optarg);
+			break;
+		case 'Q':
+			QueueBlocks = atoi(optarg);
+			if (QueueBlocks < 2)
+				QueueBlocks = 2;
+			if (QueueBlocks > MAXIMUM_QUEUE_BLOCKS)
+				QueueBlocks = MAXIMUM_QUEUE_BLOCKS;
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -2010,6 +3478,14 @@ int main(int argc, char **argv)
 	if (verbosity)
 		fprintf(stderr, "verbosity set to %d\n", verbosity);
 
+#ifdef HAVE_SSE2
+	if (cpu_has_sse2())
+		condition_block = condition_block_sse2;
+#endif
+
+	if (benchFile)
+		exit(benchmark(benchFile, modArg, atanArg, timeConstant) < 0 ? 1 : 0);
+
 	/* quadruple sample_rate to limit to Δθ to ±π/2 */
 	demod.rate_in *= demod.post_downsample;
 
@@ -2027,8 +3503,37 @@ int main(int argc, char **argv)
 		output.filename = "-";
 	}
 
+	if (writeWav && (!strncmp(output.filename, "udp://", 6) || !strncmp(output.filename, "rtp://", 6))) {
+		fprintf(stderr, "A wave header (-H) needs a file output, not %s.\n", output.filename);
+		exit(1);
+	}
+
+	if (cmd.resultFilename) {
+		/* non-blocking like the trigger sink: a fifo without reader
+		 * or a slow reader must not stall the scan */
+		cmd.resultFd = openEventSink(cmd.resultFilename, &cmd.resultIsSocket);
+		if (cmd.resultFd < 0) {
+			fprintf(stderr, "Failed to open %s\n", cmd.resultFilename);
+			exit(1);
+		}
+	}
+
+	if (cmd.triggerSink) {
+		cmd.triggerFd = openEventSink(cmd.triggerSink, &cmd.triggerIsSocket);
+		if (cmd.triggerFd < 0)
+			exit(1);
+	}
+
 	ACTUAL_BUF_LENGTH = lcm_post[demod.post_downsample] * DEFAULT_BUF_LENGTH;
 
+	if (queue_init(&demod.queue, QueueBlocks, dongle.buf_len, QueueBackpressure) < 0
+		|| queue_init(&output.queue, QueueBlocks, dongle.buf_len, QueueBackpressure) < 0) {
+		fprintf(stderr, "Failed to allocate %d buffers of %u samples.\n", QueueBlocks, dongle.buf_len);
+		exit(1);
+	}
+	/* results are copied into output blocks of buf_len */
+	demod.result_cap = dongle.buf_len;
+
 	if (!dev_given) {
 		dongle.dev_index = verbose_device_search("0");
 	}
@@ -2055,8 +3560,7 @@ int main(int argc, char **argv)
 #endif
 
 	if (demod.deemph) {
-		double tc = (double)timeConstant * 1e-6;
-		demod.deemph_a = (int)round(1.0/((1.0-exp(-1.0/(demod.rate_out * tc)))));
+		deemph_setup(timeConstant);
 		if (verbosity)
 			fprintf(stderr, "using wbfm deemphasis filter with time constant %d us\n", timeConstant );
 	}
@@ -2106,6 +3610,10 @@ int main(int argc, char **argv)
 #ifdef _WIN32
 		_setmode(_fileno(output.file), _O_BINARY);
 #endif
+	} else if ((r = output_open_net(&output, output.filename, (demod.rate_out2 > 0) ? demod.rate_out2 : demod.rate_out,
+			(demod.mode_demod == &raw_demod) ? 2 : 1)) != 0) {
+		if (r < 0)
+			exit(1);
 	} else {
 		const char * filename_to_open = output.filename;
 		if (writeWav) {
@@ -2127,6 +3635,7 @@ int main(int argc, char **argv)
 				int srate = (demod.rate_out2 > 0) ? demod.rate_out2 : demod.rate_out;
 				uint32_t f = controller.freqs[0];	/* only 1st frequency!!! */
 				waveWriteHeader(srate, f, 16, nChan, output.file);
+				output.is_wave = 1;
 			}
 		}
 	}
@@ -2136,9 +3645,18 @@ int main(int argc, char **argv)
 	/* Reset endpoint before we start reading from it (mandatory) */
 	verbose_reset_buffer(dongle.dev);
 
+	if (num_channels) {
+		/* same as the controller thread will do for the primary channel */
+		optimal_settings(controller.freqs[0] + (controller.wb_mode ? 16000 : 0), demod.rate_in);
+		if (channels_setup() < 0)
+			exit(1);
+	}
+
 	pthread_create(&controller.thread, NULL, controller_thread_fn, (void *)(&controller));
 	usleep(1000000); /* it looks, that startup of dongle level takes some time at startup! */
 	pthread_create(&output.thread, NULL, output_thread_fn, (void *)(&output));
+	for (k = 0; k < num_channels; k++)
+		pthread_create(&channels[k].output.thread, NULL, output_thread_fn, (void *)(&channels[k].output));
 	pthread_create(&demod.thread, NULL, demod_thread_fn, (void *)(&demod));
 	pthread_create(&dongle.thread, NULL, dongle_thread_fn, (void *)(&dongle));
 
@@ -2152,29 +3670,58 @@ int main(int argc, char **argv)
 		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);}
 
 	rtlsdr_cancel_async(dongle.dev);
+	/* producers might wait for a free buffer with -E qwait */
+	queue_wake(&demod.queue);
+	queue_wake(&output.queue);
+	for (k = 0; k < num_channels; k++)
+		queue_wake(&channels[k].output.queue);
 	pthread_join(dongle.thread, NULL);
-	safe_cond_signal(&demod.ready, &demod.ready_m);
 	pthread_join(demod.thread, NULL);
-	safe_cond_signal(&output.ready, &output.ready_m);
 	pthread_join(output.thread, NULL);
+	for (k = 0; k < num_channels; k++)
+		pthread_join(channels[k].output.thread, NULL);
 	safe_cond_signal(&controller.hop, &controller.hop_m);
 	pthread_join(controller.thread, NULL);
 
+	if (verbosity || demod.queue.dropped || output.queue.dropped) {
+		fprintf(stderr, "dongle -> demod: %u buffers passed, %u dropped, max %d of %d queued\n",
+			demod.queue.pushed, demod.queue.dropped, demod.queue.max_fill, demod.queue.nblocks);
+		fprintf(stderr, "demod -> output: %u buffers passed, %u dropped, max %d of %d queued\n",
+			output.queue.pushed, output.queue.dropped, output.queue.max_fill, output.queue.nblocks);
+	}
+	if (demod.predetect && (verbosity || demod.predetect_skips))
+		fprintf(stderr, "pre-detector skipped %u blocks\n", demod.predetect_skips);
+	for (k = 0; k < num_channels; k++) {
+		struct block_queue *q = &channels[k].output.queue;
+		if (verbosity || q->dropped)
+			fprintf(stderr, "demod -> channel %.3f kHz: %u buffers passed, %u dropped, max %d of %d queued\n",
+				channels[k].freq / 1000.0, q->pushed, q->dropped, q->max_fill, q->nblocks);
+		output_cleanup(&channels[k].output);
+		channel_demod_cleanup(&channels[k]);
+		if (channels[k].output.file)
+			fclose(channels[k].output.file);
+	}
+	free(channels);
+
 	/* dongle_cleanup(&dongle); */
 	demod_cleanup(&demod);
 	output_cleanup(&output);
 	controller_cleanup(&controller);
 
 	if (cmd.filename) {
-		int k;
 		/* output scan statistics */
-		for (k = 0; k < FREQUENCIES_LIMIT; k++) {
-			if (cmd.statNumLevels[k] > 0)
-				fprintf(stderr, "%.0f, %.1f, %.2f, %.1f\n", (double)(cmd.statFreq[k]), cmd.statMinLevel[k], cmd.statSumLevels[k] / cmd.statNumLevels[k], cmd.statMaxLevel[k] );
+		for (k = 0; k < cmd.numStats; k++) {
+			struct cmd_stat *st = &cmd.stats[k];
+			fprintf(stderr, "%.0f, %.1f, %.2f, %.1f\n", (double)(st->freq), st->minLevel, st->sumLevels / st->numLevels, st->maxLevel );
 		}
+		if (cmd.triggerSink && (verbosity || cmd.triggerDropped))
+			fprintf(stderr, "trigger sink: %u records sent, %u dropped\n", cmd.triggerSent, cmd.triggerDropped);
+		if (cmd.resultFilename && cmd.resultDropped)
+			fprintf(stderr, "%s: %u result records dropped\n", cmd.resultFilename, cmd.resultDropped);
 	}
+	cmd_cleanup(&cmd);
 
-	if (output.file != stdout) {
+	if (output.file && output.file != stdout) {
 		if (writeWav) {
 			int r;
 			waveFinalizeHeader(output.file);
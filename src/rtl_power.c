@@ -47,6 +47,7 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <getopt.h>
 #else
 #include <windows.h>
 #include <fcntl.h>
@@ -60,6 +61,18 @@
 #endif
 
 #include <math.h>
+
+/* SSE kernels, selected at runtime with cpu_has_sse2() */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#include <emmintrin.h>
+#define HAVE_SSE2		1
+#define SSE2_ATTR		__attribute__((target("sse2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define HAVE_SSE2		1
+#define SSE2_ATTR
+#endif
+
 #ifdef NEED_PTHREADS_WORKARROUND
 #define HAVE_STRUCT_TIMESPEC
 #endif
@@ -72,41 +85,142 @@
 #include "convenience/rtl_convenience.h"
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
 #define DEFAULT_BUF_LENGTH		(1 * 16384)
 #define AUTO_GAIN				-100
 #define BUFFER_DUMP				(1<<12)
+#define SETTLE_BLOCK			(1<<10)
+#define SETTLE_MAX_BYTES		(1<<15)
+#define SETTLE_DB			1.5
+#define SETTLE_CLASSES			6
+#define SETTLE_POLLS			40
 
 #define MAXIMUM_RATE			2800000
 #define MINIMUM_RATE			1000000
+#define FFT_MAX_STAGES			32
 
 static volatile int do_exit = 0;
-static rtlsdr_dev_t *dev = NULL;
 FILE *file;
 
 int16_t* Sinewave;
 double* power_table;
 int N_WAVE, LOG2_N_WAVE;
 int next_power;
-int16_t *fft_buf;
 int *window_coefs;
 
+enum fft_engines { FFT_FIXED, FFT_FLOAT };
+
+/* long options without a short form */
+enum long_opts { OPT_FFT = 256, OPT_FORMAT, OPT_OVERLAP, OPT_PLAN, OPT_PLAN_ONLY, OPT_QUANTILES, OPT_DUTY,
+	OPT_EVENTS, OPT_SUMMARY };
+
+/* one pass of the float FFT: sub transforms of length n at stride s */
+struct fft_stage
+{
+	int radix;
+	int n;
+	int s;
+	float *wr, *wi;	/* exp(-2 pi i p k / n) at [p*(radix-1) + k-1] */
+};
+
+struct fft_plan
+/* read only after fft_plan_init(), can be shared */
+{
+	int n;
+	int num_stages;
+	struct fft_stage stage[FFT_MAX_STAGES];
+	float *win;	/* window, scaled to the levels of fix_fft() */
+};
+
+struct fft_work
+/* split complex buffers, swapped by fft_float() */
+{
+	float *re, *im;
+	float *tre, *tim;
+};
+
+struct fft_plan fplan;
+static enum fft_engines fft_engine = FFT_FIXED;
+
+struct fft_worker
+/* one per fft thread, owns its scratch buffers */
+{
+	pthread_t thread;
+	int index;
+	int16_t *fft_buf;
+	int16_t *seg_buf;  /* windowed segment for fix_fft() */
+	struct fft_work fwork;
+};
+
+#define MAX_DONGLES	8
+
+struct dongle_state
+/* one per -d device, sweeps tunes[first] .. tunes[last-1] */
+{
+	pthread_t thread;
+	rtlsdr_dev_t *dev;
+	int dev_index;
+	int first, last;
+	/* settling after retune() */
+	int pll_check;  /* -1 unknown, 0 not supported, 1 polled */
+	int extra_blocks[SETTLE_CLASSES];  /* learned per jump size */
+	long retunes, pll_polls, settle_blocks, unsettled;
+};
+
+struct dongle_state dongles[MAX_DONGLES];
+int dongle_count = 0;
+
+struct hop_job
+{
+	int hop;
+	uint8_t *buf;
+};
+
+struct scan_pipe
+/* the dongle threads capture hops into buffers from a small pool and
+ * queue them, the fft workers take hops from the queue and return the
+ * buffers. each hop has its own avg, so only the queue is locked */
+{
+	pthread_mutex_t lock;
+	pthread_cond_t sweep_cond;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_cond_t free_cond;
+	int sweep;
+	struct hop_job *queue;  /* length == tune_count */
+	int q_head, q_tail;
+	uint8_t *pool;
+	uint8_t **free_bufs;
+	int free_count;
+	int done;
+	int aborted;
+	int stop;
+	int workers;
+	struct fft_worker *worker;
+};
+
+struct scan_pipe scan;
+
 struct tuning_state
 /* one per tuning range */
 {
 	uint64_t freq;
 	int rate;
 	int bin_e;
-	int64_t *avg;  /* length == 2^bin_e */
+	int bin_len;  /* 2^bin_e for fix_fft(), any even length for the float FFT */
+	double *avg;  /* length == bin_len, row of avg_slab */
 	int samples;
 	int downsample;
 	int downsample_passes;  /* for the recursive filter */
 	double crop;
 	//pthread_rwlock_t avg_lock;
 	//pthread_mutex_t avg_mutex;
-	/* having the iq buffer here is wasteful, but will avoid contention */
-	uint8_t *buf8;
 	int buf_len;
+	uint16_t *hist;  /* bin_len * QUANT_BUCKETS, only with --quantiles */
+	double hist_min_db;  /* lower edge of the first bucket, see stats_scale() */
+	uint32_t hist_low, hist_high;  /* fft bins clamped into the end buckets */
+	uint32_t *duty;  /* segments above duty_db, only with --duty */
 	//int *comp_fir;
 	//pthread_rwlock_t buf_lock;
 	//pthread_mutex_t buf_mutex;
@@ -114,14 +228,31 @@ struct tuning_state
 
 enum time_modes { VERBOSE_TIME, EPOCH_TIME };
 
-/* 3000 is enough for 3GHz b/w worst case */
-#define MAX_TUNES	3000
-struct tuning_state tunes[MAX_TUNES];
+struct tuning_state *tunes = NULL;
 int tune_count = 0;
+/* all avg[] in one allocation, rows start on a cache line */
+#define AVG_ALIGN	64
+void *avg_slab = NULL;
 
 int boxcar = 1;
 int comp_fir_size = 0;
 int peak_hold = 0;
+double overlap = 0.0;  /* of consecutive fft segments, 0 to 0.9 */
+
+/* per bin statistics of the single fft segments.
+ * quantiles come from a histogram of 1 dB buckets per bin. the range
+ * starts at the level of the smallest nonzero fft power of the hop,
+ * the lowest and highest bucket also take everything beyond */
+#define QUANT_MAX		4
+#define QUANT_BUCKETS		112
+#define QUANT_STEP_DB		1.0
+#define QUANT_FLOAT_DB		16.0  /* the float fft resolves powers below 1 */
+int quant_count = 0;
+int quant_pct[QUANT_MAX];
+int duty_on = 0;
+double duty_db = 0.0;
+uint16_t *hist_slab = NULL;
+uint32_t *duty_slab = NULL;
 static enum time_modes time_mode = VERBOSE_TIME;
 
 void usage(void)
@@ -143,8 +274,10 @@ void usage(void)
 		"\t[-1 enables single-shot mode (default: off)]\n"
 		"\t[-e exit_timer (default: off/0)]\n"
 		//"\t[-s avg/iir smoothing (default: avg)]\n"
-		//"\t[-t threads (default: 1)]\n"
+		"\t[-t fft_threads (default: 1)]\n"
+		"\t (the next hop is captured while these threads run the FFTs)\n"
 		"\t[-d device_index or serial (default: 0)]\n"
+		"\t (repeat -d to sweep with several devices, the hops are split between them)\n"
 		"\t[-g tuner_gain (default: automatic)]\n"
 		"\t[-p ppm_error (default: 0)]\n"
 		"\t[-T enable bias-T on GPIO PIN 0 (works for rtl-sdr.com v3 dongles)]\n"
@@ -164,9 +297,34 @@ void usage(void)
 		"\t (enables low-leakage downsample filter,\n"
 		"\t  fir_size can be 0 or 9.  0 has bad roll off,\n"
 		"\t  try with '-c 50%%')\n"
+		"\t[--overlap percent (default: 0%%, recommended: 50%%-75%% with tapered windows)]\n"
+		"\t (overlaps the fft segments inside each hop's buffer,\n"
+		"\t  more averages from the same samples. no effect with one segment per buffer)\n"
 		"\t[-P enables peak hold (default: off)]\n"
 		"\t[-D enable direct sampling (default: off)]\n"
 		"\t[-O enable offset tuning (default: off)]\n"
+		"\t[--format csv|float|int16 (default: csv)]\n"
+		"\t (float and int16 write a binary file, appended to if the plan matches:\n"
+		"\t  header with plan, then per interval: time, samples per hop,\n"
+		"\t  bins as float32 dB or int16 centi-dB. see bin_init() for the layout)\n"
+		"\t[--fft fixed|float (default: fixed)]\n"
+		"\t (float uses a single precision FFT with more dynamic range,\n"
+		"\t  bin counts are not limited to powers of two)\n"
+		"\t[--plan picks rate, hops and buffer size for the shortest sweep]\n"
+		"\t (models retune, capture and FFT time with -i, -t and the devices,\n"
+		"\t  crop per rate from the decimation and tuner IF filters, -c is the minimum,\n"
+		"\t  rates up to 3.2 MHz. keeps the default plan unless the sweep is shorter)\n"
+		"\t[--plan-only prints the --plan result and exits without opening a device]\n"
+		"\t[--quantiles p,p,... per bin percentiles of the single FFTs, e.g. 10,50,99]\n"
+		"\t (up to 4, from a 1 dB histogram per bin over 112 dB, 224 bytes of memory per bin)\n"
+		"\t[--duty dB per bin percentage of FFTs above the level]\n"
+		"\t (csv: extra rows per hop, 'p10' or 'duty' in the samples column.\n"
+		"\t  binary: extra planes of bins after the averages, see bin_init())\n"
+		"\t[--events dB writes only bins that leave their baseline by more than dB]\n"
+		"\t (rows: time, event, Hz, +|-, seconds, peak dB, mean dB, baseline dB.\n"
+		"\t  the baseline is learned per bin over 32 intervals, see event_interval())\n"
+		"\t[--summary intervals, with --events: one row per hop every n intervals (default: 60, 0 = off)]\n"
+		"\t (time, summary, Hz low, Hz high, floor dB, max dB, open events, ended events)\n"
 		"\n"
 		"CSV FFT output columns:\n"
 		"\tdate, time, Hz low, Hz high, Hz step, samples, dbm, dbm, ...\n\n"
@@ -332,6 +490,270 @@ int fix_fft(int16_t iq[], int m)
 	return 0;
 }
 
+/* float FFT: mixed radix (4, 2, 3, 5) Stockham autosort on split
+ * real/imaginary arrays. no bit reversal, output in natural order,
+ * and the inner loops run over contiguous memory */
+
+static int cpu_has_sse2(void)
+{
+#ifdef HAVE_SSE2
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") ? 1 : 0;
+#else
+	return 1;
+#endif
+#else
+	return 0;
+#endif
+}
+
+int fft_good_size(int n)
+/* smallest even length >= n with factors 2, 3 and 5 only */
+{
+	int m, k;
+	if (n < 2)
+		n = 2;
+	for (;; n++) {
+		if (n & 1)
+			continue;
+		m = n;
+		for (k = 2; k <= 5; k++) {
+			while (m % k == 0)
+				m /= k;
+		}
+		if (m == 1)
+			return n;
+	}
+}
+
+void fft_plan_free(struct fft_plan *p)
+{
+	int i;
+	for (i = 0; i < p->num_stages; i++) {
+		free(p->stage[i].wr);
+		free(p->stage[i].wi);
+	}
+	free(p->win);
+	memset(p, 0, sizeof(struct fft_plan));
+}
+
+int fft_plan_init(struct fft_plan *p, int n, double (*window_fn)(int, int))
+{
+	static const int radices[] = {4, 2, 3, 5};
+	int i, k, r, m, sub, stride;
+	double a;
+	struct fft_stage *st;
+	memset(p, 0, sizeof(struct fft_plan));
+	p->n = n;
+	sub = n;
+	stride = 1;
+	for (i = 0; i < 4 && sub > 1; ) {
+		r = radices[i];
+		if (sub % r) {
+			i++;
+			continue;
+		}
+		if (p->num_stages == FFT_MAX_STAGES)
+			return -1;
+		m = sub / r;
+		st = &p->stage[p->num_stages++];
+		st->radix = r;
+		st->n = sub;
+		st->s = stride;
+		st->wr = malloc(m * (r-1) * sizeof(float));
+		st->wi = malloc(m * (r-1) * sizeof(float));
+		if (!st->wr || !st->wi) {
+			fft_plan_free(p);
+			return -1;
+		}
+		for (k = 0; k < m * (r-1); k++) {
+			a = -2.0 * M_PI * (double)(k / (r-1)) * (double)(k % (r-1) + 1) / (double)sub;
+			st->wr[k] = (float)cos(a);
+			st->wi[k] = (float)sin(a);
+		}
+		sub = m;
+		stride *= r;
+	}
+	if (sub != 1) {
+		fft_plan_free(p);
+		return -1;
+	}
+	/* fix_fft() halves in each of log2(n) passes: scale by 1/n.
+	 * window coefficients there are 256 * window */
+	p->win = malloc(n * sizeof(float));
+	if (!p->win) {
+		fft_plan_free(p);
+		return -1;
+	}
+	for (k = 0; k < n; k++) {
+		p->win[k] = (float)(256.0 * window_fn(k, n) / (double)n);
+	}
+	return 0;
+}
+
+int fft_work_init(struct fft_work *w, int n)
+{
+	w->re  = malloc(n * sizeof(float));
+	w->im  = malloc(n * sizeof(float));
+	w->tre = malloc(n * sizeof(float));
+	w->tim = malloc(n * sizeof(float));
+	return (w->re && w->im && w->tre && w->tim) ? 0 : -1;
+}
+
+void fft_work_free(struct fft_work *w)
+{
+	free(w->re);
+	free(w->im);
+	free(w->tre);
+	free(w->tim);
+	memset(w, 0, sizeof(struct fft_work));
+}
+
+void fft_fill(const struct fft_plan *p, struct fft_work *w, const int16_t *iq)
+/* interleaved int16 iq -> windowed split float, in one pass */
+{
+	int j;
+	for (j = 0; j < p->n; j++) {
+		w->re[j] = (float)iq[2*j]   * p->win[j];
+		w->im[j] = (float)iq[2*j+1] * p->win[j];
+	}
+}
+
+/* y[q + s*(r*p + k)] = w(p,k) * sum_j x[q + s*(p + j*m)] * exp(-2 pi i j k / r) */
+
+#define FFT_LOAD(j)	ar[j] = xr[q + s*(pp + (j)*m)]; ai[j] = xi[q + s*(pp + (j)*m)]
+#define FFT_STORE(k, br, bi) \
+	if (k) { \
+		yr[q + s*(r*pp + (k))] = (br) * wr[(k)-1] - (bi) * wi[(k)-1]; \
+		yi[q + s*(r*pp + (k))] = (br) * wi[(k)-1] + (bi) * wr[(k)-1]; \
+	} else { \
+		yr[q + s*(r*pp)] = (br); \
+		yi[q + s*(r*pp)] = (bi); \
+	}
+
+static void fft_stage_generic(const struct fft_stage *st, const float *xr, const float *xi, float *yr, float *yi)
+{
+	const float c3 = -0.5f, s3 = 0.86602540378f;
+	const float c51 = 0.30901699437f, c52 = -0.80901699437f;
+	const float s51 = 0.95105651630f, s52 = 0.58778525229f;
+	int r = st->radix, s = st->s, m = st->n / st->radix;
+	int pp, q;
+	float ar[5], ai[5], t0r, t0i, t1r, t1i, t2r, t2i, t3r, t3i;
+	const float *wr, *wi;
+	for (pp = 0; pp < m; pp++) {
+		wr = st->wr + pp * (r-1);
+		wi = st->wi + pp * (r-1);
+		for (q = 0; q < s; q++) {
+			switch (r) {
+			case 2:
+				FFT_LOAD(0); FFT_LOAD(1);
+				FFT_STORE(0, ar[0] + ar[1], ai[0] + ai[1]);
+				FFT_STORE(1, ar[0] - ar[1], ai[0] - ai[1]);
+				break;
+			case 3:
+				FFT_LOAD(0); FFT_LOAD(1); FFT_LOAD(2);
+				t0r = ar[1] + ar[2];  t0i = ai[1] + ai[2];
+				t1r = ar[0] + c3 * t0r;  t1i = ai[0] + c3 * t0i;
+				t2r = s3 * (ar[1] - ar[2]);  t2i = s3 * (ai[1] - ai[2]);
+				FFT_STORE(0, ar[0] + t0r, ai[0] + t0i);
+				FFT_STORE(1, t1r + t2i, t1i - t2r);
+				FFT_STORE(2, t1r - t2i, t1i + t2r);
+				break;
+			case 4:
+				FFT_LOAD(0); FFT_LOAD(1); FFT_LOAD(2); FFT_LOAD(3);
+				t0r = ar[0] + ar[2];  t0i = ai[0] + ai[2];
+				t1r = ar[0] - ar[2];  t1i = ai[0] - ai[2];
+				t2r = ar[1] + ar[3];  t2i = ai[1] + ai[3];
+				t3r = ar[1] - ar[3];  t3i = ai[1] - ai[3];
+				FFT_STORE(0, t0r + t2r, t0i + t2i);
+				FFT_STORE(1, t1r + t3i, t1i - t3r);
+				FFT_STORE(2, t0r - t2r, t0i - t2i);
+				FFT_STORE(3, t1r - t3i, t1i + t3r);
+				break;
+			case 5:
+				FFT_LOAD(0); FFT_LOAD(1); FFT_LOAD(2); FFT_LOAD(3); FFT_LOAD(4);
+				{
+				float s1r = ar[1] + ar[4], s1i = ai[1] + ai[4];
+				float d1r = ar[1] - ar[4], d1i = ai[1] - ai[4];
+				float s2r = ar[2] + ar[3], s2i = ai[2] + ai[3];
+				float d2r = ar[2] - ar[3], d2i = ai[2] - ai[3];
+				float u1r = s51 * d1r + s52 * d2r, u1i = s51 * d1i + s52 * d2i;
+				float u2r = s52 * d1r - s51 * d2r, u2i = s52 * d1i - s51 * d2i;
+				t1r = ar[0] + c51 * s1r + c52 * s2r;  t1i = ai[0] + c51 * s1i + c52 * s2i;
+				t2r = ar[0] + c52 * s1r + c51 * s2r;  t2i = ai[0] + c52 * s1i + c51 * s2i;
+				FFT_STORE(0, ar[0] + s1r + s2r, ai[0] + s1i + s2i);
+				FFT_STORE(1, t1r + u1i, t1i - u1r);
+				FFT_STORE(2, t2r + u2i, t2i - u2r);
+				FFT_STORE(3, t2r - u2i, t2i + u2r);
+				FFT_STORE(4, t1r - u1i, t1i + u1r);
+				}
+				break;
+			}
+		}
+	}
+}
+
+#ifdef HAVE_SSE2
+SSE2_ATTR
+static void fft_stage4_sse(const struct fft_stage *st, const float *xr, const float *xi, float *yr, float *yi)
+/* radix 4 with 4 values of q per vector, s % 4 == 0 */
+{
+	int s = st->s, m = st->n / 4;
+	int pp, q, k;
+	__m128 ar[4], ai[4], br[4], bi[4], t0r, t0i, t1r, t1i, t2r, t2i, t3r, t3i, w_r, w_i;
+	for (pp = 0; pp < m; pp++) {
+		const float *wr = st->wr + pp * 3;
+		const float *wi = st->wi + pp * 3;
+		for (q = 0; q < s; q += 4) {
+			for (k = 0; k < 4; k++) {
+				ar[k] = _mm_loadu_ps(xr + q + s*(pp + k*m));
+				ai[k] = _mm_loadu_ps(xi + q + s*(pp + k*m));
+			}
+			t0r = _mm_add_ps(ar[0], ar[2]);  t0i = _mm_add_ps(ai[0], ai[2]);
+			t1r = _mm_sub_ps(ar[0], ar[2]);  t1i = _mm_sub_ps(ai[0], ai[2]);
+			t2r = _mm_add_ps(ar[1], ar[3]);  t2i = _mm_add_ps(ai[1], ai[3]);
+			t3r = _mm_sub_ps(ar[1], ar[3]);  t3i = _mm_sub_ps(ai[1], ai[3]);
+			br[0] = _mm_add_ps(t0r, t2r);  bi[0] = _mm_add_ps(t0i, t2i);
+			br[1] = _mm_add_ps(t1r, t3i);  bi[1] = _mm_sub_ps(t1i, t3r);
+			br[2] = _mm_sub_ps(t0r, t2r);  bi[2] = _mm_sub_ps(t0i, t2i);
+			br[3] = _mm_sub_ps(t1r, t3i);  bi[3] = _mm_add_ps(t1i, t3r);
+			_mm_storeu_ps(yr + q + s*(4*pp), br[0]);
+			_mm_storeu_ps(yi + q + s*(4*pp), bi[0]);
+			for (k = 1; k < 4; k++) {
+				w_r = _mm_set1_ps(wr[k-1]);
+				w_i = _mm_set1_ps(wi[k-1]);
+				_mm_storeu_ps(yr + q + s*(4*pp + k),
+					_mm_sub_ps(_mm_mul_ps(br[k], w_r), _mm_mul_ps(bi[k], w_i)));
+				_mm_storeu_ps(yi + q + s*(4*pp + k),
+					_mm_add_ps(_mm_mul_ps(br[k], w_i), _mm_mul_ps(bi[k], w_r)));
+			}
+		}
+	}
+}
+#endif
+
+static int fft_use_sse = 0;
+
+void fft_float(const struct fft_plan *p, struct fft_work *w)
+/* in place on w->re/w->im, the buffers may be swapped */
+{
+	int i;
+	float *t;
+	const struct fft_stage *st;
+	for (i = 0; i < p->num_stages; i++) {
+		st = &p->stage[i];
+#ifdef HAVE_SSE2
+		if (fft_use_sse && st->radix == 4 && (st->s & 3) == 0)
+			fft_stage4_sse(st, w->re, w->im, w->tre, w->tim);
+		else
+#endif
+		fft_stage_generic(st, w->re, w->im, w->tre, w->tim);
+		t = w->re; w->re = w->tre; w->tre = t;
+		t = w->im; w->im = w->tim; w->tim = t;
+	}
+}
+
 double rectangle(int i, int length)
 {
 	return 1.0;
@@ -413,14 +835,72 @@ double bartlett(int i, int length)
 	return w;
 }
 
-void rms_power(struct tuning_state *ts)
+struct stats_scale
+/* per hop constants of stats_add() */
+{
+	float a, b;  /* bucket = log2(power) * a + b */
+	double thresh;  /* duty_db as raw power */
+};
+
+static inline float fast_log2(float x)
+/* about 0.005 off, 0 gives -127 */
+{
+	union {float f; uint32_t i;} u;
+	float e, m;
+	u.f = x;
+	e = (float)((int)((u.i >> 23) & 0xff) - 128);
+	u.i = (u.i & 0x007fffff) | 0x3f800000;
+	m = u.f;
+	return e + m * (-0.34484843f * m + 2.02466578f) - 0.67487759f;
+}
+
+void stats_scale(struct tuning_state *ts, int ds, struct stats_scale *sc)
+/* same normalisation as csv_dbm(), for one segment.
+ * an fft power of 1 is the smallest nonzero one of the fixed point
+ * engine: lower edge of the histogram, a bit lower for the float one.
+ * full scale stays below the upper edge either way */
+{
+	double norm_db = 10 * log10((double)ts->rate * (double)ds);
+	ts->hist_min_db = floor(-norm_db) - (fft_engine == FFT_FLOAT ? QUANT_FLOAT_DB : 0.0);
+	sc->a = (float)(10 * log10(2.0) / QUANT_STEP_DB);
+	sc->b = (float)(-(norm_db + ts->hist_min_db) / QUANT_STEP_DB);
+	sc->thresh = pow(10.0, (duty_db + norm_db) / 10.0);
+}
+
+static inline void stats_add(struct tuning_state *ts, int j, double p, struct stats_scale *sc)
+{
+	int b, k;
+	uint16_t *h;
+	if (ts->duty && p > sc->thresh) {
+		ts->duty[j]++;}
+	if (!ts->hist) {
+		return;}
+	b = (int)(fast_log2((float)p) * sc->a + sc->b);
+	if (b < 0) {
+		/* zero power belongs there, no loss */
+		if (p > 0.0) {
+			ts->hist_low++;}
+		b = 0;
+	} else if (b >= QUANT_BUCKETS) {
+		ts->hist_high++;
+		b = QUANT_BUCKETS - 1;
+	}
+	h = ts->hist + (size_t)j * QUANT_BUCKETS;
+	/* halving keeps the shape when a bucket would overflow */
+	if (++h[b] == UINT16_MAX) {
+		for (k=0; k<QUANT_BUCKETS; k++) {
+			h[k] >>= 1;}
+	}
+}
+
+void rms_power(struct tuning_state *ts, uint8_t *buf)
 /* for bins between 1MHz and 2MHz */
 {
 	int i, s;
-	uint8_t *buf = ts->buf8;
 	int buf_len = ts->buf_len;
 	int64_t p, t;
 	double dc, err;
+	struct stats_scale sc;
 
 	p = t = 0L;
 	for (i=0; i<buf_len; i++) {
@@ -438,45 +918,113 @@ void rms_power(struct tuning_state *ts)
 	} else {
 		ts->avg[0] = MAX(ts->avg[0], p);
 	}
+	if (ts->hist || ts->duty) {
+		stats_scale(ts, 1, &sc);
+		stats_add(ts, 0, (double)p, &sc);
+	}
 	ts->samples += 1;
 }
 
-void frequency_range(char *arg, double crop)
-/* flesh out the tunes[] for scanning */
-// do we want the fewest ranges (easy) or the fewest bins (harder)?
+struct sweep_plan
 {
-	char *start, *stop, *step;
-	uint64_t upper, lower;
-	int i, j, max_size, bw_seen, bw_used, bin_e, buf_len;
-	int downsample, downsample_passes;
+	int hops;
+	int bw_seen;  /* per hop, after cropping */
+	int rate;  /* dongle sample rate */
+	double crop;
+	int bin_e;
+	int bin_len;
 	double bin_size;
-	struct tuning_state *ts;
-	/* hacky string parsing */
-	start = arg;
-	stop = strchr(start, ':') + 1;
-	stop[-1] = '\0';
-	step = strchr(stop, ':') + 1;
-	step[-1] = '\0';
-	lower = (uint64_t)(atofs(start) + 0.5);
-	upper = (uint64_t)(atofs(stop) + 0.5);
-	max_size = (int)atofs(step);
-	stop[-1] = ':';
-	step[-1] = ':';
+	int downsample;
+	int downsample_passes;
+	int buf_len;
+	/* estimates of the optimiser */
+	double hop_us;  /* settle and capture */
+	double fft_us;  /* all segments of one hop */
+	double sweep_s;
+};
+
+struct plan_limits
+/* what the optimiser may assume */
+{
+	int interval;
+	int fft_threads;
+	int dongles;
+	double settle_us;  /* per retune, incl. usb latency */
+	int crop_given;
+	rtlsdr_dev_t *dev;  /* for the tuner's IF filter, NULL: R82xx model */
+};
+
+/* flat part of the rtl2832 decimation filter */
+#define PLAN_CROP		0.15
+/* flat part of the tuner's IF filter, of its nominal bandwidth */
+#define PLAN_IF_FLAT		0.9
+/* above MAXIMUM_RATE slow hosts may lose samples,
+ * only taken when it saves sweep time */
+#define PLAN_MAX_RATE		3200000
+#define PLAN_RATE_STEP		50000
+#define PLAN_MAX_BUF		(1<<22)
+#define PLAN_SWEEP_TIE		0.02	/* sweep times within 2% are equal */
+/* per N*log2(N) of one fft, incl. window and accumulation */
+#define PLAN_NS_FIXED		4.7
+#define PLAN_NS_FLOAT		1.2
+#define PLAN_NS_SAMPLE		2.0
+
+double tuner_settle_us(enum rtlsdr_tuner tuner)
+/* see retune(): PLL polling on R82xx, fixed sleep elsewhere */
+{
+	switch (tuner) {
+	case RTLSDR_TUNER_R820T:
+	case RTLSDR_TUNER_R828D:
+		return 1500.0;
+	default:
+		return 6000.0;
+	}
+}
+
+static int plan_bins(int bw_used, int max_size, int downsample, int *bin_e)
+/* bin count for the fft engine, bin size is under limit */
+{
+	int i, n;
+	// todo, replace loop with log2
+	for (i=1; i<=21; i++) {
+		*bin_e = i;
+		if ((double)bw_used / (double)((1<<i) * downsample) <= (double)max_size) {
+			break;}
+	}
+	n = 1 << *bin_e;
+	/* the float FFT takes any 2^a * 3^b * 5^c, closer to the limit */
+	if (fft_engine == FFT_FLOAT) {
+		n = (int)ceil((double)bw_used / ((double)max_size * (double)downsample));
+		n = fft_good_size(MIN(n, 1<<21));
+	}
+	return n;
+}
+
+static int plan_segments(int buf_len, int bin_len, int downsample)
+{
+	int step = MAX(1, bin_len - (int)((double)bin_len * overlap));
+	return (buf_len / downsample / 2 - bin_len) / step + 1;
+}
+
+static void plan_classic(struct sweep_plan *p, uint64_t lower, uint64_t upper, int max_size, double crop)
+/* evenly sized ranges, as close to MAXIMUM_RATE as possible */
+{
+	int i, bw_seen, bw_used, downsample, downsample_passes;
 	downsample = 1;
 	downsample_passes = 0;
-	/* evenly sized ranges, as close to MAXIMUM_RATE as possible */
-	// todo, replace loop with algebra
-	for (i=1; i<1500; i++) {
+	/* start from the estimate and fix up integer rounding */
+	i = (int)((double)(upper - lower) * (1.0 - crop) / (double)MAXIMUM_RATE);
+	for (i=MAX(1, i); ; i++) {
 		bw_seen = (upper - lower) / i;
 		bw_used = (int)((double)(bw_seen) / (1.0 - crop));
 		if (bw_used > MAXIMUM_RATE) {
 			continue;}
-		tune_count = i;
+		p->hops = i;
 		break;
 	}
 	/* unless small bandwidth */
 	if (bw_used < MINIMUM_RATE) {
-		tune_count = 1;
+		p->hops = 1;
 		downsample = MAXIMUM_RATE / bw_used;
 		bw_used = bw_used * downsample;
 	}
@@ -485,77 +1033,306 @@ void frequency_range(char *arg, double crop)
 		downsample = 1 << downsample_passes;
 		bw_used = (int)((double)(bw_seen * downsample) / (1.0 - crop));
 	}
-	/* number of bins is power-of-two, bin size is under limit */
-	// todo, replace loop with log2
-	for (i=1; i<=21; i++) {
-		bin_e = i;
-		bin_size = (double)bw_used / (double)((1<<i) * downsample);
-		if (bin_size <= (double)max_size) {
-			break;}
-	}
+	p->bin_len = plan_bins(bw_used, max_size, downsample, &p->bin_e);
+	p->bin_size = (double)bw_used / (double)(p->bin_len * downsample);
 	/* unless giant bins */
 	if (max_size >= MINIMUM_RATE) {
 		bw_seen = max_size;
 		bw_used = max_size;
-		tune_count = (upper - lower) / bw_seen;
-		bin_e = 0;
+		p->hops = (upper - lower) / bw_seen;
+		p->bin_e = 0;
+		p->bin_len = 1;
 		crop = 0;
 	}
-	if (tune_count > MAX_TUNES) {
-		fprintf(stderr, "Error: bandwidth too wide.\n");
-		exit(1);
+	p->bw_seen = bw_seen;
+	p->rate = bw_used;
+	p->crop = crop;
+	p->downsample = downsample;
+	p->downsample_passes = downsample_passes;
+	p->buf_len = 2 * p->bin_len * downsample;
+	if (p->buf_len < DEFAULT_BUF_LENGTH) {
+		p->buf_len = DEFAULT_BUF_LENGTH;
+	}
+	/* usb transfers are in 512 byte units */
+	p->buf_len = (p->buf_len + 511) & ~511;
+}
+
+static void plan_estimate(struct sweep_plan *p, struct plan_limits *lim)
+{
+	int segs, per_dongle;
+	double ns;
+	ns = (fft_engine == FFT_FLOAT) ? PLAN_NS_FLOAT : PLAN_NS_FIXED;
+	segs = plan_segments(p->buf_len, p->bin_len, p->downsample);
+	p->hop_us = lim->settle_us + 1e6 * 0.5 * (double)p->buf_len / (double)p->rate;
+	p->fft_us = 1e-3 * (0.5 * (double)p->buf_len * PLAN_NS_SAMPLE
+		+ segs * (double)p->bin_len * log2((double)p->bin_len) * ns);
+	/* capture and fft are pipelined */
+	per_dongle = (p->hops + lim->dongles - 1) / lim->dongles;
+	p->sweep_s = 1e-6 * MAX(per_dongle * p->hop_us, p->hops * p->fft_us / lim->fft_threads);
+}
+
+static double plan_averages(struct sweep_plan *p, struct plan_limits *lim)
+/* fft averages per bin and interval */
+{
+	double sweeps = floor((double)lim->interval / p->sweep_s);
+	return sweeps * plan_segments(p->buf_len, p->bin_len, p->downsample);
+}
+
+static double plan_if_bw(struct plan_limits *lim, int rate)
+/* IF filter the tuner picks for rate with automatic bandwidth, 0: not limiting.
+ * without device: the centered R82xx filters, see r82xx_set_bandwidth() */
+{
+	static const int r82xx_khz[] = {950, 1100, 1200, 1300, 1503, 1600, 1753, 1800, 1953, 2200, 3000, 5000};
+	int i, n = (int)(sizeof(r82xx_khz) / sizeof(r82xx_khz[0]));
+	uint32_t bw = 0;
+	if (lim->dev) {
+		if (rtlsdr_set_and_get_tuner_bandwidth(lim->dev, (uint32_t)rate, &bw, 0) < 0) {
+			return 0.0;}
+		return (double)bw;
 	}
-	buf_len = 2 * (1<<bin_e) * downsample;
-	if (buf_len < DEFAULT_BUF_LENGTH) {
-		buf_len = DEFAULT_BUF_LENGTH;
+	for (i=0; i<n-1; i++) {
+		if (rate < 1000 * (r82xx_khz[i] + r82xx_khz[i+1]) / 2) {
+			break;}
+	}
+	return 1000.0 * r82xx_khz[i];
+}
+
+static double plan_crop(struct plan_limits *lim, int rate, double crop)
+/* hides the roll-off of the decimation and the IF filter at this rate,
+ * a crop given with -c is the minimum */
+{
+	double flat = (1.0 - PLAN_CROP) * (double)rate;
+	double if_bw = plan_if_bw(lim, rate);
+	if (if_bw > 0.0) {
+		flat = MIN(flat, PLAN_IF_FLAT * if_bw);}
+	flat = 1.0 - flat / (double)rate;
+	return lim->crop_given ? MAX(crop, flat) : flat;
+}
+
+static void plan_optimise(struct sweep_plan *best, uint64_t lower, uint64_t upper, int max_size, double crop, struct plan_limits *lim)
+/* tries every sample rate and buffer length. starts from the heuristic
+ * plan in best and replaces it only with a shorter sweep (revisit time).
+ * among the candidates: shortest sweep, then the fewest hops, then the
+ * most averages per interval */
+{
+	int rate, hops, bw_seen, buf_len, found = 0;
+	double c, avgs, cand_avgs = -1.0;
+	struct sweep_plan p, cand;
+	plan_estimate(best, lim);
+	for (rate=MINIMUM_RATE; rate<=PLAN_MAX_RATE; rate+=PLAN_RATE_STEP) {
+		c = plan_crop(lim, rate, crop);
+		hops = (int)ceil((double)(upper - lower) / ((double)rate * (1.0 - c)));
+		bw_seen = (int)((upper - lower) / hops);
+		memset(&p, 0, sizeof(p));
+		p.hops = hops;
+		p.bw_seen = bw_seen;
+		p.rate = rate;
+		/* rounding of the hop count widens the crop */
+		p.crop = 1.0 - (double)bw_seen / (double)rate;
+		p.downsample = 1;
+		p.bin_len = plan_bins(rate, max_size, 1, &p.bin_e);
+		p.bin_size = (double)rate / (double)p.bin_len;
+		/* longer buffers amortise the retune when the fft is the bottleneck */
+		buf_len = MAX(2 * p.bin_len, DEFAULT_BUF_LENGTH);
+		for (; buf_len <= MAX(PLAN_MAX_BUF, 2 * p.bin_len); buf_len *= 2) {
+			p.buf_len = (buf_len + 511) & ~511;
+			plan_estimate(&p, lim);
+			avgs = plan_averages(&p, lim);
+			if (found) {
+				if (p.sweep_s > cand.sweep_s * (1.0 + PLAN_SWEEP_TIE)) {
+					continue;}
+				if (p.sweep_s >= cand.sweep_s * (1.0 - PLAN_SWEEP_TIE)) {
+					if (p.hops > cand.hops) {
+						continue;}
+					if (p.hops == cand.hops && avgs <= cand_avgs) {
+						continue;}
+				}
+			}
+			cand = p;
+			cand_avgs = avgs;
+			found = 1;
+		}
 	}
+	if (found && cand.sweep_s < best->sweep_s) {
+		*best = cand;}
+}
+
+void frequency_range(char *arg, double crop, struct plan_limits *lim)
+/* flesh out the tunes[] for scanning,
+ * with the optimiser if lim is given */
+// do we want the fewest ranges (easy) or the fewest bins (harder)?
+{
+	char *start, *stop, *step;
+	uint64_t upper, lower;
+	int i, max_size;
+	size_t avg_row;
+	double *avg;
+	struct sweep_plan plan, classic;
+	struct tuning_state *ts;
+	/* hacky string parsing */
+	start = arg;
+	stop = strchr(start, ':') + 1;
+	stop[-1] = '\0';
+	step = strchr(stop, ':') + 1;
+	step[-1] = '\0';
+	lower = (uint64_t)(atofs(start) + 0.5);
+	upper = (uint64_t)(atofs(stop) + 0.5);
+	max_size = (int)atofs(step);
+	stop[-1] = ':';
+	step[-1] = ':';
+	memset(&plan, 0, sizeof(plan));
+	plan_classic(&plan, lower, upper, max_size, crop);
+	classic = plan;
+	/* narrow ranges and giant bins keep the classic plan */
+	if (lim && plan.downsample == 1 && plan.bin_len > 1) {
+		plan_optimise(&plan, lower, upper, max_size, crop, lim);}
+	else {
+		lim = NULL;}
+	tune_count = plan.hops;
+	if (tune_count < 1) {
+		return;}
 	/* build the array */
+	tunes = calloc(tune_count, sizeof(struct tuning_state));
+	avg_row = (plan.bin_len + AVG_ALIGN/sizeof(double) - 1) & ~(AVG_ALIGN/sizeof(double) - 1);
+	avg_slab = calloc(1, (size_t)tune_count * avg_row * sizeof(double) + AVG_ALIGN);
+	if (!tunes || !avg_slab) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	avg = (double*)(((uintptr_t)avg_slab + AVG_ALIGN - 1) & ~(uintptr_t)(AVG_ALIGN - 1));
 	for (i=0; i<tune_count; i++) {
 		ts = &tunes[i];
-		ts->freq = lower + i*bw_seen + bw_seen/2;
-		ts->rate = bw_used;
-		ts->bin_e = bin_e;
+		ts->freq = lower + i*plan.bw_seen + plan.bw_seen/2;
+		ts->rate = plan.rate;
+		ts->bin_e = plan.bin_e;
+		ts->bin_len = plan.bin_len;
 		ts->samples = 0;
-		ts->crop = crop;
-		ts->downsample = downsample;
-		ts->downsample_passes = downsample_passes;
-		ts->avg = (int64_t*)malloc((1<<bin_e) * sizeof(int64_t));
-		if (!ts->avg) {
-			fprintf(stderr, "Error: malloc.\n");
-			exit(1);
-		}
-		for (j=0; j<(1<<bin_e); j++) {
-			ts->avg[j] = 0L;
-		}
-		ts->buf8 = (uint8_t*)malloc(buf_len * sizeof(uint8_t));
-		if (!ts->buf8) {
-			fprintf(stderr, "Error: malloc.\n");
-			exit(1);
-		}
-		ts->buf_len = buf_len;
+		ts->crop = plan.crop;
+		ts->downsample = plan.downsample;
+		ts->downsample_passes = plan.downsample_passes;
+		ts->avg = avg + (size_t)i * avg_row;
+		ts->buf_len = plan.buf_len;
 	}
 	/* report */
 	fprintf(stderr, "Number of frequency hops: %i\n", tune_count);
-	fprintf(stderr, "Dongle bandwidth: %iHz\n", bw_used);
-	fprintf(stderr, "Downsampling by: %ix\n", downsample);
-	fprintf(stderr, "Cropping by: %0.2f%%\n", crop*100);
-	fprintf(stderr, "Total FFT bins: %i\n", tune_count * (1<<bin_e));
+	fprintf(stderr, "Dongle bandwidth: %iHz\n", plan.rate);
+	fprintf(stderr, "Downsampling by: %ix\n", plan.downsample);
+	fprintf(stderr, "Cropping by: %0.2f%%\n", plan.crop*100);
+	fprintf(stderr, "Total FFT bins: %i\n", tune_count * plan.bin_len);
 	fprintf(stderr, "Logged FFT bins: %i\n", \
-	  (int)((double)(tune_count * (1<<bin_e)) * (1.0-crop)));
-	fprintf(stderr, "FFT bin size: %0.2fHz\n", bin_size);
-	fprintf(stderr, "Buffer size: %i bytes (%0.2fms)\n", buf_len, 1000 * 0.5 * (float)buf_len / (float)bw_used);
+	  (int)((double)(tune_count * plan.bin_len) * (1.0-plan.crop)));
+	fprintf(stderr, "FFT bin size: %0.2fHz\n", plan.bin_size);
+	if (plan.bin_len > 1) {
+		fprintf(stderr, "FFT segments per hop: %i\n", plan_segments(plan.buf_len, plan.bin_len, plan.downsample));
+	}
+	fprintf(stderr, "Buffer size: %i bytes (%0.2fms)\n", plan.buf_len, 1000 * 0.5 * (float)plan.buf_len / (float)plan.rate);
+	if (lim) {
+		plan_estimate(&classic, lim);
+		fprintf(stderr, "Without --plan: %i hops, %0.3fs sweep, %0.0f averages\n",
+			classic.hops, classic.sweep_s, plan_averages(&classic, lim));
+		plan_estimate(&plan, lim);
+		fprintf(stderr, "Estimated per hop: %0.2fms capture, %0.2fms FFT\n", plan.hop_us / 1000, plan.fft_us / 1000);
+		fprintf(stderr, "Estimated sweep time: %0.3fs, %0.0f averages per bin and interval\n", plan.sweep_s, plan_averages(&plan, lim));
+	}
 }
 
-void retune(rtlsdr_dev_t *d, uint64_t freq)
+static int jump_class(uint64_t from, uint64_t to)
+/* < 1, 4, 16, 64, 256 MHz and above */
 {
-	uint8_t dump[BUFFER_DUMP];
-	int n_read;
+	uint64_t d = (from > to ? from - to : to - from) >> 20;
+	int c = 0;
+	while (d && c < SETTLE_CLASSES-1) {
+		d >>= 2;
+		c++;
+	}
+	return c;
+}
+
+static double block_power(uint8_t *buf, int len)
+{
+	int i;
+	double s = 0.0, x;
+	for (i=0; i<len; i++) {
+		x = (double)buf[i] - 127.5;
+		s += x * x;
+	}
+	return s / (double)len;
+}
+
+static int settled_from(double *p, int n)
+/* first block of the run at the end with power within SETTLE_DB */
+{
+	int i;
+	double lo, hi;
+	lo = hi = p[n-1];
+	for (i=n-2; i>=0; i--) {
+		lo = MIN(lo, p[i]);
+		hi = MAX(hi, p[i]);
+		if (hi > lo * pow(10.0, SETTLE_DB / 10.0)) {
+			break;}
+	}
+	return i + 1;
+}
+
+void retune(struct dongle_state *ds, uint64_t freq)
+/* dead time is the PLL lock time, the buffer dump, and more blocks
+ * only while their power still moves. each jump size learns how many
+ * blocks to read in one go */
+{
+	uint8_t dump[SETTLE_MAX_BYTES];
+	double power[SETTLE_MAX_BYTES/SETTLE_BLOCK];
+	int i, n, n_read, len, c, polls, blocks;
+	rtlsdr_dev_t *d = ds->dev;
+	c = jump_class(rtlsdr_get_center_freq64(d), freq);
 	rtlsdr_set_center_freq64(d, freq);
-	/* wait for settling and flush buffer */
-	usleep(5000);
-	rtlsdr_read_sync(d, &dump, BUFFER_DUMP, &n_read);
-	if (n_read != BUFFER_DUMP) {
-		fprintf(stderr, "Error: bad retune.\n");}
+	ds->retunes++;
+	/* wait for settling */
+	if (ds->pll_check) {
+		for (polls=1; polls<=SETTLE_POLLS; polls++) {
+			i = rtlsdr_is_tuner_PLL_locked(d);
+			if (i <= 0) {
+				break;}
+			usleep(250);
+		}
+		ds->pll_polls += polls;
+		if (i < 0 && ds->pll_check < 0) {
+			fprintf(stderr, "Device #%d: no PLL lock check, using fixed settle time.\n", ds->dev_index);
+			ds->pll_check = 0;
+		} else if (i > 0) {
+			ds->unsettled++;
+		} else {
+			ds->pll_check = 1;}
+	}
+	if (!ds->pll_check) {
+		usleep(5000);}
+	/* flush buffer, at least the last three blocks must agree */
+	len = BUFFER_DUMP + ds->extra_blocks[c] * SETTLE_BLOCK;
+	rtlsdr_read_sync(d, dump, len, &n_read);
+	if (n_read != len) {
+		fprintf(stderr, "Error: bad retune.\n");
+		return;
+	}
+	n = len / SETTLE_BLOCK;
+	for (i=0; i<n; i++) {
+		power[i] = block_power(dump + i*SETTLE_BLOCK, SETTLE_BLOCK);
+	}
+	while (settled_from(power, n) > n-3 && n < SETTLE_MAX_BYTES/SETTLE_BLOCK) {
+		rtlsdr_read_sync(d, dump, SETTLE_BLOCK, &n_read);
+		power[n++] = block_power(dump, SETTLE_BLOCK);
+	}
+	i = settled_from(power, n);
+	if (i > n-3) {
+		ds->unsettled++;}
+	ds->settle_blocks += n - BUFFER_DUMP/SETTLE_BLOCK;
+	/* extra blocks that would have put the first settled block
+	 * at the start of the final three */
+	blocks = MAX(0, i + 3 - BUFFER_DUMP/SETTLE_BLOCK);
+	blocks = MIN(blocks, (SETTLE_MAX_BYTES - BUFFER_DUMP) / SETTLE_BLOCK);
+	/* move halfway to what this jump needed */
+	if (blocks > ds->extra_blocks[c]) {
+		ds->extra_blocks[c] = (ds->extra_blocks[c] + blocks + 1) / 2;
+	} else {
+		ds->extra_blocks[c] = (ds->extra_blocks[c] + blocks) / 2;}
 }
 
 void fifth_order(int16_t *data, int length)
@@ -646,96 +1423,280 @@ int64_t real_conj(int16_t real, int16_t imag)
 	return ((int64_t)real*(int64_t)real + (int64_t)imag*(int64_t)imag);
 }
 
-void scanner(void)
+void capture_hop(struct dongle_state *ds, struct tuning_state *ts, uint8_t *buf8)
 {
-	int i, j, j2, n_read, offset, bin_e, bin_len, buf_len, ds, ds_p;
+	int n_read;
 	uint64_t f;
+	rtlsdr_dev_t *dev = ds->dev;
+	f = rtlsdr_get_center_freq64(dev);
+	if (f != ts->freq) {
+		retune(ds, ts->freq);}
+	rtlsdr_read_sync(dev, buf8, ts->buf_len, &n_read);
+	if (n_read != ts->buf_len) {
+		fprintf(stderr, "Error: dropped samples.\n");}
+}
+
+void process_hop(struct tuning_state *ts, uint8_t *buf8, struct fft_worker *fw)
+{
+	int j, j2, offset, step, bin_e, bin_len, buf_len, ds, ds_p;
 	int32_t w;
-	struct tuning_state *ts;
-	bin_e = tunes[0].bin_e;
-	bin_len = 1 << bin_e;
-	buf_len = tunes[0].buf_len;
-	for (i=0; i<tune_count; i++) {
-		if (do_exit >= 2)
-			{return;}
-		ts = &tunes[i];
-		f = rtlsdr_get_center_freq64(dev);
-		if (f != ts->freq) {
-			retune(dev, ts->freq);}
-		rtlsdr_read_sync(dev, ts->buf8, buf_len, &n_read);
-		if (n_read != buf_len) {
-			fprintf(stderr, "Error: dropped samples.\n");}
-		/* rms */
-		if (bin_len == 1) {
-			rms_power(ts);
-			continue;
+	float *re, *im;
+	struct stats_scale sc;
+	int16_t *fft_buf = fw->fft_buf;
+	int16_t *seg = fw->seg_buf;
+	bin_e = ts->bin_e;
+	bin_len = ts->bin_len;
+	buf_len = ts->buf_len;
+	/* segments overlap by sharing the converted samples in fft_buf */
+	step = MAX(1, bin_len - (int)((double)bin_len * overlap));
+	/* rms */
+	if (bin_len == 1) {
+		rms_power(ts, buf8);
+		return;
+	}
+	/* prep for fft */
+	for (j=0; j<buf_len; j++) {
+		fft_buf[j] = (int16_t)buf8[j] - 127;
+	}
+	ds = ts->downsample;
+	ds_p = ts->downsample_passes;
+	if (boxcar && ds > 1) {
+		j=2, j2=0;
+		while (j < buf_len) {
+			fft_buf[j2]   += fft_buf[j];
+			fft_buf[j2+1] += fft_buf[j+1];
+			fft_buf[j] = 0;
+			fft_buf[j+1] = 0;
+			j += 2;
+			if (j % (ds*2) == 0) {
+				j2 += 2;}
 		}
-		/* prep for fft */
-		for (j=0; j<buf_len; j++) {
-			fft_buf[j] = (int16_t)ts->buf8[j] - 127;
+	} else if (ds_p) {  /* recursive */
+		for (j=0; j < ds_p; j++) {
+			downsample_iq(fft_buf, buf_len >> j);
 		}
-		ds = ts->downsample;
-		ds_p = ts->downsample_passes;
-		if (boxcar && ds > 1) {
-			j=2, j2=0;
-			while (j < buf_len) {
-				fft_buf[j2]   += fft_buf[j];
-				fft_buf[j2+1] += fft_buf[j+1];
-				fft_buf[j] = 0;
-				fft_buf[j+1] = 0;
-				j += 2;
-				if (j % (ds*2) == 0) {
-					j2 += 2;}
-			}
-		} else if (ds_p) {  /* recursive */
-			for (j=0; j < ds_p; j++) {
-				downsample_iq(fft_buf, buf_len >> j);
-			}
-			/* droop compensation */
-			if (comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
-				generic_fir(fft_buf, buf_len >> j, cic_9_tables[ds_p]);
-				generic_fir(fft_buf+1, (buf_len >> j)-1, cic_9_tables[ds_p]);
-			}
+		/* droop compensation */
+		if (comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
+			generic_fir(fft_buf, buf_len >> j, cic_9_tables[ds_p]);
+			generic_fir(fft_buf+1, (buf_len >> j)-1, cic_9_tables[ds_p]);
 		}
-		remove_dc(fft_buf, buf_len / ds);
-		remove_dc(fft_buf+1, (buf_len / ds) - 1);
-		/* window function and fft */
-		for (offset=0; offset<(buf_len/ds); offset+=(2*bin_len)) {
-			// todo, let rect skip this
-			for (j=0; j<bin_len; j++) {
-				w =  (int32_t)fft_buf[offset+j*2];
-				w *= (int32_t)(window_coefs[j]);
-				//w /= (int32_t)(ds);
-				fft_buf[offset+j*2]   = (int16_t)w;
-				w =  (int32_t)fft_buf[offset+j*2+1];
-				w *= (int32_t)(window_coefs[j]);
-				//w /= (int32_t)(ds);
-				fft_buf[offset+j*2+1] = (int16_t)w;
-			}
-			fix_fft(fft_buf+offset, bin_e);
+	}
+	remove_dc(fft_buf, buf_len / ds);
+	remove_dc(fft_buf+1, (buf_len / ds) - 1);
+	stats_scale(ts, ds, &sc);
+	/* window function and fft */
+	for (offset=0; offset+2*bin_len <= buf_len/ds; offset+=(2*step)) {
+		if (fft_engine == FFT_FLOAT) {
+			fft_fill(&fplan, &fw->fwork, fft_buf+offset);
+			fft_float(&fplan, &fw->fwork);
+			re = fw->fwork.re;
+			im = fw->fwork.im;
 			if (!peak_hold) {
 				for (j=0; j<bin_len; j++) {
-					ts->avg[j] += real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]);
+					ts->avg[j] += (double)(re[j]*re[j] + im[j]*im[j]);
 				}
 			} else {
 				for (j=0; j<bin_len; j++) {
-					ts->avg[j] = MAX(real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]), ts->avg[j]);
+					ts->avg[j] = MAX((double)(re[j]*re[j] + im[j]*im[j]), ts->avg[j]);
+				}
+			}
+			if (ts->hist || ts->duty) {
+				for (j=0; j<bin_len; j++) {
+					stats_add(ts, j, (double)(re[j]*re[j] + im[j]*im[j]), &sc);
 				}
 			}
 			ts->samples += ds;
+			continue;
+		}
+		// todo, let rect skip this
+		for (j=0; j<bin_len; j++) {
+			w =  (int32_t)fft_buf[offset+j*2];
+			w *= (int32_t)(window_coefs[j]);
+			//w /= (int32_t)(ds);
+			seg[j*2]   = (int16_t)w;
+			w =  (int32_t)fft_buf[offset+j*2+1];
+			w *= (int32_t)(window_coefs[j]);
+			//w /= (int32_t)(ds);
+			seg[j*2+1] = (int16_t)w;
 		}
+		fix_fft(seg, bin_e);
+		if (!peak_hold) {
+			for (j=0; j<bin_len; j++) {
+				ts->avg[j] += real_conj(seg[j*2], seg[j*2+1]);
+			}
+		} else {
+			for (j=0; j<bin_len; j++) {
+				ts->avg[j] = MAX(real_conj(seg[j*2], seg[j*2+1]), ts->avg[j]);
+			}
+		}
+		if (ts->hist || ts->duty) {
+			for (j=0; j<bin_len; j++) {
+				stats_add(ts, j, (double)real_conj(seg[j*2], seg[j*2+1]), &sc);
+			}
+		}
+		ts->samples += ds;
 	}
 }
 
-void csv_dbm(struct tuning_state *ts)
+static void *capture_thread_fn(void *arg)
 {
-	int i, len, ds, i1, i2, bw2, bin_count;
-	int64_t tmp;
-	double dbm;
-	len = 1 << ts->bin_e;
-	ds = ts->downsample;
-	/* fix FFT stuff quirks */
-	if (ts->bin_e > 0) {
+	struct dongle_state *ds = arg;
+	int i, sweep = 0;
+	uint8_t *buf;
+	pthread_mutex_lock(&scan.lock);
+	while (!scan.stop) {
+		while (!scan.stop && scan.sweep == sweep) {
+			pthread_cond_wait(&scan.sweep_cond, &scan.lock);}
+		if (scan.stop) {
+			break;}
+		sweep = scan.sweep;
+		pthread_mutex_unlock(&scan.lock);
+		for (i=ds->first; i<ds->last; i++) {
+			if (do_exit >= 2) {
+				break;}
+			pthread_mutex_lock(&scan.lock);
+			while (!scan.stop && !scan.free_count) {
+				pthread_cond_wait(&scan.free_cond, &scan.lock);}
+			if (scan.stop) {
+				pthread_mutex_unlock(&scan.lock);
+				break;
+			}
+			buf = scan.free_bufs[--scan.free_count];
+			pthread_mutex_unlock(&scan.lock);
+			capture_hop(ds, &tunes[i], buf);
+			pthread_mutex_lock(&scan.lock);
+			scan.queue[scan.q_tail].hop = i;
+			scan.queue[scan.q_tail].buf = buf;
+			scan.q_tail++;
+			pthread_cond_signal(&scan.work_cond);
+			pthread_mutex_unlock(&scan.lock);
+		}
+		pthread_mutex_lock(&scan.lock);
+		if (i < ds->last) {
+			scan.aborted = 1;
+			pthread_cond_signal(&scan.done_cond);
+		}
+	}
+	pthread_mutex_unlock(&scan.lock);
+	return 0;
+}
+
+static void *fft_thread_fn(void *arg)
+{
+	struct fft_worker *fw = arg;
+	struct hop_job job;
+	pthread_mutex_lock(&scan.lock);
+	while (!scan.stop) {
+		if (scan.q_head == scan.q_tail) {
+			pthread_cond_wait(&scan.work_cond, &scan.lock);
+			continue;
+		}
+		job = scan.queue[scan.q_head++];
+		pthread_mutex_unlock(&scan.lock);
+		process_hop(&tunes[job.hop], job.buf, fw);
+		pthread_mutex_lock(&scan.lock);
+		scan.free_bufs[scan.free_count++] = job.buf;
+		pthread_cond_signal(&scan.free_cond);
+		scan.done++;
+		pthread_cond_signal(&scan.done_cond);
+	}
+	pthread_mutex_unlock(&scan.lock);
+	return 0;
+}
+
+int scan_start(int workers, int buf_len, int bin_len)
+{
+	int i;
+	struct fft_worker *fw;
+	pthread_mutex_init(&scan.lock, NULL);
+	pthread_cond_init(&scan.sweep_cond, NULL);
+	pthread_cond_init(&scan.work_cond, NULL);
+	pthread_cond_init(&scan.done_cond, NULL);
+	pthread_cond_init(&scan.free_cond, NULL);
+	scan.sweep = scan.q_head = scan.q_tail = 0;
+	scan.done = scan.aborted = scan.stop = 0;
+	scan.queue = malloc(tune_count * sizeof(struct hop_job));
+	scan.workers = workers;
+	scan.worker = calloc(workers, sizeof(struct fft_worker));
+	/* hops in flight: one being captured and one queued per dongle,
+	 * one being processed per worker */
+	scan.free_count = 2 * dongle_count + workers;
+	scan.pool = malloc((size_t)scan.free_count * buf_len);
+	scan.free_bufs = malloc(scan.free_count * sizeof(uint8_t *));
+	if (!scan.queue || !scan.worker || !scan.pool || !scan.free_bufs) {
+		return -1;}
+	for (i=0; i<scan.free_count; i++) {
+		scan.free_bufs[i] = scan.pool + (size_t)i * buf_len;
+	}
+	for (i=0; i<workers; i++) {
+		fw = &scan.worker[i];
+		fw->index = i;
+		fw->fft_buf = malloc(buf_len * sizeof(int16_t));
+		fw->seg_buf = malloc(2 * bin_len * sizeof(int16_t));
+		if (!fw->fft_buf || !fw->seg_buf) {
+			return -1;}
+		if (fft_engine == FFT_FLOAT && bin_len > 1 && fft_work_init(&fw->fwork, bin_len) < 0) {
+			return -1;}
+		if (pthread_create(&fw->thread, NULL, fft_thread_fn, fw)) {
+			return -1;}
+	}
+	for (i=0; i<dongle_count; i++) {
+		if (pthread_create(&dongles[i].thread, NULL, capture_thread_fn, &dongles[i])) {
+			return -1;}
+	}
+	return 0;
+}
+
+void scan_stop(void)
+{
+	int i;
+	pthread_mutex_lock(&scan.lock);
+	scan.stop = 1;
+	pthread_cond_broadcast(&scan.sweep_cond);
+	pthread_cond_broadcast(&scan.work_cond);
+	pthread_cond_broadcast(&scan.free_cond);
+	pthread_mutex_unlock(&scan.lock);
+	for (i=0; i<dongle_count; i++) {
+		pthread_join(dongles[i].thread, NULL);
+	}
+	for (i=0; i<scan.workers; i++) {
+		pthread_join(scan.worker[i].thread, NULL);
+		free(scan.worker[i].fft_buf);
+		free(scan.worker[i].seg_buf);
+		fft_work_free(&scan.worker[i].fwork);
+	}
+	free(scan.worker);
+	free(scan.queue);
+	free(scan.free_bufs);
+	free(scan.pool);
+	pthread_cond_destroy(&scan.sweep_cond);
+	pthread_cond_destroy(&scan.free_cond);
+	pthread_cond_destroy(&scan.work_cond);
+	pthread_cond_destroy(&scan.done_cond);
+	pthread_mutex_destroy(&scan.lock);
+}
+
+void scanner(void)
+/* one sweep: every dongle captures its hops while the workers process
+ * those already captured. returns when avg[] of all hops is complete */
+{
+	pthread_mutex_lock(&scan.lock);
+	scan.q_head = scan.q_tail = 0;
+	scan.done = 0;
+	scan.sweep++;
+	pthread_cond_broadcast(&scan.sweep_cond);
+	while (scan.done < tune_count && !scan.aborted) {
+		pthread_cond_wait(&scan.done_cond, &scan.lock);}
+	pthread_mutex_unlock(&scan.lock);
+}
+
+void fix_quirks(struct tuning_state *ts)
+/* fix FFT stuff quirks */
+{
+	int i, len;
+	double tmp;
+	len = ts->bin_len;
+	if (len > 1) {
 		/* nuke DC component (not effective for all windows) */
 		ts->avg[0] = ts->avg[1];
 		/* FFT is translated by 180 degrees */
@@ -745,14 +1706,135 @@ void csv_dbm(struct tuning_state *ts)
 			ts->avg[i+len/2] = tmp;
 		}
 	}
-	/* Hz low, Hz high, Hz step, samples, dbm, dbm, ... */
+}
+
+void logged_bins(struct tuning_state *ts, int *i1, int *i2)
+/* first and last bin after cropping */
+{
+	int len = ts->bin_len;
+	*i1 = 0 + (int)((double)len * ts->crop * 0.5);
+	*i2 = (len-1) - (int)((double)len * ts->crop * 0.5);
+}
+
+double hop_low_hz(struct tuning_state *ts)
+{
+	int len, bw2, bin_count;
+	len = ts->bin_len;
 	bin_count = (int)((double)len * (1.0 - ts->crop));
-	bw2 = (int)(((double)ts->rate * (double)bin_count) / (len * 2 * ds));
-	fprintf(file, "%.0f, %.0f, %.2f, %i, ", (double)(ts->freq - bw2), (double)(ts->freq + bw2),
+	bw2 = (int)(((double)ts->rate * (double)bin_count) / (len * 2 * ts->downsample));
+	return (double)(ts->freq - bw2);
+}
+
+void reset_hop(struct tuning_state *ts)
+{
+	int i;
+	for (i=0; i<ts->bin_len; i++) {
+		ts->avg[i] = 0.0;
+	}
+	if (ts->hist) {
+		memset(ts->hist, 0, (size_t)ts->bin_len * QUANT_BUCKETS * sizeof(uint16_t));}
+	if (ts->duty) {
+		memset(ts->duty, 0, (size_t)ts->bin_len * sizeof(uint32_t));}
+	ts->samples = 0;
+}
+
+int stats_init(void)
+/* histogram and duty rows for every hop, after frequency_range() */
+{
+	int i;
+	size_t bins = (size_t)tune_count * tunes[0].bin_len;
+	if (quant_count) {
+		hist_slab = calloc(bins * QUANT_BUCKETS, sizeof(uint16_t));
+		if (!hist_slab) {
+			return -1;}
+	}
+	if (duty_on) {
+		duty_slab = calloc(bins, sizeof(uint32_t));
+		if (!duty_slab) {
+			return -1;}
+	}
+	for (i=0; i<tune_count; i++) {
+		if (hist_slab) {
+			tunes[i].hist = hist_slab + (size_t)i * tunes[i].bin_len * QUANT_BUCKETS;}
+		if (duty_slab) {
+			tunes[i].duty = duty_slab + (size_t)i * tunes[i].bin_len;}
+	}
+	fprintf(stderr, "Statistics memory: %0.1f MB\n",
+		(double)bins * ((quant_count ? QUANT_BUCKETS * sizeof(uint16_t) : 0) + (duty_on ? sizeof(uint32_t) : 0)) / 1e6);
+	return 0;
+}
+
+static int raw_bin(struct tuning_state *ts, int i)
+/* index of the i-th output bin before fix_quirks() */
+{
+	int len = ts->bin_len;
+	if (len == 1) {
+		return 0;}
+	i = (i + len/2) % len;
+	return i ? i : 1;
+}
+
+double stats_value(struct tuning_state *ts, int stat, int i)
+/* stat < quant_count: percentile in dB, else duty in percent */
+{
+	int b, j = raw_bin(ts, i);
+	uint16_t *h;
+	double total, target, cum;
+	if (stat >= quant_count) {
+		if (ts->samples < ts->downsample) {
+			return 0.0;}
+		return 100.0 * (double)ts->duty[j] / (double)(ts->samples / ts->downsample);
+	}
+	h = ts->hist + (size_t)j * QUANT_BUCKETS;
+	total = 0.0;
+	for (b=0; b<QUANT_BUCKETS; b++) {
+		total += h[b];}
+	target = total * quant_pct[stat] / 100.0;
+	cum = 0.0;
+	for (b=0; b<QUANT_BUCKETS; b++) {
+		/* linear inside the bucket */
+		if (h[b] && cum + h[b] >= target) {
+			return ts->hist_min_db + QUANT_STEP_DB * (b + (target - cum) / h[b]);}
+		cum += h[b];
+	}
+	return ts->hist_min_db;
+}
+
+void csv_stats(struct tuning_state *ts, char *t_str)
+/* one row per statistic after csv_dbm(), same columns */
+{
+	int stat, i, i1, i2;
+	double v = 0.0, low;
+	low = hop_low_hz(ts);
+	logged_bins(ts, &i1, &i2);
+	for (stat=0; stat < quant_count + duty_on; stat++) {
+		fprintf(file, "%s, %.0f, %.0f, %.2f, ", t_str, low, 2.0 * (double)ts->freq - low,
+			(double)ts->rate / (double)(ts->bin_len * ts->downsample));
+		if (stat < quant_count) {
+			fprintf(file, "p%i, ", quant_pct[stat]);
+		} else {
+			fprintf(file, "duty, ");}
+		for (i=i1; i<=i2; i++) {
+			v = stats_value(ts, stat, i);
+			fprintf(file, "%.2f, ", v);
+		}
+		fprintf(file, "%.2f\n", v);
+	}
+}
+
+void csv_dbm(struct tuning_state *ts)
+{
+	int i, len, ds, i1, i2;
+	double dbm, low;
+	len = ts->bin_len;
+	ds = ts->downsample;
+	fix_quirks(ts);
+	/* Hz low, Hz high, Hz step, samples, dbm, dbm, ... */
+	low = hop_low_hz(ts);
+	fprintf(file, "%.0f, %.0f, %.2f, %i, ", low, 2.0 * (double)ts->freq - low,
 		(double)ts->rate / (double)(len*ds), ts->samples);
 	// something seems off with the dbm math
-	i1 = 0 + (int)((double)len * ts->crop * 0.5);
-	i2 = (len-1) - (int)((double)len * ts->crop * 0.5);
+	logged_bins(ts, &i1, &i2);
 	for (i=i1; i<=i2; i++) {
 		dbm  = (double)ts->avg[i];
 		dbm /= (double)ts->rate;
@@ -761,15 +1843,389 @@ void csv_dbm(struct tuning_state *ts)
 		fprintf(file, "%.2f, ", dbm);
 	}
 	dbm = (double)ts->avg[i2] / ((double)ts->rate * (double)ts->samples);
-	if (ts->bin_e == 0) {
+	if (len == 1) {
 		dbm = ((double)ts->avg[0] / \
 		((double)ts->rate * (double)ts->samples));}
 	dbm  = 10 * log10(dbm);
 	fprintf(file, "%.2f\n", dbm);
-	for (i=0; i<len; i++) {
-		ts->avg[i] = 0L;
+}
+
+/* binary output, all values little endian.
+ * the header is written once, then one fixed size record per interval.
+ * record k starts at header_len + k * record_len, so a file can be
+ * appended to by later runs with the same plan and mapped for random
+ * access by time.
+ *
+ * header:
+ *    0  char[8]  "RTLPOWER"
+ *    8  u16      format version (1)
+ *   10  u16      sample type: 1 = float32 dB, 2 = int16 centi-dB
+ *   12  u32      header_len
+ *   16  u32      record_len
+ *   20  u32      hop count
+ *   24  u32      logged bins per hop
+ *   28  u32      fft length
+ *   32  f64      bin size [Hz]
+ *   40  u32      dongle sample rate [Hz]
+ *   44  u32      downsample factor
+ *   48  f64      crop
+ *   56  char[16] window name
+ *   72  u8       quantile planes, --quantiles
+ *   73  u8       duty plane, --duty
+ *   74  i16      duty level [centi-dB]
+ *   76  u8[4]    percentile of each quantile plane
+ *   80  f64      frequency of the first logged bin, per hop [Hz]
+ *
+ * record:
+ *    0  u64      unix time [s]
+ *    8  u32      samples, per hop
+ *       pad to 8 bytes
+ *       bins, hop after hop, float32 or int16
+ *       per quantile plane: bins as above
+ *       duty plane: bins in percent, float32 or int16 centi-percent
+ *       pad to 8 bytes
+ */
+
+#define BIN_VERSION		1
+#define BIN_HEADER_FIXED	80
+
+enum bin_types { BIN_F32 = 1, BIN_I16 = 2 };
+
+struct bin_output
+{
+	enum bin_types type;
+	int header_len;
+	int record_len;
+	int bins_per_hop;
+	int bins_offset;
+	int planes;  /* averages and statistics */
+	unsigned char *header;
+	unsigned char *record;
+};
+
+struct bin_output bin_out;
+
+static void put_le(unsigned char *p, uint64_t v, int n)
+{
+	int k;
+	for (k = 0; k < n; k++, v >>= 8)
+		p[k] = (unsigned char)(v & 0xff);
+}
+
+static void put_le_f64(unsigned char *p, double v)
+{
+	uint64_t u;
+	memcpy(&u, &v, 8);
+	put_le(p, u, 8);
+}
+
+static void put_le_f32(unsigned char *p, float v)
+{
+	uint32_t u;
+	memcpy(&u, &v, 4);
+	put_le(p, u, 4);
+}
+
+int bin_init(struct bin_output *b, enum bin_types type, const char *window_name)
+{
+	int i, i1, i2, bin_size;
+	unsigned char *h;
+	struct tuning_state *ts = &tunes[0];
+	logged_bins(ts, &i1, &i2);
+	b->type = type;
+	b->bins_per_hop = i2 - i1 + 1;
+	b->header_len = BIN_HEADER_FIXED + 8 * tune_count;
+	b->bins_offset = (8 + 4 * tune_count + 7) & ~7;
+	b->planes = 1 + quant_count + duty_on;
+	bin_size = (type == BIN_F32) ? 4 : 2;
+	b->record_len = (b->bins_offset + bin_size * b->bins_per_hop * tune_count * b->planes + 7) & ~7;
+	b->header = calloc(1, b->header_len);
+	b->record = calloc(1, b->record_len);
+	if (!b->header || !b->record) {
+		return -1;}
+	h = b->header;
+	memcpy(h, "RTLPOWER", 8);
+	put_le(h + 8, BIN_VERSION, 2);
+	put_le(h + 10, type, 2);
+	put_le(h + 12, b->header_len, 4);
+	put_le(h + 16, b->record_len, 4);
+	put_le(h + 20, tune_count, 4);
+	put_le(h + 24, b->bins_per_hop, 4);
+	put_le(h + 28, ts->bin_len, 4);
+	put_le_f64(h + 32, (double)ts->rate / (double)(ts->bin_len * ts->downsample));
+	put_le(h + 40, ts->rate, 4);
+	put_le(h + 44, ts->downsample, 4);
+	put_le_f64(h + 48, ts->crop);
+	strncpy((char *)h + 56, window_name, 15);
+	h[72] = (unsigned char)quant_count;
+	h[73] = (unsigned char)duty_on;
+	put_le(h + 74, (uint16_t)(int16_t)lround(duty_db * 100.0), 2);
+	for (i=0; i<quant_count; i++) {
+		h[76 + i] = (unsigned char)quant_pct[i];}
+	for (i=0; i<tune_count; i++) {
+		put_le_f64(h + BIN_HEADER_FIXED + 8*i, hop_low_hz(&tunes[i]));
 	}
-	ts->samples = 0;
+	return 0;
+}
+
+int bin_open(struct bin_output *b, FILE *f)
+/* appends if the file already has the same header */
+{
+	unsigned char *old;
+	long size;
+	if (f == stdout) {
+		return fwrite(b->header, b->header_len, 1, f) == 1 ? 0 : -1;}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	if (size <= 0) {
+		return fwrite(b->header, b->header_len, 1, f) == 1 ? 0 : -1;}
+	old = malloc(b->header_len);
+	if (!old) {
+		return -1;}
+	fseek(f, 0, SEEK_SET);
+	if (size < b->header_len || fread(old, b->header_len, 1, f) != 1
+	    || memcmp(old, b->header, b->header_len)) {
+		free(old);
+		fprintf(stderr, "Error: existing file has a different format or frequency plan.\n");
+		return -1;
+	}
+	free(old);
+	/* drop a partial record of an interrupted run */
+	size = b->header_len + ((size - b->header_len) / b->record_len) * b->record_len;
+	fseek(f, size, SEEK_SET);
+	fprintf(stderr, "Appending after %li records.\n", (size - b->header_len) / b->record_len);
+	return 0;
+}
+
+static unsigned char *put_value(struct bin_output *b, unsigned char *p, double v)
+/* float32 or int16 hundredths */
+{
+	long c;
+	if (b->type == BIN_F32) {
+		put_le_f32(p, (float)v);
+		return p + 4;
+	}
+	if (!(v > -327.68)) {
+		c = -32768;
+	} else if (v > 327.67) {
+		c = 32767;
+	} else {
+		c = lround(v * 100.0);}
+	put_le(p, (uint16_t)(int16_t)c, 2);
+	return p + 2;
+}
+
+int bin_record(struct bin_output *b, time_t t)
+{
+	int h, i, i1, i2, stat;
+	size_t hop_len, plane_len;
+	double dbm;
+	unsigned char *p;
+	struct tuning_state *ts;
+	memset(b->record, 0, b->record_len);
+	put_le(b->record, (uint64_t)t, 8);
+	hop_len = (size_t)b->bins_per_hop * (b->type == BIN_F32 ? 4 : 2);
+	plane_len = hop_len * tune_count;
+	for (h=0; h<tune_count; h++) {
+		ts = &tunes[h];
+		put_le(b->record + 8 + 4*h, (uint32_t)ts->samples, 4);
+		fix_quirks(ts);
+		logged_bins(ts, &i1, &i2);
+		p = b->record + b->bins_offset + h * hop_len;
+		for (i=i1; i<=i2; i++) {
+			dbm = 10 * log10(ts->avg[i] / ((double)ts->rate * (double)ts->samples));
+			p = put_value(b, p, dbm);
+		}
+		for (stat=0; stat < b->planes - 1; stat++) {
+			p = b->record + b->bins_offset + (stat + 1) * plane_len + h * hop_len;
+			for (i=i1; i<=i2; i++) {
+				p = put_value(b, p, stats_value(ts, stat, i));}
+		}
+		reset_hop(ts);
+	}
+	return fwrite(b->record, b->record_len, 1, file) == 1 ? 0 : -1;
+}
+
+void bin_free(struct bin_output *b)
+{
+	free(b->header);
+	free(b->record);
+}
+
+void time_label(char *s, int n, time_t t, const char *dev_label)
+/* first columns of every csv row */
+{
+	struct tm *cal_time;
+	if (time_mode == EPOCH_TIME) {
+		snprintf(s, n, "%u, %s", (unsigned)t, dev_label);
+		return;
+	}
+	cal_time = localtime(&t);
+	strftime(s, n, "%Y-%m-%d, %H:%M:%S", cal_time);
+}
+
+/* event output, instead of every bin of every interval.
+ * each logged bin keeps a baseline, the running mean of its level in dB
+ * over the first EVENT_BASE intervals and an exponential average after.
+ * a bin that leaves the baseline by more than the threshold opens an
+ * event, which is written once the bin is back:
+ *
+ *   time, event, Hz, +|-, seconds, peak dB, mean dB, baseline dB
+ *
+ * time is the interval the event started in, seconds are whole
+ * intervals, '+' is a rise, '-' a drop
+ * of a signal that is part of the baseline, peak is the level furthest
+ * from the baseline. the baseline follows 8x slower during an event,
+ * so a lasting change ends up as the new baseline and closes the event.
+ * every summary intervals, one row per hop:
+ *
+ *   time, summary, Hz low, Hz high, floor dB, max dB, active, ended
+ *
+ * with the mean baseline, the strongest bin, open events and events
+ * written since the last summary.
+ */
+
+#define EVENT_BASE		32
+#define EVENT_WARMUP		4
+
+struct bin_event
+{
+	float base;
+	float peak;
+	float sum;  /* of levels during the event */
+	int32_t n;  /* intervals in the event, 0 = none */
+	uint32_t start;  /* seconds after the first interval */
+};
+
+struct event_output
+{
+	double threshold;
+	int summary;  /* intervals, 0 = never */
+	int interval;  /* seconds */
+	int bins_per_hop;
+	int intervals;
+	time_t t0;
+	int *ended;  /* per hop, since the last summary */
+	struct bin_event *bins;
+	const char *dev_label;
+};
+
+struct event_output ev_out;
+
+int event_init(struct event_output *e, double threshold, int summary, int interval, const char *dev_label)
+{
+	int i1, i2;
+	logged_bins(&tunes[0], &i1, &i2);
+	e->threshold = threshold;
+	e->summary = summary;
+	e->interval = interval;
+	e->bins_per_hop = i2 - i1 + 1;
+	e->intervals = 0;
+	e->t0 = 0;
+	e->dev_label = dev_label;
+	e->ended = calloc(tune_count, sizeof(int));
+	e->bins = calloc((size_t)tune_count * e->bins_per_hop, sizeof(struct bin_event));
+	if (!e->ended || !e->bins) {
+		return -1;}
+	return 0;
+}
+
+static void event_write(struct event_output *e, struct bin_event *b, double hz)
+{
+	char t_str[512];
+	time_label(t_str, sizeof(t_str), e->t0 + b->start, e->dev_label);
+	fprintf(file, "%s, event, %.0f, %c, %li, %.2f, %.2f, %.2f\n", t_str, hz,
+		b->peak >= b->base ? '+' : '-', (long)b->n * e->interval,
+		b->peak, b->sum / b->n, b->base);
+	b->n = 0;
+}
+
+void event_interval(struct event_output *e, time_t t)
+/* after every sweep that ends an interval */
+{
+	int h, i, i1, i2;
+	double level, alpha, bin_hz, low, floor_db, max_db;
+	int active;
+	char t_str[512];
+	struct tuning_state *ts;
+	struct bin_event *b;
+	if (!e->intervals) {
+		e->t0 = t;}
+	alpha = 1.0 / (double)MIN(e->intervals + 1, EVENT_BASE);
+	time_label(t_str, sizeof(t_str), t, e->dev_label);
+	for (h=0; h<tune_count; h++) {
+		ts = &tunes[h];
+		fix_quirks(ts);
+		logged_bins(ts, &i1, &i2);
+		bin_hz = (double)ts->rate / (double)(ts->bin_len * ts->downsample);
+		low = hop_low_hz(ts);
+		floor_db = 0.0;
+		max_db = -1e9;
+		active = 0;
+		for (i=i1; i<=i2; i++) {
+			b = &e->bins[(size_t)h * e->bins_per_hop + (i - i1)];
+			level = 10 * log10(ts->avg[i] / ((double)ts->rate * (double)ts->samples));
+			if (!isfinite(level)) {
+				/* no power at all: below the smallest nonzero one */
+				level = -10 * log10((double)ts->rate * (double)MAX(ts->samples, 1));}
+			if (!e->intervals) {
+				b->base = (float)level;}
+			/* a sign change closes the event and opens another */
+			if (b->n && (fabs(level - b->base) <= e->threshold
+			    || (level > b->base) != (b->peak > b->base))) {
+				event_write(e, b, low + (i - i1) * bin_hz);
+				e->ended[h]++;
+			}
+			if (!b->n && e->intervals >= EVENT_WARMUP
+			    && fabs(level - b->base) > e->threshold) {
+				b->start = (uint32_t)(t - e->t0);
+				b->peak = (float)level;
+				b->sum = (float)level;
+				b->n = 1;
+			} else if (b->n) {
+				b->sum += (float)level;
+				b->n++;
+				if (fabs(level - b->base) > fabs(b->peak - b->base)) {
+					b->peak = (float)level;}
+			}
+			b->base += (float)((level - b->base) * alpha / (b->n ? 8.0 : 1.0));
+			floor_db += b->base;
+			max_db = MAX(max_db, level);
+			active += b->n != 0;
+		}
+		if (e->summary && (e->intervals + 1) % e->summary == 0) {
+			fprintf(file, "%s, summary, %.0f, %.0f, %.2f, %.2f, %i, %i\n", t_str,
+				low, low + (i2 - i1) * bin_hz, floor_db / (i2 - i1 + 1), max_db, active, e->ended[h]);
+			e->ended[h] = 0;
+		}
+		reset_hop(ts);
+	}
+	e->intervals++;
+}
+
+void event_flush(struct event_output *e)
+/* writes the open events at exit, they end with the last interval */
+{
+	int h, i;
+	double hz;
+	struct bin_event *b;
+	if (!e->bins || !e->intervals) {
+		return;}
+	for (h=0; h<tune_count; h++) {
+		for (i=0; i<e->bins_per_hop; i++) {
+			b = &e->bins[(size_t)h * e->bins_per_hop + i];
+			if (!b->n) {
+				continue;}
+			hz = hop_low_hz(&tunes[h]) + i * (double)tunes[h].rate / (double)(tunes[h].bin_len * tunes[h].downsample);
+			event_write(e, b, hz);
+		}
+	}
+}
+
+void event_free(struct event_output *e)
+{
+	free(e->ended);
+	free(e->bins);
 }
 
 int main(int argc, char **argv)
@@ -778,12 +2234,11 @@ int main(int argc, char **argv)
 	struct sigaction sigact;
 #endif
 	char *filename = NULL;
-	int i, length, r, opt, wb_mode = 0;
+	int i, d, length, r = 0, opt, wb_mode = 0;
+	rtlsdr_dev_t *dev;
 	int f_set = 0;
 	int gain = AUTO_GAIN; // tenths of a dB
-	int dev_index = 0;
-	char dev_label[256];
-	int dev_given = 0;
+	char dev_label[256] = "";
 	int ppm_error = 0;
 	int interval = 10;
 	int fft_threads = 1;
@@ -800,27 +2255,55 @@ int main(int argc, char **argv)
 	time_t time_now;
 	time_t exit_time = 0;
 	char t_str[512];
-	struct tm *cal_time;
 	double (*window_fn)(int, int) = rectangle;
+	char *window_name = "rectangle";
+	int out_format = 0;  /* 0 = csv, else enum bin_types */
+	char *p;
+	int events = 0, summary = 60;
+	double event_db = 0.0;
+	int plan_mode = 0;  /* 1 = optimise, 2 = and exit */
+	int crop_given = 0;
+	struct plan_limits limits;
+	static struct option long_options[] = {
+		{"fft", required_argument, NULL, OPT_FFT},
+		{"format", required_argument, NULL, OPT_FORMAT},
+		{"overlap", required_argument, NULL, OPT_OVERLAP},
+		{"plan", no_argument, NULL, OPT_PLAN},
+		{"plan-only", no_argument, NULL, OPT_PLAN_ONLY},
+		{"quantiles", required_argument, NULL, OPT_QUANTILES},
+		{"duty", required_argument, NULL, OPT_DUTY},
+		{"events", required_argument, NULL, OPT_EVENTS},
+		{"summary", required_argument, NULL, OPT_SUMMARY},
+		{NULL, 0, NULL, 0}
+	};
 	freq_optarg = "";
 
-	while ((opt = getopt(argc, argv, "f:i:s:t:d:g:p:e:w:c:F:1EPOhTD:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "f:i:s:t:d:g:p:e:w:c:F:1EPOhTD:", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'f': // lower:upper:bin_size
 			freq_optarg = strdup(optarg);
 			f_set = 1;
 			break;
 		case 'd':
-			dev_index = verbose_device_search(optarg);
-			strncpy(dev_label, optarg, 255);
-			dev_label[255] = 0;
-			dev_given = 1;
+			if (dongle_count >= MAX_DONGLES) {
+				fprintf(stderr, "Too many devices, at most %i.\n", MAX_DONGLES);
+				exit(1);
+			}
+			dongles[dongle_count].dev_index = verbose_device_search(optarg);
+			if (dongles[dongle_count].dev_index < 0) {
+				exit(1);}
+			/* epoch mode label, e.g. "0+1" */
+			if (dongle_count) {
+				strncat(dev_label, "+", sizeof(dev_label) - strlen(dev_label) - 1);}
+			strncat(dev_label, optarg, sizeof(dev_label) - strlen(dev_label) - 1);
+			dongle_count++;
 			break;
 		case 'g':
 			gain = (int)(atof(optarg) * 10);
 			break;
 		case 'c':
 			crop = atofp(optarg);
+			crop_given = 1;
 			break;
 		case 'i':
 			interval = (int)round(atoft(optarg));
@@ -836,21 +2319,29 @@ int main(int argc, char **argv)
 			break;
 		case 'w':
 			if (strcmp("rectangle",  optarg) == 0) {
-				window_fn = rectangle;}
+				window_fn = rectangle;
+				window_name = "rectangle";}
 			if (strcmp("hamming",  optarg) == 0) {
-				window_fn = hamming;}
+				window_fn = hamming;
+				window_name = "hamming";}
 			if (strcmp("blackman",  optarg) == 0) {
-				window_fn = blackman;}
+				window_fn = blackman;
+				window_name = "blackman";}
 			if (strcmp("blackman-harris",  optarg) == 0) {
-				window_fn = blackman_harris;}
+				window_fn = blackman_harris;
+				window_name = "blackman-harris";}
 			if (strcmp("hann-poisson",  optarg) == 0) {
-				window_fn = hann_poisson;}
+				window_fn = hann_poisson;
+				window_name = "hann-poisson";}
 			if (strcmp("youssef",  optarg) == 0) {
-				window_fn = youssef;}
+				window_fn = youssef;
+				window_name = "youssef";}
 			if (strcmp("kaiser",  optarg) == 0) {
-				window_fn = kaiser;}
+				window_fn = kaiser;
+				window_name = "kaiser";}
 			if (strcmp("bartlett",  optarg) == 0) {
-				window_fn = bartlett;}
+				window_fn = bartlett;
+				window_name = "bartlett";}
 			break;
 		case 't':
 			fft_threads = atoi(optarg);
@@ -888,6 +2379,59 @@ int main(int argc, char **argv)
 		case 'T':
 			enable_biastee = 1;
 			break;
+		case OPT_FFT:
+			if (strcmp("fixed",  optarg) == 0) {
+				fft_engine = FFT_FIXED;
+			} else if (strcmp("float",  optarg) == 0) {
+				fft_engine = FFT_FLOAT;
+			} else {
+				usage();}
+			break;
+		case OPT_OVERLAP:
+			overlap = atofp(optarg);
+			break;
+		case OPT_PLAN:
+			plan_mode = MAX(plan_mode, 1);
+			break;
+		case OPT_PLAN_ONLY:
+			plan_mode = 2;
+			break;
+		case OPT_QUANTILES:
+			quant_count = 0;
+			for (p = optarg; *p; p++) {
+				if (quant_count >= QUANT_MAX) {
+					usage();}
+				quant_pct[quant_count] = (int)strtol(p, &p, 10);
+				if (quant_pct[quant_count] < 1 || quant_pct[quant_count] > 99) {
+					usage();}
+				quant_count++;
+				if (*p != ',') {
+					break;}
+			}
+			if (*p || !quant_count) {
+				usage();}
+			break;
+		case OPT_DUTY:
+			duty_on = 1;
+			duty_db = atof(optarg);
+			break;
+		case OPT_EVENTS:
+			events = 1;
+			event_db = atof(optarg);
+			break;
+		case OPT_SUMMARY:
+			summary = atoi(optarg);
+			break;
+		case OPT_FORMAT:
+			if (strcmp("csv",  optarg) == 0) {
+				out_format = 0;
+			} else if (strcmp("float",  optarg) == 0) {
+				out_format = BIN_F32;
+			} else if (strcmp("int16",  optarg) == 0) {
+				out_format = BIN_I16;
+			} else {
+				usage();}
+			break;
 		case 'h':
 		default:
 			usage();
@@ -900,15 +2444,25 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if ((crop < 0.0) || (crop > 1.0)) {
+	if ((crop < 0.0) || (crop >= 1.0)) {
 		fprintf(stderr, "Crop value outside of 0 to 1.\n");
 		exit(1);
 	}
 
-	frequency_range(freq_optarg, crop);
+	if ((overlap < 0.0) || (overlap > 0.9)) {
+		fprintf(stderr, "Overlap value outside of 0 to 90%%.\n");
+		exit(1);
+	}
 
-	if (tune_count == 0) {
-		usage();}
+	if (events && (out_format || quant_count || duty_on)) {
+		fprintf(stderr, "--events replaces the per bin output, it does not combine with --format, --quantiles or --duty.\n");
+		exit(1);
+	}
+
+	if (events && event_db <= 0.0) {
+		fprintf(stderr, "Event threshold must be above 0 dB.\n");
+		exit(1);
+	}
 
 	if (argc <= optind) {
 		filename = "-";
@@ -919,21 +2473,94 @@ int main(int argc, char **argv)
 	if (interval < 1) {
 		interval = 1;}
 
-	fprintf(stderr, "Reporting every %i seconds\n", interval);
+	if (plan_mode < 2) {
+		fprintf(stderr, "Reporting every %i seconds\n", interval);}
+
+	if (!dongle_count) {
+		dongles[0].dev_index = 0;
+		if (plan_mode < 2) {
+			dongles[0].dev_index = verbose_device_search("0");}
+		if (dongles[0].dev_index < 0) {
+			exit(1);}
+		strcpy(dev_label, "0");
+		dongle_count = 1;
+	}
+
+	/* the planner needs the slowest tuner, --plan-only assumes a R820T */
+	limits.interval = interval;
+	limits.fft_threads = MAX(1, fft_threads);
+	limits.dongles = dongle_count;
+	limits.settle_us = tuner_settle_us(RTLSDR_TUNER_R820T);
+	limits.crop_given = crop_given;
+	limits.dev = NULL;
+
+	for (d=0; plan_mode < 2 && d<dongle_count; d++) {
+		r = rtlsdr_open(&dongles[d].dev, (uint32_t)dongles[d].dev_index);
+		if (r < 0) {
+			fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dongles[d].dev_index);
+			exit(1);
+		}
+		dev = dongles[d].dev;
+		dongles[d].pll_check = -1;
+		if (d == 0) {
+			limits.settle_us = 0.0;
+			limits.dev = dev;}
+		limits.settle_us = MAX(limits.settle_us, tuner_settle_us(rtlsdr_get_tuner_type(dev)));
+
+		if (direct_sampling) {
+			verbose_direct_sampling(dev, 1);
+		}
+
+		/* Set direct sampling with threshold */
+		rtlsdr_set_ds_mode(dev, ds_mode, ds_threshold);
 
-	if (!dev_given) {
-		dev_index = verbose_device_search("0");
+		if (offset_tuning) {
+			verbose_offset_tuning(dev);
+		}
+
+		/* Set the tuner gain */
+		if (gain == AUTO_GAIN) {
+			verbose_auto_gain(dev);
+		} else {
+			verbose_gain_set(dev, nearest_gain(dev, gain));
+		}
+
+		verbose_ppm_set(dev, ppm_error);
+
+		rtlsdr_set_bias_tee(dev, enable_biastee);
+		if (enable_biastee)
+			fprintf(stderr, "activated bias-T on GPIO PIN 0\n");
 	}
 
-	if (dev_index < 0) {
-		exit(1);
+	frequency_range(freq_optarg, crop, plan_mode ? &limits : NULL);
+
+	if (tune_count == 0) {
+		usage();}
+
+	if (plan_mode == 2) {
+		free(avg_slab);
+		free(tunes);
+		exit(0);
 	}
 
-	r = rtlsdr_open(&dev, (uint32_t)dev_index);
-	if (r < 0) {
-		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
+	if ((quant_count || duty_on) && stats_init() < 0) {
+		fprintf(stderr, "Error: malloc.\n");
 		exit(1);
 	}
+
+	/* contiguous blocks of hops keep the retune steps small */
+	if (dongle_count > tune_count) {
+		fprintf(stderr, "Warning: more devices than hops, %i devices stay idle.\n", dongle_count - tune_count);}
+	for (d=0; d<dongle_count; d++) {
+		dongles[d].first = d * tune_count / dongle_count;
+		dongles[d].last = (d+1) * tune_count / dongle_count;
+		dev = dongles[d].dev;
+		if (dongle_count > 1) {
+			fprintf(stderr, "Device #%d sweeps hops %i to %i\n", dongles[d].dev_index, dongles[d].first, dongles[d].last - 1);}
+		/* Reset endpoint before we start reading from it (mandatory) */
+		verbose_reset_buffer(dev);
+		rtlsdr_set_sample_rate(dev, (uint32_t)tunes[0].rate);
+	}
 #ifndef _WIN32
 	sigact.sa_handler = sighandler;
 	sigemptyset(&sigact.sa_mask);
@@ -946,37 +2573,21 @@ int main(int argc, char **argv)
 	SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sighandler, TRUE );
 #endif
 
-	if (direct_sampling) {
-		verbose_direct_sampling(dev, 1);
-	}
-
-	/* Set direct sampling with threshold */
-	rtlsdr_set_ds_mode(dev, ds_mode, ds_threshold);
-
-	if (offset_tuning) {
-		verbose_offset_tuning(dev);
-	}
-
-	/* Set the tuner gain */
-	if (gain == AUTO_GAIN) {
-		verbose_auto_gain(dev);
-	} else {
-		gain = nearest_gain(dev, gain);
-		verbose_gain_set(dev, gain);
-	}
-
-	verbose_ppm_set(dev, ppm_error);
-
-	rtlsdr_set_bias_tee(dev, enable_biastee);
-	if (enable_biastee)
-		fprintf(stderr, "activated bias-T on GPIO PIN 0\n");
-
 	if (strcmp(filename, "-") == 0) { /* Write log to stdout */
 		file = stdout;
 #ifdef _WIN32
 		// Is this necessary?  Output is ascii.
 		_setmode(_fileno(file), _O_BINARY);
 #endif
+	} else if (out_format) {
+		/* binary files are appended to */
+		file = fopen(filename, "r+b");
+		if (!file) {
+			file = fopen(filename, "w+b");}
+		if (!file) {
+			fprintf(stderr, "Failed to open %s\n", filename);
+			exit(1);
+		}
 	} else {
 		file = fopen(filename, "wb");
 		if (!file) {
@@ -985,37 +2596,63 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/* Reset endpoint before we start reading from it (mandatory) */
-	verbose_reset_buffer(dev);
+	if (out_format && (bin_init(&bin_out, (enum bin_types)out_format, window_name) < 0 || bin_open(&bin_out, file) < 0)) {
+		fprintf(stderr, "Failed to write header to %s\n", filename);
+		exit(1);
+	}
+
+	if (events && event_init(&ev_out, event_db, MAX(0, summary), interval, dev_label) < 0) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
 
 	/* actually do stuff */
-	rtlsdr_set_sample_rate(dev, (uint32_t)tunes[0].rate);
-	sine_table(tunes[0].bin_e);
 	next_tick = time(NULL) + interval;
 	if (exit_time) {
 		exit_time = time(NULL) + exit_time;}
-	fft_buf = malloc(tunes[0].buf_len * sizeof(int16_t));
-	length = 1 << tunes[0].bin_e;
-	window_coefs = malloc(length * sizeof(int));
-	for (i=0; i<length; i++) {
-		window_coefs[i] = (int)(256*window_fn(i, length));
+	if (fft_engine == FFT_FLOAT) {
+		length = tunes[0].bin_len;
+		if (length > 1 && fft_plan_init(&fplan, length, window_fn) < 0) {
+			fprintf(stderr, "Error: no FFT plan for %i bins.\n", length);
+			exit(1);
+		}
+		fft_use_sse = cpu_has_sse2();
+		window_coefs = NULL;
+	} else {
+		sine_table(tunes[0].bin_e);
+		length = 1 << tunes[0].bin_e;
+		window_coefs = malloc(length * sizeof(int));
+		for (i=0; i<length; i++) {
+			window_coefs[i] = (int)(256*window_fn(i, length));
+		}
+	}
+	if (fft_threads < 1) {
+		fft_threads = 1;}
+	if (scan_start(fft_threads, tunes[0].buf_len, tunes[0].bin_len) < 0) {
+		fprintf(stderr, "Error: failed to start fft threads.\n");
+		exit(1);
 	}
 	while (!do_exit) {
 		scanner();
 		time_now = time(NULL);
 		if (time_now < next_tick) {
 			continue;}
-		// time, Hz low, Hz high, Hz step, samples, dbm, dbm, ...
-		cal_time = localtime(&time_now);
-		if (time_mode == VERBOSE_TIME) {
-			strftime(t_str, 512, "%Y-%m-%d, %H:%M:%S", cal_time);
-		}
-		if (time_mode == EPOCH_TIME) {
-			snprintf(t_str, 512, "%u, %s", (unsigned)time_now, dev_label);
-		}
-		for (i=0; i<tune_count; i++) {
-			fprintf(file, "%s, ", t_str);
-			csv_dbm(&tunes[i]);
+		if (events) {
+			event_interval(&ev_out, time_now);
+		} else if (out_format) {
+			if (bin_record(&bin_out, time_now) < 0) {
+				fprintf(stderr, "Failed to write record.\n");
+				do_exit = 1;
+			}
+		} else {
+			// time, Hz low, Hz high, Hz step, samples, dbm, dbm, ...
+			time_label(t_str, sizeof(t_str), time_now, dev_label);
+			for (i=0; i<tune_count; i++) {
+				fprintf(file, "%s, ", t_str);
+				csv_dbm(&tunes[i]);
+				csv_stats(&tunes[i], t_str);
+				reset_hop(&tunes[i]);
+			}
 		}
 		fflush(file);
 		while (time(NULL) >= next_tick) {
@@ -1033,16 +2670,39 @@ int main(int argc, char **argv)
 	else {
 		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);}
 
+	if (events) {
+		event_flush(&ev_out);
+		event_free(&ev_out);
+	}
+
 	if (file != stdout) {
 		fclose(file);}
 
-	rtlsdr_close(dev);
-	free(fft_buf);
+	scan_stop();
+	for (d=0; d<dongle_count; d++) {
+		if (dongles[d].retunes) {
+			fprintf(stderr, "Device #%d: %li retunes, %.1f PLL polls and %.1f extra settle blocks per retune, %li unsettled\n",
+				dongles[d].dev_index, dongles[d].retunes,
+				(double)dongles[d].pll_polls / (double)dongles[d].retunes,
+				(double)dongles[d].settle_blocks / (double)dongles[d].retunes,
+				dongles[d].unsettled);}
+		rtlsdr_close(dongles[d].dev);}
 	free(window_coefs);
-	//for (i=0; i<tune_count; i++) {
-	//	free(tunes[i].avg);
-	//	free(tunes[i].buf8);
-	//}
+	fft_plan_free(&fplan);
+	bin_free(&bin_out);
+	if (hist_slab) {
+		double low = 0.0, high = 0.0;
+		for (i=0; i<tune_count; i++) {
+			low += tunes[i].hist_low;
+			high += tunes[i].hist_high;}
+		if (low || high) {
+			fprintf(stderr, "Quantile histograms: %.0f fft bins below and %.0f above the %i dB range were clamped\n",
+				low, high, QUANT_BUCKETS);}
+	}
+	free(hist_slab);
+	free(duty_slab);
+	free(avg_slab);
+	free(tunes);
 	return r >= 0 ? r : -r;
 }
 
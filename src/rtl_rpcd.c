@@ -415,6 +415,13 @@ static const char* op_to_string(rtlsdr_rpc_op_t op)
     "RTLSDR_RPC_OP_READ_ASYNC",
     "RTLSDR_RPC_OP_CANCEL_ASYNC",
     "RTLSDR_RPC_OP_EVENT_STATE",
+    "RTLSDR_RPC_OP_SET_FINE_OFFSET",
+    "RTLSDR_RPC_OP_SET_DS_DECIMATION",
+    "RTLSDR_RPC_OP_GET_USB_STATS",
+    "RTLSDR_RPC_OP_RECALIBRATE_TUNER_FILTER",
+    "RTLSDR_RPC_OP_GET_FINE_OFFSET",
+    "RTLSDR_RPC_OP_RTLSDR_RPC_OP_GET_DELIVERED_SAMPLE_RATE",
+    "RTLSDR_RPC_OP_GET_DELIVERED_SAMPLE_RATE",
     "RTLSDR_RPC_OP_INVALID"
   };
   if (op >= RTLSDR_RPC_OP_INVALID) op = RTLSDR_RPC_OP_INVALID;
@@ -1038,6 +1045,122 @@ static int handle_query
       break ;
     }
 
+  case RTLSDR_RPC_OP_SET_FINE_OFFSET:
+    {
+      uint32_t did;
+      int32_t offset;
+
+      if (rtlsdr_rpc_msg_pop_uint32(q, &did)) goto on_error;
+      if (rtlsdr_rpc_msg_pop_int32(q, &offset)) goto on_error;
+
+      if ((rpcd->dev == NULL) || (rpcd->did != did)) goto on_error;
+
+      err = rtlsdr_set_fine_offset(rpcd->dev, offset);
+      if (err) goto on_error;
+
+      break ;
+    }
+
+  case RTLSDR_RPC_OP_SET_DS_DECIMATION:
+    {
+      uint32_t did;
+      uint32_t on;
+
+      if (rtlsdr_rpc_msg_pop_uint32(q, &did)) goto on_error;
+      if (rtlsdr_rpc_msg_pop_uint32(q, &on)) goto on_error;
+
+      if ((rpcd->dev == NULL) || (rpcd->did != did)) goto on_error;
+
+      err = rtlsdr_set_ds_decimation(rpcd->dev, (int)on);
+      if (err) goto on_error;
+
+      break ;
+    }
+
+  case RTLSDR_RPC_OP_GET_USB_STATS:
+    {
+      struct rtlsdr_usb_stats stats;
+      uint32_t did;
+      uint32_t reset;
+      uint32_t v[8];
+      size_t i;
+
+      if (rtlsdr_rpc_msg_pop_uint32(q, &did)) goto on_error;
+      if (rtlsdr_rpc_msg_pop_uint32(q, &reset)) goto on_error;
+
+      if ((rpcd->dev == NULL) || (rpcd->did != did)) goto on_error;
+
+      err = rtlsdr_get_usb_stats(rpcd->dev, &stats, (int)reset);
+      if (err) goto on_error;
+
+      v[0] = stats.ctrl_in;
+      v[1] = stats.ctrl_out;
+      v[2] = stats.ctrl_errors;
+      v[3] = stats.bulk_sync;
+      v[4] = stats.bulk_async;
+      v[5] = stats.bulk_errors;
+      v[6] = (uint32_t)stats.bulk_bytes;
+      v[7] = (uint32_t)(stats.bulk_bytes >> 32);
+
+      for (i = 0; i != sizeof(v) / sizeof(v[0]); ++i)
+      {
+	if (rtlsdr_rpc_msg_push_uint32(r, v[i]))
+	{
+	  err = -1;
+	  goto on_error;
+	}
+      }
+
+      break ;
+    }
+
+  case RTLSDR_RPC_OP_RECALIBRATE_TUNER_FILTER:
+    {
+      uint32_t did;
+
+      if (rtlsdr_rpc_msg_pop_uint32(q, &did)) goto on_error;
+
+      if ((rpcd->dev == NULL) || (rpcd->did != did)) goto on_error;
+
+      err = rtlsdr_recalibrate_tuner_filter(rpcd->dev);
+      if (err) goto on_error;
+
+      break ;
+    }
+
+  case RTLSDR_RPC_OP_GET_FINE_OFFSET:
+    {
+      uint32_t did;
+      int32_t offset;
+
+      if (rtlsdr_rpc_msg_pop_uint32(q, &did)) goto on_error;
+
+      if ((rpcd->dev == NULL) || (rpcd->did != did)) goto on_error;
+
+      offset = rtlsdr_get_fine_offset(rpcd->dev);
+      if (rtlsdr_rpc_msg_push_int32(r, offset)) goto on_error;
+      err = 0;
+
+      break ;
+    }
+
+  case RTLSDR_RPC_OP_GET_DELIVERED_SAMPLE_RATE:
+    {
+      uint32_t did;
+      uint32_t rate;
+
+      if (rtlsdr_rpc_msg_pop_uint32(q, &did)) goto on_error;
+
+      if ((rpcd->dev == NULL) || (rpcd->did != did)) goto on_error;
+
+      rate = rtlsdr_get_delivered_sample_rate(rpcd->dev);
+      if (rate == 0) goto on_error;
+      if (rtlsdr_rpc_msg_push_uint32(r, rate)) goto on_error;
+      err = 0;
+
+      break ;
+    }
+
   default:
     {
       PRINTF("invalid op: %u\n", op);
@@ -156,6 +156,7 @@ int main(int argc, char **argv)
 	uint64_t frequency = 100000000;
 	uint32_t bandwidth = DEFAULT_BANDWIDTH;
 	uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
+	uint32_t out_rate;
 	uint32_t out_block_size = DEFAULT_BUF_LENGTH;
 	int verbosity = 0;
 
@@ -285,6 +286,13 @@ int main(int argc, char **argv)
 
 	verbose_ppm_set(dev, ppm_error);
 
+	/* direct sampling decimation (LIBRTLSDR_OPT or -O dsdec=1) halves the rate */
+	out_rate = rtlsdr_get_delivered_sample_rate(dev);
+	if (out_rate && out_rate != samp_rate)
+		fprintf(stderr, "Delivered samplerate is %u Hz.\n", out_rate);
+	else
+		out_rate = samp_rate;
+
 	if(strcmp(filename, "-") == 0) { /* Write samples to stdout */
 		file = stdout;
 #ifdef _WIN32
@@ -304,7 +312,7 @@ int main(int argc, char **argv)
 			goto out;
 		}
 		if (writeWav) {
-			waveWriteHeader(samp_rate, frequency, 8, 2, file);
+			waveWriteHeader(out_rate, frequency, 8, 2, file);
 		}
 	}
 
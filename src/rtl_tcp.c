@@ -92,6 +92,7 @@ static int verbosity = 0;
 static uint32_t bandwidth = 0;
 
 static int enable_biastee = 0;
+static uint32_t client_rate = 0;
 static int global_numq = 0;
 static struct llist *ll_buffers = 0;
 static int llbuf_num = 500;
@@ -307,6 +308,24 @@ static int set_gain_by_index(rtlsdr_dev_t *_dev, unsigned int index)
 	return res;
 }
 
+/* the client expects its samplerate: compensate the direct sampling decimation */
+static int set_client_rate(rtlsdr_dev_t *_dev, uint32_t rate)
+{
+	int res = rtlsdr_set_sample_rate(_dev, rate);
+
+	client_rate = rate;
+	if (res < 0 || rtlsdr_get_delivered_sample_rate(_dev) == rate)
+		return res;
+	if (rtlsdr_set_sample_rate(_dev, 2 * rate) < 0) {
+		printf("  samplerate %u Hz not possible with ds decimation: delivering %u Hz\n",
+			2 * rate, rate / 2);
+		return rtlsdr_set_sample_rate(_dev, rate);
+	}
+	if (verbosity)
+		printf("  ds decimation: set samplerate %u Hz\n", 2 * rate);
+	return 0;
+}
+
 static void check_tuner_pll(rtlsdr_dev_t *dev, int *tuner_unsupported, int *last_lock_report)
 {
 	int r = rtlsdr_is_tuner_PLL_locked(dev);
@@ -424,7 +443,7 @@ static void *command_worker(void *arg)
 		case SET_SAMPLE_RATE:
 			tmp = ntohl(cmd.param);
 			printf("set sample rate %u\n", tmp);
-			r = rtlsdr_set_sample_rate(dev, tmp);
+			r = set_client_rate(dev, tmp);
 			if (r < 0)
 				printf("  error setting sample rate! sample rate is %u\n", rtlsdr_get_sample_rate(dev));
 			break;
@@ -478,6 +497,8 @@ static void *command_worker(void *arg)
 			r = rtlsdr_set_direct_sampling(dev, tmp);
 			if (r < 0)
 				printf("  error setting direct sampling!\n");
+			else if (client_rate)
+				set_client_rate(dev, client_rate);
 			break;
 		case SET_OFFSET_TUNING:
 			itmp = ntohl(cmd.param);
@@ -904,6 +925,13 @@ int main(int argc, char **argv)
 	/* Set direct sampling with threshold */
 	rtlsdr_set_ds_mode(dev, ds_mode, ds_threshold);
 
+	/* direct sampling decimation halves the rate, the client expects samp_rate */
+	if (rtlsdr_get_delivered_sample_rate(dev) != samp_rate) {
+		r = set_client_rate(dev, samp_rate);
+		fprintf(stderr, "Delivered samplerate is %u Hz.\n", rtlsdr_get_delivered_sample_rate(dev));
+	}
+	client_rate = samp_rate;
+
 	/* Set the frequency */
 	r = rtlsdr_set_center_freq64(dev, frequency);
 	if (r < 0)
@@ -78,7 +78,8 @@ struct time_generic
 static enum {
 	NO_BENCHMARK,
 	TUNER_BENCHMARK,
-	PPM_BENCHMARK
+	PPM_BENCHMARK,
+	API_BENCHMARK
 } test_mode = NO_BENCHMARK;
 
 static int do_exit = 0;
@@ -112,6 +113,7 @@ void usage(void)
 #ifndef _WIN32
 		"\t[-p[seconds] enable PPM error measurement (default: 10 seconds)]\n"
 #endif
+		"\t[-c count USB control transfers and time per API call]\n"
 		"\t[-b output_block_size (default: 16 * 16384)]\n"
 		"\t[-S force sync output (default: async)]\n"
 		, rtlsdr_get_opt_help(1) );
@@ -501,6 +503,52 @@ void tuner_benchmark(uint32_t beg_freq, uint32_t end_freq)
 		report_band(band_start, low_bound);
 }
 
+static void api_report(const char *call, int rc, const struct time_generic *start)
+{
+	struct rtlsdr_usb_stats stats;
+	struct time_generic now;
+	double ms;
+
+	memset(&now, 0, sizeof(now));
+	ppm_gettime(&now);
+	ms = (now.tv_sec - start->tv_sec) * 1E3 + (now.tv_nsec - start->tv_nsec) * 1E-6;
+	rtlsdr_get_usb_stats(dev, &stats, 1);
+	fprintf(stderr, "%-40s rc %4d: %4u ctrl in, %4u ctrl out, %2u errors, %8.3f ms\n",
+		call, rc, (unsigned)stats.ctrl_in, (unsigned)stats.ctrl_out,
+		(unsigned)stats.ctrl_errors, ms);
+}
+
+#define API_BENCH(CALL) \
+	do { \
+		struct time_generic start; \
+		int rc; \
+		memset(&start, 0, sizeof(start)); \
+		ppm_gettime(&start); \
+		rc = CALL; \
+		api_report(#CALL, rc, &start); \
+	} while (0)
+
+void api_benchmark(int gain)
+{
+	fprintf(stderr, "Counting control transfers per API call..\n");
+	rtlsdr_get_usb_stats(dev, NULL, 1);
+
+	API_BENCH(rtlsdr_set_sample_rate(dev, samp_rate));
+	API_BENCH(rtlsdr_set_center_freq(dev, MHZ(100)));
+	API_BENCH(rtlsdr_set_center_freq(dev, MHZ(100) + 12500));
+	API_BENCH(rtlsdr_set_center_freq(dev, MHZ(433)));
+	API_BENCH(rtlsdr_set_center_freq(dev, MHZ(1090)));
+	API_BENCH(rtlsdr_set_fine_offset(dev, 12500));
+	API_BENCH(rtlsdr_set_fine_offset(dev, 0));
+	API_BENCH(rtlsdr_set_tuner_gain_mode(dev, 1));
+	API_BENCH(rtlsdr_set_tuner_gain(dev, gain));
+	API_BENCH(rtlsdr_set_tuner_gain_mode(dev, 0));
+	API_BENCH(rtlsdr_set_tuner_bandwidth(dev, 0));
+	API_BENCH(rtlsdr_set_agc_mode(dev, 0));
+	API_BENCH(rtlsdr_is_tuner_PLL_locked(dev));
+	API_BENCH(rtlsdr_reset_buffer(dev));
+}
+
 int main(int argc, char **argv)
 {
 #ifndef _WIN32
@@ -518,7 +566,7 @@ int main(int argc, char **argv)
 	int count;
 	int gains[100];
 
-	while ((opt = getopt(argc, argv, "d:s:b:O:tf:e:p::Sh")) != -1) {
+	while ((opt = getopt(argc, argv, "d:s:b:O:tf:e:p::cSh")) != -1) {
 		switch (opt) {
 		case 'd':
 			dev_index = verbose_device_search(optarg);
@@ -547,6 +595,9 @@ int main(int argc, char **argv)
 			if (optarg)
 				ppm_duration = atoi(optarg);
 			break;
+		case 'c':
+			test_mode = API_BENCHMARK;
+			break;
 		case 'S':
 			sync_mode = 1;
 			break;
@@ -615,6 +666,11 @@ int main(int argc, char **argv)
 		goto exit;
 	}
 
+	if (test_mode == API_BENCHMARK) {
+		api_benchmark(count > 0 ? gains[count / 2] : 0);
+		goto exit;
+	}
+
 	/* Enable test mode */
 	r = rtlsdr_set_testmode(dev, 1);
 
@@ -662,6 +718,14 @@ int main(int argc, char **argv)
 	else
 		fprintf(stderr, "\nLibrary error %d after %u buffers, exiting...\n", r, (unsigned)bufferNo);
 
+	{
+		struct rtlsdr_usb_stats stats;
+		if (!rtlsdr_get_usb_stats(dev, &stats, 0))
+			fprintf(stderr, "USB bulk transfers: %u sync, %u async, %u failed, %.1f MB received\n",
+				(unsigned)stats.bulk_sync, (unsigned)stats.bulk_async,
+				(unsigned)stats.bulk_errors, stats.bulk_bytes * 1E-6);
+	}
+
 exit:
 	rtlsdr_close(dev);
 	free (buffer);
@@ -0,0 +1,409 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ * rtl_usb_emu, exercises librtlsdr against the emulated dongle of usb_emu.c
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <rtl-sdr.h>
+#include "usb_emu/usb_emu.h"
+
+#define DEFAULT_SAMPLE_RATE		2048000
+#define DEFAULT_BUF_LENGTH		(16 * 16384)
+#define DEFAULT_BUF_NUMBER		15
+
+#define MHZ(x)					((x)*1000*1000)
+
+#define STALL_TIMEOUT			3.0
+
+static rtlsdr_dev_t *dev = NULL;
+static int failures = 0;
+
+struct async_run {
+	uint32_t buffers;		/* cancel after this many callbacks */
+	int from_thread;		/* .. from a second thread, not from the callback */
+	uint32_t callbacks;
+	uint32_t late;			/* callbacks after rtlsdr_cancel_async() */
+	uint64_t bytes;
+	int retune;				/* retune from a second thread while streaming */
+	int stop;
+	int stalled;			/* no data for STALL_TIMEOUT: cancelled by the watchdog */
+	uint32_t retunes;
+	double t_cancel;
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+void usage(void)
+{
+	fprintf(stderr,
+		"rtl_usb_emu, runs librtlsdr against an emulated RTL2832U/R820T\n"
+		"  - no dongle needed: libusb is replaced by usb_emu.c\n\n"
+		"Usage:\n"
+		"\t[-s samplerate (default: 2048000 Hz)]\n"
+		"\t[-b output_block_size (default: 16 * 16384)]\n"
+		"\t[-n buffers per streaming run (default: 20)]\n"
+		"\t[-R number of read_async/cancel cycles (default: 6)]\n"
+		"\t[-r emulated data rate in samples/s (default: 0 = programmed rate, -1 = unthrottled)]\n"
+		"\t[-e fail every n-th bulk transfer in the error run (default: 7)]\n"
+		"\t[-g tuner gain in tenth dB for the manual gain run (default: 200)]\n"
+		"exit code is the number of failed checks\n");
+	exit(1);
+}
+
+static void check(int ok, const char *what)
+{
+	if (ok)
+		return;
+	++failures;
+	fprintf(stderr, "FAILED: %s\n", what);
+}
+
+/* control transfers of one API call, counted by librtlsdr and by the device */
+static void api_report(const char *call, int rc, double start)
+{
+	struct rtlsdr_usb_stats stats;
+	struct usb_emu_stats emu;
+
+	rtlsdr_get_usb_stats(dev, &stats, 1);
+	usb_emu_get_stats(&emu, 1);
+	fprintf(stderr, "%-44s rc %4d: %4u ctrl in, %4u ctrl out, %3u i2c, %2u errors, %8.3f ms\n",
+		call, rc, (unsigned)stats.ctrl_in, (unsigned)stats.ctrl_out,
+		(unsigned)(emu.i2c_in + emu.i2c_out), (unsigned)stats.ctrl_errors,
+		(now_s() - start) * 1E3);
+	check(stats.ctrl_in == emu.ctrl_in && stats.ctrl_out == emu.ctrl_out
+		&& stats.ctrl_errors == emu.ctrl_errors,
+		"librtlsdr and device disagree on the control transfer count");
+}
+
+#define API_CALL(CALL) \
+	do { \
+		double start = now_s(); \
+		int rc = CALL; \
+		api_report(#CALL, rc, start); \
+	} while (0)
+
+static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+	struct async_run *run = (struct async_run *)ctx;
+
+	if (run->t_cancel > 0.0)
+		++run->late;
+	++run->callbacks;
+	run->bytes += len;
+	if (!run->from_thread && run->callbacks == run->buffers) {
+		run->t_cancel = now_s();
+		rtlsdr_cancel_async(dev);
+	}
+}
+
+/* retunes, cancels and watches the stream while rtlsdr_read_async() runs */
+static void *control_thread(void *arg)
+{
+	struct async_run *run = (struct async_run *)arg;
+	uint32_t f = MHZ(100);
+	uint32_t seen = 0;
+	double t_seen = now_s();
+
+	while (!run->stop) {
+		if (run->retune && run->t_cancel == 0.0) {
+			f = (f == MHZ(100)) ? MHZ(433) : MHZ(100);
+			rtlsdr_set_center_freq(dev, f);
+			++run->retunes;
+		}
+		usleep(2000);
+		if (run->from_thread && run->t_cancel == 0.0 && run->callbacks >= run->buffers) {
+			run->t_cancel = now_s();
+			rtlsdr_cancel_async(dev);
+		}
+		if (run->callbacks != seen) {
+			seen = run->callbacks;
+			t_seen = now_s();
+		} else if (!run->stalled && now_s() - t_seen > STALL_TIMEOUT) {
+			run->stalled = 1;
+			rtlsdr_cancel_async(dev);
+		}
+	}
+	return NULL;
+}
+
+/* one rtlsdr_read_async() session, cancelled from the callback or from a thread */
+static int async_run(struct async_run *run, uint32_t buf_len)
+{
+	pthread_t thread;
+	int r;
+
+	run->callbacks = 0;
+	run->late = 0;
+	run->bytes = 0;
+	run->stop = 0;
+	run->stalled = 0;
+	run->retunes = 0;
+	run->t_cancel = 0.0;
+	rtlsdr_reset_buffer(dev);
+	pthread_create(&thread, NULL, control_thread, run);
+	r = rtlsdr_read_async(dev, rtlsdr_callback, run, DEFAULT_BUF_NUMBER, buf_len);
+	run->stop = 1;
+	pthread_join(thread, NULL);
+	if (run->stalled)
+		fprintf(stderr, "stream stalled after %u buffers\n", (unsigned)run->callbacks);
+	return r;
+}
+
+static void bench_api(uint32_t samp_rate, int gain)
+{
+	fprintf(stderr, "\nControl transfers per API call:\n");
+	API_CALL(rtlsdr_set_sample_rate(dev, samp_rate));
+	API_CALL(rtlsdr_set_center_freq(dev, MHZ(100)));
+	API_CALL(rtlsdr_set_center_freq(dev, MHZ(100) + 12500));
+	API_CALL(rtlsdr_set_center_freq(dev, MHZ(433)));
+	API_CALL(rtlsdr_set_center_freq(dev, MHZ(1090)));
+	API_CALL(rtlsdr_set_fine_offset(dev, 12500));
+	API_CALL(rtlsdr_set_fine_offset(dev, 0));
+	API_CALL(rtlsdr_set_freq_correction(dev, 20));
+	API_CALL(rtlsdr_set_tuner_gain_mode(dev, 1));
+	API_CALL(rtlsdr_set_tuner_gain(dev, gain));
+	API_CALL(rtlsdr_set_tuner_gain_mode(dev, 0));
+	API_CALL(rtlsdr_set_tuner_bandwidth(dev, 0));
+	API_CALL(rtlsdr_set_agc_mode(dev, 0));
+	API_CALL(rtlsdr_is_tuner_PLL_locked(dev));
+	API_CALL(rtlsdr_reset_buffer(dev));
+}
+
+static void bench_sync(uint32_t buf_len, uint32_t buffers)
+{
+	struct rtlsdr_usb_stats stats;
+	struct usb_emu_stats emu;
+	uint8_t *buffer = malloc(buf_len);
+	uint32_t i;
+	int n_read, r = 0;
+	double start;
+
+	rtlsdr_reset_buffer(dev);
+	rtlsdr_get_usb_stats(dev, NULL, 1);
+	usb_emu_get_stats(NULL, 1);
+	start = now_s();
+	for (i = 0; buffer && i < buffers; i++) {
+		r = rtlsdr_read_sync(dev, buffer, buf_len, &n_read);
+		if (r < 0 || (uint32_t)n_read != buf_len)
+			break;
+	}
+	rtlsdr_get_usb_stats(dev, &stats, 1);
+	usb_emu_get_stats(&emu, 1);
+	fprintf(stderr, "read_sync:  %u buffers, %.3f MS/s\n", (unsigned)stats.bulk_sync,
+		stats.bulk_bytes / 2E6 / (now_s() - start));
+	check(i == buffers, "rtlsdr_read_sync() did not deliver all buffers");
+	check(stats.bulk_bytes == emu.bulk_bytes, "librtlsdr and device disagree on the bulk bytes");
+	free(buffer);
+}
+
+static void bench_async(uint32_t buf_len, uint32_t buffers, int cycles)
+{
+	struct async_run run;
+	struct rtlsdr_usb_stats stats;
+	struct usb_emu_stats emu;
+	double start, lat, max_lat = 0.0, sum_lat = 0.0;
+	uint64_t bytes = 0;
+	uint32_t late = 0;
+	int i, r;
+
+	rtlsdr_get_usb_stats(dev, NULL, 1);
+	usb_emu_get_stats(NULL, 1);
+	start = now_s();
+	for (i = 0; i < cycles; i++) {
+		memset(&run, 0, sizeof(run));
+		/* every other cycle cancels from a second thread */
+		run.buffers = buffers;
+		run.from_thread = i & 1;
+		r = async_run(&run, buf_len);
+		lat = now_s() - run.t_cancel;
+		sum_lat += lat;
+		if (lat > max_lat)
+			max_lat = lat;
+		bytes += run.bytes;
+		late += run.late;
+		check(r == 0 && !run.stalled, "rtlsdr_read_async() returned an error or stalled");
+		check(run.callbacks >= run.buffers, "rtlsdr_read_async() ended before the cancel");
+	}
+	rtlsdr_get_usb_stats(dev, &stats, 1);
+	usb_emu_get_stats(&emu, 1);
+	fprintf(stderr, "read_async: %d cycles, %u transfers, %.3f MS/s, cancel latency %.3f ms mean, %.3f ms max\n",
+		cycles, (unsigned)stats.bulk_async, bytes / 2E6 / (now_s() - start),
+		sum_lat * 1E3 / cycles, max_lat * 1E3);
+	fprintf(stderr, "            %u cancelled in flight, %u callbacks after the cancel, at most %u queued\n",
+		(unsigned)emu.bulk_cancelled, (unsigned)late, (unsigned)emu.max_queued);
+	check(stats.bulk_bytes == emu.bulk_bytes, "librtlsdr and device disagree on the bulk bytes");
+	check(stats.bulk_async == emu.bulk_completed, "librtlsdr and device disagree on the bulk transfers");
+}
+
+static void bench_retune(uint32_t buf_len, uint32_t buffers)
+{
+	struct async_run run;
+	struct rtlsdr_usb_stats stats;
+	int r;
+
+	memset(&run, 0, sizeof(run));
+	run.buffers = buffers;
+	run.retune = 1;
+	rtlsdr_get_usb_stats(dev, NULL, 1);
+	r = async_run(&run, buf_len);
+	rtlsdr_get_usb_stats(dev, &stats, 1);
+	fprintf(stderr, "retune:     %u retunes while streaming, %.1f ctrl transfers each, %u buffers\n",
+		(unsigned)run.retunes, run.retunes ? (double)(stats.ctrl_in + stats.ctrl_out) / run.retunes : 0.0,
+		(unsigned)run.callbacks);
+	check(r == 0 && !run.stalled && run.callbacks >= buffers, "streaming stalled while retuning");
+	check(!stats.ctrl_errors, "control transfer errors while retuning");
+	rtlsdr_set_center_freq(dev, MHZ(100));
+}
+
+static void bench_softagc(uint32_t buf_len, uint32_t buffers)
+{
+	struct async_run run;
+	struct usb_emu_stats emu;
+	int r, gain_before;
+
+	rtlsdr_set_opt_string(dev, "softagc=1", 0);
+	usb_emu_get_stats(&emu, 1);
+	gain_before = emu.gain;
+	memset(&run, 0, sizeof(run));
+	run.buffers = buffers;
+	r = async_run(&run, buf_len);
+	usb_emu_get_stats(&emu, 1);
+	fprintf(stderr, "softagc:    tuner gain %.1f -> %.1f dB, %u of %u buffers delivered, %u overloaded\n",
+		gain_before * 0.1, emu.gain * 0.1, (unsigned)run.callbacks,
+		(unsigned)emu.bulk_completed, (unsigned)emu.clipped);
+	check(r == 0 && !run.stalled, "rtlsdr_read_async() with softagc returned an error or stalled");
+	rtlsdr_set_opt_string(dev, "softagc=0", 0);
+}
+
+static void bench_errors(uint32_t buf_len, uint32_t buffers, unsigned every)
+{
+	struct usb_emu_config cfg, saved;
+	struct async_run run;
+	struct rtlsdr_usb_stats stats;
+	struct usb_emu_stats emu;
+	int r;
+
+	usb_emu_get_config(&saved);
+	cfg = saved;
+	cfg.bulk_error_every = every;
+	usb_emu_set_config(&cfg);
+	rtlsdr_get_usb_stats(dev, NULL, 1);
+	usb_emu_get_stats(NULL, 1);
+	memset(&run, 0, sizeof(run));
+	run.buffers = buffers;
+	r = async_run(&run, buf_len);
+	rtlsdr_get_usb_stats(dev, &stats, 1);
+	usb_emu_get_stats(&emu, 1);
+	fprintf(stderr, "errors:     every %u. transfer fails: %u errors counted, %u injected, %u buffers\n",
+		every, (unsigned)stats.bulk_errors, (unsigned)emu.bulk_errors, (unsigned)run.callbacks);
+	check(r == 0 && !run.stalled && run.callbacks >= buffers, "streaming did not survive sporadic bulk errors");
+	check(stats.bulk_errors == emu.bulk_errors, "librtlsdr and device disagree on the bulk errors");
+
+	/* all transfers fail: librtlsdr has to give up and cancel by itself */
+	cfg.bulk_error_every = 1;
+	usb_emu_set_config(&cfg);
+	memset(&run, 0, sizeof(run));
+	run.buffers = buffers;
+	r = async_run(&run, buf_len);
+	fprintf(stderr, "errors:     every transfer fails: rtlsdr_read_async() returned %d after %u buffers\n",
+		r, (unsigned)run.callbacks);
+	check(run.callbacks == 0 && !run.stalled, "librtlsdr did not give up on a dead device");
+	usb_emu_set_config(&saved);
+}
+
+int main(int argc, char **argv)
+{
+	struct usb_emu_config cfg;
+	uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
+	uint32_t buf_len = DEFAULT_BUF_LENGTH;
+	uint32_t buffers = 20;
+	unsigned error_every = 7;
+	int cycles = 6;
+	int gain = 200;
+	int opt, r;
+	double start;
+
+	usb_emu_get_config(&cfg);
+	while ((opt = getopt(argc, argv, "s:b:n:R:r:e:g:h")) != -1) {
+		switch (opt) {
+		case 's':
+			samp_rate = (uint32_t)atof(optarg);
+			break;
+		case 'b':
+			buf_len = (uint32_t)atof(optarg);
+			break;
+		case 'n':
+			buffers = (uint32_t)atoi(optarg);
+			break;
+		case 'R':
+			cycles = atoi(optarg);
+			break;
+		case 'r':
+			cfg.rate = atol(optarg);
+			break;
+		case 'e':
+			error_every = (unsigned)atoi(optarg);
+			break;
+		case 'g':
+			gain = atoi(optarg);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	if (buf_len < 512 || buf_len % 512 || !buffers || cycles < 1 || error_every < 2)
+		usage();
+	usb_emu_set_config(&cfg);
+
+	usb_emu_get_stats(NULL, 1);
+	start = now_s();
+	r = rtlsdr_open(&dev, 0);
+	if (r < 0) {
+		fprintf(stderr, "Failed to open emulated rtlsdr device (%d).\n", r);
+		return 1;
+	}
+	/* librtlsdr starts counting at rtlsdr_open() */
+	api_report("rtlsdr_open(&dev, 0)", r, start);
+
+	bench_api(samp_rate, gain);
+	rtlsdr_set_center_freq(dev, MHZ(100));
+	rtlsdr_set_tuner_gain_mode(dev, 1);
+	rtlsdr_set_tuner_gain(dev, gain);
+
+	fprintf(stderr, "\nData path:\n");
+	bench_sync(buf_len, buffers);
+	bench_async(buf_len, buffers, cycles);
+	bench_retune(buf_len, buffers);
+	bench_softagc(buf_len, buffers);
+	bench_errors(buf_len, buffers, error_every);
+
+	rtlsdr_close(dev);
+	fprintf(stderr, "\n%d failed checks\n", failures);
+	return failures;
+}
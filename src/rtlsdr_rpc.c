@@ -15,6 +15,7 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include "rtlsdr_rpc_msg.h"
+#include "rtl-sdr.h"
 
 
 #if 1
@@ -1362,6 +1363,174 @@ int rtlsdr_rpc_cancel_async(void* devp)
   return 0;
 }
 
+int rtlsdr_rpc_set_fine_offset(void* devp, int32_t offset)
+{
+  rtlsdr_rpc_dev_t* const dev = devp;
+  rtlsdr_rpc_cli_t* const cli = dev->cli;
+  rtlsdr_rpc_msg_t* q;
+  rtlsdr_rpc_msg_t* r;
+  int err = -1;
+
+  if (alloc_qr(cli, &q, &r)) goto on_error_0;
+
+  rtlsdr_rpc_msg_set_op(q, RTLSDR_RPC_OP_SET_FINE_OFFSET);
+  if (rtlsdr_rpc_msg_push_uint32(q, dev->index)) goto on_error_1;
+  if (rtlsdr_rpc_msg_push_int32(q, offset)) goto on_error_1;
+
+  if (send_recv_msg(cli, q, r)) goto on_error_1;
+
+  err = rtlsdr_rpc_msg_get_err(r);
+
+ on_error_1:
+  free_qr(cli, q, r);
+ on_error_0:
+  return err;
+}
+
+int rtlsdr_rpc_set_ds_decimation(void* devp, int on)
+{
+  rtlsdr_rpc_dev_t* const dev = devp;
+  rtlsdr_rpc_cli_t* const cli = dev->cli;
+  rtlsdr_rpc_msg_t* q;
+  rtlsdr_rpc_msg_t* r;
+  int err = -1;
+
+  if (alloc_qr(cli, &q, &r)) goto on_error_0;
+
+  rtlsdr_rpc_msg_set_op(q, RTLSDR_RPC_OP_SET_DS_DECIMATION);
+  if (rtlsdr_rpc_msg_push_uint32(q, dev->index)) goto on_error_1;
+  if (rtlsdr_rpc_msg_push_uint32(q, (uint32_t)on)) goto on_error_1;
+
+  if (send_recv_msg(cli, q, r)) goto on_error_1;
+
+  err = rtlsdr_rpc_msg_get_err(r);
+
+ on_error_1:
+  free_qr(cli, q, r);
+ on_error_0:
+  return err;
+}
+
+int rtlsdr_rpc_get_usb_stats
+(void* devp, struct rtlsdr_usb_stats* stats, int reset)
+{
+  rtlsdr_rpc_dev_t* const dev = devp;
+  rtlsdr_rpc_cli_t* const cli = dev->cli;
+  rtlsdr_rpc_msg_t* q;
+  rtlsdr_rpc_msg_t* r;
+  uint32_t v[8];
+  size_t i;
+  int err = -1;
+
+  if (alloc_qr(cli, &q, &r)) goto on_error_0;
+
+  rtlsdr_rpc_msg_set_op(q, RTLSDR_RPC_OP_GET_USB_STATS);
+  if (rtlsdr_rpc_msg_push_uint32(q, dev->index)) goto on_error_1;
+  if (rtlsdr_rpc_msg_push_uint32(q, (uint32_t)reset)) goto on_error_1;
+
+  if (send_recv_msg(cli, q, r)) goto on_error_1;
+
+  err = rtlsdr_rpc_msg_get_err(r);
+  if (err) goto on_error_1;
+
+  /* the counters of the daemon side device, bulk_bytes as low/high word */
+  for (i = 0; i != sizeof(v) / sizeof(v[0]); ++i)
+  {
+    if (rtlsdr_rpc_msg_pop_uint32(r, &v[i]))
+    {
+      err = -1;
+      goto on_error_1;
+    }
+  }
+
+  if (stats != NULL)
+  {
+    stats->ctrl_in = v[0];
+    stats->ctrl_out = v[1];
+    stats->ctrl_errors = v[2];
+    stats->bulk_sync = v[3];
+    stats->bulk_async = v[4];
+    stats->bulk_errors = v[5];
+    stats->bulk_bytes = ((uint64_t)v[7] << 32) | v[6];
+  }
+
+ on_error_1:
+  free_qr(cli, q, r);
+ on_error_0:
+  return err;
+}
+
+int rtlsdr_rpc_recalibrate_tuner_filter(void* devp)
+{
+  rtlsdr_rpc_dev_t* const dev = devp;
+  rtlsdr_rpc_cli_t* const cli = dev->cli;
+  rtlsdr_rpc_msg_t* q;
+  rtlsdr_rpc_msg_t* r;
+  int err = -1;
+
+  if (alloc_qr(cli, &q, &r)) goto on_error_0;
+
+  rtlsdr_rpc_msg_set_op(q, RTLSDR_RPC_OP_RECALIBRATE_TUNER_FILTER);
+  if (rtlsdr_rpc_msg_push_uint32(q, dev->index)) goto on_error_1;
+
+  if (send_recv_msg(cli, q, r)) goto on_error_1;
+
+  err = rtlsdr_rpc_msg_get_err(r);
+
+ on_error_1:
+  free_qr(cli, q, r);
+ on_error_0:
+  return err;
+}
+
+int32_t rtlsdr_rpc_get_fine_offset(void* devp)
+{
+  rtlsdr_rpc_dev_t* const dev = devp;
+  rtlsdr_rpc_cli_t* const cli = dev->cli;
+  rtlsdr_rpc_msg_t* q;
+  rtlsdr_rpc_msg_t* r;
+  int32_t offset = 0;
+
+  if (alloc_qr(cli, &q, &r)) goto on_error_0;
+
+  rtlsdr_rpc_msg_set_op(q, RTLSDR_RPC_OP_GET_FINE_OFFSET);
+  if (rtlsdr_rpc_msg_push_uint32(q, dev->index)) goto on_error_1;
+
+  if (send_recv_msg(cli, q, r)) goto on_error_1;
+
+  if (rtlsdr_rpc_msg_get_err(r)) goto on_error_1;
+  if (rtlsdr_rpc_msg_pop_int32(r, &offset)) goto on_error_1;
+
+ on_error_1:
+  free_qr(cli, q, r);
+ on_error_0:
+  return offset;
+}
+
+uint32_t rtlsdr_rpc_get_delivered_sample_rate(void* devp)
+{
+  rtlsdr_rpc_dev_t* const dev = devp;
+  rtlsdr_rpc_cli_t* const cli = dev->cli;
+  rtlsdr_rpc_msg_t* q;
+  rtlsdr_rpc_msg_t* r;
+  uint32_t rate = 0;
+
+  if (alloc_qr(cli, &q, &r)) goto on_error_0;
+
+  rtlsdr_rpc_msg_set_op(q, RTLSDR_RPC_OP_GET_DELIVERED_SAMPLE_RATE);
+  if (rtlsdr_rpc_msg_push_uint32(q, dev->index)) goto on_error_1;
+
+  if (send_recv_msg(cli, q, r)) goto on_error_1;
+
+  if (rtlsdr_rpc_msg_get_err(r)) goto on_error_1;
+  if (rtlsdr_rpc_msg_pop_uint32(r, &rate)) goto on_error_1;
+
+ on_error_1:
+  free_qr(cli, q, r);
+ on_error_0:
+  return rate;
+}
+
 unsigned int rtlsdr_rpc_is_enabled(void)
 {
   static unsigned int is_enabled = (unsigned int)-1;
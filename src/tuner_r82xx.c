@@ -1246,15 +1246,77 @@ static int r82xx_sysfreq_sel(struct r82xx_priv *priv,
 	 return 0;
 }
 
+/*
+ * Run the filter calibration at the current PLL default frequency and
+ * store the result in priv->fil_cal_code. Returns 1 when the tuner
+ * delivered a plausible code, 0 when both attempts failed.
+ */
+static int r82xx_calibrate_filter(struct r82xx_priv *priv,
+				 enum r82xx_tuner_type type, uint8_t filt_q)
+{
+	int rc, i;
+	uint8_t data[5];
+	int cal_ok = 0;
+
+	for (i = 0; i < 2; i++) {
+
+		/* set cali clk =on */
+		rc = r82xx_write_reg_mask(priv, 0x0f, 0x04, 0x04);
+		if (rc < 0)
+			return rc;
+
+		priv->tuner_pll_set = 0;
+		rc = r82xx_set_pll(priv, priv->rf_freq);
+		if (rc < 0 || !priv->has_lock) {
+			priv->fil_cal_valid = 0;
+			return rc;
+		}
+
+		/* Start Trigger */
+		rc = r82xx_write_reg_mask_ext(priv, 0x0b, 0x10, 0x10, __FUNCTION__);
+		if (rc < 0)
+			return rc;
+
+		/* Stop Trigger */
+		rc = r82xx_write_reg_mask_ext(priv, 0x0b, 0x00, 0x10, __FUNCTION__);
+		if (rc < 0)
+			return rc;
+
+		/* set cali clk =off */
+		rc = r82xx_write_reg_mask(priv, 0x0f, 0x00, 0x04);
+		if (rc < 0)
+			return rc;
+
+		/* Check if calibration worked */
+		rc = r82xx_read(priv, 0x00, data, sizeof(data));
+		if (rc < 0)
+			return rc;
+
+		priv->fil_cal_code = data[4] & 0x0f;
+		if (priv->fil_cal_code && priv->fil_cal_code != 0x0f) {
+			cal_ok = 1;
+			break;
+		}
+	}
+	/* narrowest */
+	if (priv->fil_cal_code == 0x0f)
+		priv->fil_cal_code = 0;
+
+	/* remember the code only if it is trustworthy */
+	priv->fil_cal_valid = cal_ok;
+	priv->fil_cal_type = type;
+	priv->fil_cal_xtal = priv->cfg->xtal;
+	priv->fil_cal_q = filt_q;
+	return cal_ok;
+}
+
 static int r82xx_set_tv_standard(struct r82xx_priv *priv,
 				 enum r82xx_tuner_type type,
 				 uint32_t delsys)
 
 {
-	int rc, i;
-	uint8_t data[5];
-
-	int need_calibration = 1;
+	int rc;
+	int need_calibration;
 
 	/* BW < 6 MHz */
 	uint8_t filt_q = 0x10;		/* r10[4]:low q(1'b1) */
@@ -1270,49 +1332,20 @@ static int r82xx_set_tv_standard(struct r82xx_priv *priv,
 	priv->int_freq = 3570 * 1000;
 	priv->sideband = 0;
 
-	/* Check if standard changed. If so, filter calibration is needed */
-	/* as we call this function only once in rtlsdr, force calibration */
+	/* The filter calibration code only depends on standard, xtal and
+	 * filter Q. Reuse a previous result for the same configuration,
+	 * e.g. when the tuner is re-initialized after direct sampling.
+	 * r82xx_recalibrate_filter() or a PLL lock failure drop the cache.
+	 */
+	need_calibration = !( priv->fil_cal_valid
+		&& priv->fil_cal_type == type
+		&& priv->fil_cal_xtal == priv->cfg->xtal
+		&& priv->fil_cal_q == filt_q );
 
 	if (need_calibration) {
-		for (i = 0; i < 2; i++) {
-
-			/* set cali clk =on */
-			rc = r82xx_write_reg_mask(priv, 0x0f, 0x04, 0x04);
-			if (rc < 0)
-				return rc;
-
-			priv->tuner_pll_set = 0;
-			rc = r82xx_set_pll(priv, priv->rf_freq);
-			if (rc < 0 || !priv->has_lock)
-				return rc;
-
-			/* Start Trigger */
-			rc = r82xx_write_reg_mask_ext(priv, 0x0b, 0x10, 0x10, __FUNCTION__);
-			if (rc < 0)
-				return rc;
-
-			/* Stop Trigger */
-			rc = r82xx_write_reg_mask_ext(priv, 0x0b, 0x00, 0x10, __FUNCTION__);
-			if (rc < 0)
-				return rc;
-
-			/* set cali clk =off */
-			rc = r82xx_write_reg_mask(priv, 0x0f, 0x00, 0x04);
-			if (rc < 0)
-				return rc;
-
-			/* Check if calibration worked */
-			rc = r82xx_read(priv, 0x00, data, sizeof(data));
-			if (rc < 0)
-				return rc;
-
-			priv->fil_cal_code = data[4] & 0x0f;
-			if (priv->fil_cal_code && priv->fil_cal_code != 0x0f)
-				break;
-		}
-		/* narrowest */
-		if (priv->fil_cal_code == 0x0f)
-			priv->fil_cal_code = 0;
+		rc = r82xx_calibrate_filter(priv, type, filt_q);
+		if (rc < 0 || !priv->has_lock)
+			return rc;
 	}
 
 	rc = r82xx_write_reg_mask_ext(priv, 0x0a,
@@ -1328,6 +1361,36 @@ static int r82xx_set_tv_standard(struct r82xx_priv *priv,
 	return 0;
 }
 
+int r82xx_recalibrate_filter(struct r82xx_priv *priv)
+{
+	int rc, cal_rc;
+	uint64_t freq = priv->rf_freq;
+	uint8_t filt_q = priv->fil_cal_q ? priv->fil_cal_q : 0x10;
+
+	priv->fil_cal_valid = 0;
+	if (!priv->init_done)
+		return 0;	/* next r82xx_init() calibrates */
+
+	priv->rf_freq = 56000 * 1000;
+	cal_rc = r82xx_calibrate_filter(priv, priv->type, filt_q);
+	if (cal_rc >= 0 && priv->has_lock) {
+		rc = r82xx_write_reg_mask_ext(priv, 0x0a,
+					  filt_q | priv->fil_cal_code, 0x1f, __FUNCTION__);
+		if (rc < 0)
+			cal_rc = rc;
+	}
+
+	/* restore the previous tuning */
+	priv->rf_freq = freq;
+	if (freq) {
+		priv->tuner_pll_set = 0;
+		rc = r82xx_set_freq64(priv, freq);
+		if (rc < 0)
+			return rc;
+	}
+	return (cal_rc < 0) ? cal_rc : 0;
+}
+
 /* measured with a Racal 6103E GSM test set at 928 MHz with -60 dBm
  * input power, for raw results see:
  * http://steve-m.de/projects/rtl-sdr/gain_measurement/r820t/
@@ -2011,6 +2074,8 @@ int r82xx_set_freq64(struct r82xx_priv *priv, uint64_t freq)
 		{
 			if ( !nth_harm && lo_freq > RETRY_WITH_FIFTH_HARM_KHZ * 1000 )
 				continue;
+			/* don't trust the cached filter calibration anymore */
+			priv->fil_cal_valid = 0;
 			goto err;
 		}
 
@@ -0,0 +1,690 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ * usb_emu, replacement of the libusb functions used by librtlsdr:
+ * emulates one RTL2832U with an R820T tuner - no dongle needed
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <libusb.h>
+
+#include "usb_emu.h"
+
+/* the project builds with -fvisibility=hidden: keep the libusb symbols
+ * visible for the LD_PRELOAD module */
+#if defined(__GNUC__) && !defined(_WIN32)
+#define EMU_API __attribute__((visibility("default")))
+#else
+#define EMU_API
+#endif
+
+#define EMU_VID			0x0bda
+#define EMU_PID			0x2838
+#define EMU_XTAL		28800000.0
+
+/* control transfer addressing, see rtlsdr_read_array() & co in librtlsdr.c */
+#define SYSB			2
+#define IRB				5
+#define IICB			6
+#define NUM_BLOCKS		8
+
+#define R820T_ADDR		0x34
+#define EEPROM_ADDR		0xa0
+#define TUNER_REGS		32
+#define TUNER_RO_REGS	5
+
+/* cumulative gain steps in tenth dB, as in tuner_r82xx.c */
+static const int lna_steps[16] = {
+	0, 9, 13, 40, 38, 13, 31, 22, 26, 31, 26, 14, 19, 5, 35, 13
+};
+static const int mixer_steps[16] = {
+	0, 5, 10, 10, 19, 9, 10, 25, 17, 10, 8, 16, 13, 6, 3, -8
+};
+static const int vga_steps[16] = {
+	0, 26, 26, 30, 42, 35, 24, 13, 14, 32, 36, 34, 35, 37, 35, 36
+};
+
+struct libusb_context {
+	int unused;
+};
+
+struct libusb_device {
+	int unused;
+};
+
+struct libusb_device_handle {
+	struct libusb_device *dev;
+};
+
+struct emu_pending {
+	struct libusb_transfer *xfer;
+	int cancelled;
+};
+
+static struct libusb_context emu_ctx;
+static struct libusb_device emu_device;
+static struct libusb_device_handle emu_handle = { &emu_device };
+static libusb_device *emu_list[2] = { &emu_device, NULL };
+
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t emu_cond = PTHREAD_COND_INITIALIZER;
+
+static int emu_configured;
+static struct usb_emu_config emu_cfg = { 0, 0, 0, -40.0 };
+static struct usb_emu_stats emu_stats;
+
+static int emu_opened;
+static int emu_claimed;
+static uint8_t emu_demod[16][256];
+static uint8_t emu_regs[NUM_BLOCKS][0x10000];
+static uint8_t emu_tuner[TUNER_REGS];
+static uint8_t emu_eeprom[256];
+static uint8_t emu_eeprom_ptr;
+
+static unsigned emu_ctrl_seq;
+static unsigned emu_bulk_seq;
+static double emu_clock;		/* stream time of the last delivered sample */
+static unsigned emu_phase;
+static uint32_t emu_noise = 1;
+
+static struct emu_pending *emu_queue;
+static int emu_queued;
+static int emu_queue_size;
+
+static double emu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+static void emu_timespec(double t, struct timespec *ts)
+{
+	ts->tv_sec = (time_t)t;
+	ts->tv_nsec = (long)((t - (double)ts->tv_sec) * 1E9);
+}
+
+static void emu_read_env(void)
+{
+	const char *s;
+
+	if (emu_configured)
+		return;
+	emu_configured = 1;
+	if ((s = getenv("RTLEMU_RATE")))
+		emu_cfg.rate = atol(s);
+	if ((s = getenv("RTLEMU_BULK_ERRORS")))
+		emu_cfg.bulk_error_every = (unsigned)atoi(s);
+	if ((s = getenv("RTLEMU_CTRL_ERRORS")))
+		emu_cfg.ctrl_error_every = (unsigned)atoi(s);
+	if ((s = getenv("RTLEMU_SIGNAL")))
+		emu_cfg.signal_db = atof(s);
+	memset(emu_eeprom, 0xff, sizeof(emu_eeprom));
+}
+
+/* chip state after plugging in */
+static void emu_power_on(void)
+{
+	memset(emu_demod, 0, sizeof(emu_demod));
+	memset(emu_regs, 0, sizeof(emu_regs));
+	memset(emu_tuner, 0, sizeof(emu_tuner));
+	emu_tuner[0] = 0x96;	/* chip id: reads 0x69 (R82XX_CHECK_VAL) on the wire */
+	emu_tuner[2] = 0x40;	/* PLL locked */
+	emu_tuner[4] = 0x28;	/* vco fine tune 2, filter calibration code 8 */
+	emu_queued = 0;
+	emu_clock = 0.0;
+}
+
+static uint8_t bitrev(uint8_t byte)
+{
+	static const uint8_t lut[16] = { 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+					  0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf };
+
+	return (lut[byte & 0xf] << 4) | lut[byte >> 4];
+}
+
+/* tuner gain in tenth dB from the LNA, mixer and VGA registers */
+static int emu_gain(void)
+{
+	int i, gain = -47;
+	int lna = emu_tuner[0x05] & 0x0f;
+	int mixer = emu_tuner[0x07] & 0x0f;
+	int vga = emu_tuner[0x0c] & 0x0f;
+
+	/* LNA in auto mode: model the tuner agc holding the level at -10 dBFS */
+	if (!(emu_tuner[0x05] & 0x10))
+		return (int)((-10.0 - emu_cfg.signal_db) * 10.0);
+
+	for (i = 1; i <= lna; i++)
+		gain += lna_steps[i];
+	for (i = 1; i <= mixer; i++)
+		gain += mixer_steps[i];
+	for (i = 1; i <= vga; i++)
+		gain += vga_steps[i];
+	return gain;
+}
+
+/* samples/s of the resampler, see rtlsdr_set_sample_rate() */
+static double emu_rate(void)
+{
+	uint32_t ratio;
+
+	if (emu_cfg.rate)
+		return (double)emu_cfg.rate;
+
+	ratio = ((uint32_t)emu_demod[1][0x9f] << 24) | ((uint32_t)emu_demod[1][0xa0] << 16)
+		| ((uint32_t)emu_demod[1][0xa1] << 8) | emu_demod[1][0xa2];
+	ratio |= (ratio & 0x08000000) << 1;
+	if (!ratio)
+		return 2048000.0;
+	return EMU_XTAL * 4194304.0 / ratio;
+}
+
+static double emu_duration(int len)
+{
+	double rate = emu_rate();
+
+	if (rate <= 0.0)
+		return 0.0;
+	return (len / 2) / rate;
+}
+
+/* 8 bit I/Q: a tone at fs/16 and some noise, saturating like the ADC */
+static void emu_fill(unsigned char *buf, int len)
+{
+	int tab[32];
+	double a;
+	int i, k, v, clipped = 0;
+
+	emu_stats.gain = emu_gain();
+	a = 127.5 * pow(10.0, (emu_cfg.signal_db + emu_stats.gain * 0.1) / 20.0);
+	for (k = 0; k < 16; k++) {
+		tab[2*k] = (int)lrint(a * cos(2.0 * M_PI * k / 16.0));
+		tab[2*k+1] = (int)lrint(a * sin(2.0 * M_PI * k / 16.0));
+	}
+
+	for (i = 0; i < len; i++) {
+		k = 2 * (emu_phase & 15) + (i & 1);
+		emu_noise = emu_noise * 1103515245u + 12345u;
+		v = 128 + tab[k] + (int)((emu_noise >> 24) & 7) - 4;
+		if (v < 0 || v > 255) {
+			v = v < 0 ? 0 : 255;
+			clipped = 1;
+		}
+		buf[i] = (unsigned char)v;
+		if (i & 1)
+			++emu_phase;
+	}
+	if (clipped)
+		++emu_stats.clipped;
+}
+
+/* deliver one bulk transfer of the stream: 0 or -1 for an injected error */
+static int emu_bulk(unsigned char *buf, int len)
+{
+	emu_clock += emu_duration(len);
+	++emu_bulk_seq;
+	if (emu_cfg.bulk_error_every && !(emu_bulk_seq % emu_cfg.bulk_error_every)) {
+		++emu_stats.bulk_errors;
+		return -1;
+	}
+	emu_fill(buf, len);
+	++emu_stats.bulk_completed;
+	emu_stats.bulk_bytes += len;
+	return 0;
+}
+
+static int emu_i2c(int out, uint16_t addr, unsigned char *data, uint16_t len)
+{
+	int i;
+
+	if (out)
+		++emu_stats.i2c_out;
+	else
+		++emu_stats.i2c_in;
+
+	if (addr == R820T_ADDR) {
+		/* the tuner is only reachable through the i2c repeater */
+		if (!(emu_demod[1][0x01] & 0x08))
+			return LIBUSB_ERROR_PIPE;
+		if (out) {
+			for (i = 1; i < len; i++)
+				if (data[0] + i - 1 >= TUNER_RO_REGS && data[0] + i - 1 < TUNER_REGS)
+					emu_tuner[data[0] + i - 1] = data[i];
+			return len;
+		}
+		/* reads always start at register 0, bit reversed */
+		for (i = 0; i < len; i++)
+			data[i] = bitrev(emu_tuner[i % TUNER_REGS]);
+		return len;
+	}
+
+	if (addr == EEPROM_ADDR) {
+		if (out) {
+			if (len)
+				emu_eeprom_ptr = data[0];
+			for (i = 1; i < len; i++)
+				emu_eeprom[emu_eeprom_ptr++] = data[i];
+			return len;
+		}
+		for (i = 0; i < len; i++)
+			data[i] = emu_eeprom[emu_eeprom_ptr++];
+		return len;
+	}
+
+	/* no acknowledge */
+	return LIBUSB_ERROR_PIPE;
+}
+
+EMU_API int LIBUSB_CALL libusb_control_transfer(libusb_device_handle *devh,
+	uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+	unsigned char *data, uint16_t len, unsigned int timeout)
+{
+	int out = !(request_type & LIBUSB_ENDPOINT_IN);
+	int block = index >> 8;
+	int i, r = len;
+	uint8_t *mem;
+
+	pthread_mutex_lock(&emu_lock);
+	if (out)
+		++emu_stats.ctrl_out;
+	else
+		++emu_stats.ctrl_in;
+	++emu_ctrl_seq;
+
+	if (!emu_opened || devh != &emu_handle) {
+		r = LIBUSB_ERROR_NO_DEVICE;
+	} else if (emu_cfg.ctrl_error_every && !(emu_ctrl_seq % emu_cfg.ctrl_error_every)) {
+		r = LIBUSB_ERROR_PIPE;
+	} else if (!block) {
+		/* demodulator: value = (addr << 8) | 0x20, index = page */
+		mem = &emu_demod[index & 0x0f][0];
+		for (i = 0; i < len; i++) {
+			if (out)
+				mem[((value >> 8) + i) & 0xff] = data[i];
+			else
+				data[i] = mem[((value >> 8) + i) & 0xff];
+		}
+	} else if (block == IICB) {
+		r = emu_i2c(out, value, data, len);
+	} else {
+		if (block == SYSB && (index & 0x0f) == 0x01)
+			block = IRB;
+		mem = &emu_regs[block % NUM_BLOCKS][0];
+		for (i = 0; i < len; i++) {
+			if (out)
+				mem[(value + i) & 0xffff] = data[i];
+			else
+				data[i] = mem[(value + i) & 0xffff];
+		}
+	}
+
+	if (r < 0)
+		++emu_stats.ctrl_errors;
+	pthread_mutex_unlock(&emu_lock);
+	return r;
+}
+
+EMU_API int LIBUSB_CALL libusb_bulk_transfer(libusb_device_handle *devh,
+	unsigned char endpoint, unsigned char *data, int length,
+	int *transferred, unsigned int timeout)
+{
+	struct timespec ts;
+	double now, until;
+	int r;
+
+	*transferred = 0;
+	pthread_mutex_lock(&emu_lock);
+	if (!emu_opened || devh != &emu_handle) {
+		pthread_mutex_unlock(&emu_lock);
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+	now = emu_now();
+	if (emu_clock < now)
+		emu_clock = now;
+	r = emu_bulk(data, length);
+	until = emu_clock;
+	pthread_mutex_unlock(&emu_lock);
+
+	/* the data is there when the ADC has produced it */
+	if (until > now) {
+		emu_timespec(until - now, &ts);
+		nanosleep(&ts, NULL);
+	}
+	if (r < 0)
+		return LIBUSB_ERROR_IO;
+	*transferred = length;
+	return 0;
+}
+
+EMU_API struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer(int iso_packets)
+{
+	/* bulk only */
+	if (iso_packets)
+		return NULL;
+	return calloc(1, sizeof(struct libusb_transfer));
+}
+
+EMU_API void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer *xfer)
+{
+	free(xfer);
+}
+
+EMU_API int LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer *xfer)
+{
+	struct emu_pending *q;
+	double now;
+	int i, r = 0;
+
+	pthread_mutex_lock(&emu_lock);
+	if (!emu_opened || xfer->dev_handle != &emu_handle)
+		r = LIBUSB_ERROR_NO_DEVICE;
+	for (i = 0; !r && i < emu_queued; i++)
+		if (emu_queue[i].xfer == xfer)
+			r = LIBUSB_ERROR_BUSY;
+	if (!r && emu_queued == emu_queue_size) {
+		q = realloc(emu_queue, (emu_queue_size + 16) * sizeof(struct emu_pending));
+		if (q) {
+			emu_queue = q;
+			emu_queue_size += 16;
+		} else
+			r = LIBUSB_ERROR_NO_MEM;
+	}
+	if (!r) {
+		/* no data gets captured while no transfer is pending */
+		now = emu_now();
+		if (!emu_queued && emu_clock < now)
+			emu_clock = now;
+		emu_queue[emu_queued].xfer = xfer;
+		emu_queue[emu_queued].cancelled = 0;
+		if (++emu_queued > (int)emu_stats.max_queued)
+			emu_stats.max_queued = emu_queued;
+		pthread_cond_signal(&emu_cond);
+	}
+	pthread_mutex_unlock(&emu_lock);
+	return r;
+}
+
+EMU_API int LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer *xfer)
+{
+	int i, r = LIBUSB_ERROR_NOT_FOUND;
+
+	pthread_mutex_lock(&emu_lock);
+	for (i = 0; i < emu_queued; i++) {
+		if (emu_queue[i].xfer == xfer && !emu_queue[i].cancelled) {
+			emu_queue[i].cancelled = 1;
+			pthread_cond_signal(&emu_cond);
+			r = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&emu_lock);
+	return r;
+}
+
+static void emu_dequeue(int i)
+{
+	--emu_queued;
+	memmove(&emu_queue[i], &emu_queue[i + 1], (emu_queued - i) * sizeof(struct emu_pending));
+}
+
+/* the transfer to hand back now - or NULL and when the next one is due */
+static struct libusb_transfer *emu_next_event(double *due)
+{
+	struct libusb_transfer *xfer;
+	double now = emu_now();
+	int i;
+
+	*due = now + 3600.0;
+	for (i = 0; i < emu_queued; i++) {
+		if (emu_queue[i].cancelled) {
+			xfer = emu_queue[i].xfer;
+			emu_dequeue(i);
+			xfer->status = LIBUSB_TRANSFER_CANCELLED;
+			xfer->actual_length = 0;
+			++emu_stats.bulk_cancelled;
+			return xfer;
+		}
+	}
+	if (!emu_queued)
+		return NULL;
+
+	xfer = emu_queue[0].xfer;
+	if (emu_clock + emu_duration(xfer->length) > now) {
+		*due = emu_clock + emu_duration(xfer->length);
+		return NULL;
+	}
+	emu_dequeue(0);
+	if (emu_bulk(xfer->buffer, xfer->length) < 0) {
+		xfer->status = LIBUSB_TRANSFER_ERROR;
+		xfer->actual_length = 0;
+	} else {
+		xfer->status = LIBUSB_TRANSFER_COMPLETED;
+		xfer->actual_length = xfer->length;
+	}
+	return xfer;
+}
+
+EMU_API int LIBUSB_CALL libusb_handle_events_timeout_completed(libusb_context *ctx,
+	struct timeval *tv, int *completed)
+{
+	struct libusb_transfer *xfer;
+	struct timespec ts;
+	double deadline, due;
+	int handled = 0, budget;
+
+	pthread_mutex_lock(&emu_lock);
+	deadline = emu_now() + (tv ? tv->tv_sec + tv->tv_usec * 1E-6 : 60.0);
+	/* one round like a poll(): resubmitted transfers wait for the next call */
+	budget = emu_queued;
+	while (!(completed && *completed)) {
+		due = deadline;
+		xfer = handled < budget ? emu_next_event(&due) : NULL;
+		if (xfer) {
+			/* callbacks resubmit: call them unlocked */
+			pthread_mutex_unlock(&emu_lock);
+			xfer->callback(xfer);
+			pthread_mutex_lock(&emu_lock);
+			++handled;
+			continue;
+		}
+		if (handled || emu_now() >= deadline)
+			break;
+		budget = emu_queued;
+		emu_timespec(due < deadline ? due : deadline, &ts);
+		pthread_cond_timedwait(&emu_cond, &emu_lock, &ts);
+	}
+	pthread_mutex_unlock(&emu_lock);
+	return 0;
+}
+
+EMU_API int LIBUSB_CALL libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv)
+{
+	return libusb_handle_events_timeout_completed(ctx, tv, NULL);
+}
+
+#if LIBUSB_API_VERSION >= 0x01000105
+EMU_API unsigned char * LIBUSB_CALL libusb_dev_mem_alloc(libusb_device_handle *devh, size_t length)
+{
+	return malloc(length);
+}
+
+EMU_API int LIBUSB_CALL libusb_dev_mem_free(libusb_device_handle *devh,
+	unsigned char *buffer, size_t length)
+{
+	free(buffer);
+	return 0;
+}
+#endif
+
+EMU_API int LIBUSB_CALL libusb_init(libusb_context **ctx)
+{
+	pthread_mutex_lock(&emu_lock);
+	emu_read_env();
+	pthread_mutex_unlock(&emu_lock);
+	if (ctx)
+		*ctx = &emu_ctx;
+	return 0;
+}
+
+EMU_API void LIBUSB_CALL libusb_exit(libusb_context *ctx)
+{
+}
+
+EMU_API ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	*list = emu_list;
+	return 1;
+}
+
+EMU_API void LIBUSB_CALL libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+}
+
+EMU_API int LIBUSB_CALL libusb_get_device_descriptor(libusb_device *dev,
+	struct libusb_device_descriptor *desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->idVendor = EMU_VID;
+	desc->idProduct = EMU_PID;
+	desc->iManufacturer = 1;
+	desc->iProduct = 2;
+	desc->iSerialNumber = 3;
+	return 0;
+}
+
+EMU_API libusb_device * LIBUSB_CALL libusb_get_device(libusb_device_handle *devh)
+{
+	return devh->dev;
+}
+
+EMU_API int LIBUSB_CALL libusb_get_string_descriptor_ascii(libusb_device_handle *devh,
+	uint8_t desc_index, unsigned char *data, int length)
+{
+	static const char *strings[] = { "", "Realtek", "RTL2838UHIDIR", "00000001" };
+	int len;
+
+	if (desc_index >= sizeof(strings) / sizeof(strings[0]) || length < 1)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	len = (int)strlen(strings[desc_index]);
+	if (len > length - 1)
+		len = length - 1;
+	memcpy(data, strings[desc_index], len);
+	data[len] = 0;
+	return len;
+}
+
+EMU_API int LIBUSB_CALL libusb_open(libusb_device *dev, libusb_device_handle **devh)
+{
+	if (dev != &emu_device)
+		return LIBUSB_ERROR_NO_DEVICE;
+	pthread_mutex_lock(&emu_lock);
+	if (!emu_opened++)
+		emu_power_on();
+	pthread_mutex_unlock(&emu_lock);
+	*devh = &emu_handle;
+	return 0;
+}
+
+EMU_API void LIBUSB_CALL libusb_close(libusb_device_handle *devh)
+{
+	pthread_mutex_lock(&emu_lock);
+	if (emu_opened)
+		--emu_opened;
+	pthread_mutex_unlock(&emu_lock);
+}
+
+EMU_API int LIBUSB_CALL libusb_kernel_driver_active(libusb_device_handle *devh, int interface_number)
+{
+	return 0;
+}
+
+EMU_API int LIBUSB_CALL libusb_detach_kernel_driver(libusb_device_handle *devh, int interface_number)
+{
+	return 0;
+}
+
+EMU_API int LIBUSB_CALL libusb_attach_kernel_driver(libusb_device_handle *devh, int interface_number)
+{
+	return 0;
+}
+
+EMU_API int LIBUSB_CALL libusb_claim_interface(libusb_device_handle *devh, int interface_number)
+{
+	int r = 0;
+
+	pthread_mutex_lock(&emu_lock);
+	if (emu_claimed)
+		r = LIBUSB_ERROR_BUSY;
+	else
+		emu_claimed = 1;
+	pthread_mutex_unlock(&emu_lock);
+	return r;
+}
+
+EMU_API int LIBUSB_CALL libusb_release_interface(libusb_device_handle *devh, int interface_number)
+{
+	pthread_mutex_lock(&emu_lock);
+	emu_claimed = 0;
+	pthread_mutex_unlock(&emu_lock);
+	return 0;
+}
+
+EMU_API int LIBUSB_CALL libusb_reset_device(libusb_device_handle *devh)
+{
+	return 0;
+}
+
+EMU_API const char * LIBUSB_CALL libusb_error_name(int error_code)
+{
+	return error_code < 0 ? "LIBUSB_EMU_ERROR" : "LIBUSB_SUCCESS";
+}
+
+void usb_emu_get_config(struct usb_emu_config *cfg)
+{
+	pthread_mutex_lock(&emu_lock);
+	emu_read_env();
+	*cfg = emu_cfg;
+	pthread_mutex_unlock(&emu_lock);
+}
+
+void usb_emu_set_config(const struct usb_emu_config *cfg)
+{
+	pthread_mutex_lock(&emu_lock);
+	emu_read_env();
+	emu_cfg = *cfg;
+	emu_ctrl_seq = 0;
+	emu_bulk_seq = 0;
+	pthread_cond_signal(&emu_cond);
+	pthread_mutex_unlock(&emu_lock);
+}
+
+void usb_emu_get_stats(struct usb_emu_stats *stats, int reset)
+{
+	pthread_mutex_lock(&emu_lock);
+	emu_stats.gain = emu_gain();
+	if (stats)
+		*stats = emu_stats;
+	if (reset)
+		memset(&emu_stats, 0, sizeof(emu_stats));
+	pthread_mutex_unlock(&emu_lock);
+}
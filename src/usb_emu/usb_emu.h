@@ -0,0 +1,73 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ * usb_emu, replacement of the libusb functions used by librtlsdr
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __USB_EMU_H
+#define __USB_EMU_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* usb_emu.c implements libusb_init(), libusb_control_transfer(),
+ * libusb_submit_transfer(), libusb_handle_events_timeout_completed() ..
+ * for one emulated RTL2832U with an R820T tuner.
+ * Link it in front of libusb or LD_PRELOAD the module build of it.
+ *
+ * The configuration is read from the environment at libusb_init():
+ *   RTLEMU_RATE=<samples/s>   bulk data rate, 0 (default): follow the
+ *                             programmed resampler, -1: as fast as possible
+ *   RTLEMU_BULK_ERRORS=<n>    fail every n-th bulk transfer
+ *   RTLEMU_CTRL_ERRORS=<n>    fail every n-th control transfer
+ *   RTLEMU_SIGNAL=<dBFS>      tone level at 0 dB tuner gain, default -40
+ */
+
+struct usb_emu_config {
+	long rate;					/* samples/s, 0: programmed resampler, < 0: unthrottled */
+	unsigned bulk_error_every;	/* fail every n-th bulk transfer, 0: never */
+	unsigned ctrl_error_every;	/* fail every n-th control transfer, 0: never */
+	double signal_db;			/* tone level in dBFS at 0 dB tuner gain */
+};
+
+struct usb_emu_stats {
+	uint32_t ctrl_in;			/* control transfers seen by the device */
+	uint32_t ctrl_out;
+	uint32_t ctrl_errors;		/* injected or not acknowledged */
+	uint32_t i2c_in;			/* part of the above: i2c reads and writes */
+	uint32_t i2c_out;
+	uint32_t bulk_completed;	/* bulk transfers, sync and async */
+	uint32_t bulk_errors;		/* injected bulk errors */
+	uint32_t bulk_cancelled;
+	uint32_t clipped;			/* transfers with ADC overload */
+	uint32_t max_queued;		/* most async transfers in flight */
+	uint64_t bulk_bytes;
+	int gain;					/* tuner gain model in tenth dB */
+};
+
+/* get/set the emulation parameters - effective with the next transfer */
+void usb_emu_get_config(struct usb_emu_config *cfg);
+void usb_emu_set_config(const struct usb_emu_config *cfg);
+
+/* device side view of the transfers - to cross check rtlsdr_get_usb_stats() */
+void usb_emu_get_stats(struct usb_emu_stats *stats, int reset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__USB_EMU_H*/